@@ -0,0 +1,212 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "libfileserver.h"
+
+/*
+ * Latency of switching a thread to a client identity and back with
+ * credential tokens, one registered for each user and one for the
+ * server itself, against the setthread* syscalls:
+ * - setthreadtoken to the user, then to the server;
+ * - setthreadgroups, setthreadgid and setthreaduid, and back with the
+ *   same three calls, the uid first since only root may set the groups;
+ * - pushthreadcred and popthreadcred.
+ * The users are switched to in turn.  Must run as root.
+ */
+
+#define	BENCH_ID_BASE	10000
+
+static int ngroups = 16;
+static int users = 1024;
+static int rounds = 5;
+static long iterations = 100000;
+
+static gid_t **groups;		/* the groups of each user */
+static int *tokens;		/* the token of each user */
+static int srvtoken;
+static gid_t *srvgroups;	/* the groups of the server, not the egid */
+static int nsrvgroups;
+
+static void
+cycletoken(int u)
+{
+
+	if (fileserver_setthreadtoken(tokens[u]) == -1)
+		err(1, "setthreadtoken");
+	if (fileserver_setthreadtoken(srvtoken) == -1)
+		err(1, "setthreadtoken");
+}
+
+static void
+cycle3(int u)
+{
+
+	if (fileserver_setthreadgroups(ngroups, groups[u]) == -1)
+		err(1, "setthreadgroups");
+	if (fileserver_setthreadgid(BENCH_ID_BASE + u) == -1)
+		err(1, "setthreadgid");
+	if (fileserver_setthreaduid(BENCH_ID_BASE + u) == -1)
+		err(1, "setthreaduid");
+	if (fileserver_setthreaduid(getuid()) == -1)
+		err(1, "setthreaduid");
+	if (fileserver_setthreadgid(getgid()) == -1)
+		err(1, "setthreadgid");
+	if (fileserver_setthreadgroups(nsrvgroups, srvgroups) == -1)
+		err(1, "setthreadgroups");
+}
+
+static void
+cyclepush(int u)
+{
+
+	if (fileserver_pushthreadcred(BENCH_ID_BASE + u, BENCH_ID_BASE + u,
+	    ngroups, groups[u]) == -1)
+		err(1, "pushthreadcred");
+	if (fileserver_popthreadcred() == -1)
+		err(1, "popthreadcred");
+}
+
+static void
+run(const char *name, void (*cycle)(int))
+{
+	double *ns;
+	uint64_t start;
+	long i;
+	int r;
+
+	ns = calloc(rounds, sizeof(*ns));
+	if (ns == NULL)
+		err(1, "calloc");
+	for (r = 0; r < rounds; r++) {
+		start = bench_nsec();
+		for (i = 0; i < iterations; i++)
+			cycle(i % users);
+		ns[r] = (double)(bench_nsec() - start) / iterations;
+	}
+	printf("%-44s %10.0f %10.0f\n", name, bench_median(ns, rounds), ns[0]);
+	free(ns);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: credtokenbench [-g ngroups] "
+	    "[-i iterations] [-r rounds] [-u users]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	gid_t *procgroups;
+	long ngroups_max;
+	int ch, i, j, n;
+
+	while ((ch = getopt(argc, argv, "g:i:r:u:")) != -1) {
+		switch (ch) {
+		case 'g':
+			ngroups = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atol(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'u':
+			users = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	ngroups_max = sysconf(_SC_NGROUPS_MAX);
+	if (ngroups < 0 || ngroups >= ngroups_max || iterations <= 0 ||
+	    rounds <= 0 || users <= 0)
+		usage();
+
+	if (fileserver_init() == -1)
+		err(1, "fileserver_init");
+	if (!fileserver_has(FILESERVER_CAP_CREDTOKEN))
+		errx(1, "credtoken is not loaded");
+	if (!fileserver_has(FILESERVER_CAP_THREADCRED))
+		errx(1, "setthreadcred is not loaded");
+
+	/* cr_groups[0] is the egid, the setthread* calls take the rest. */
+	procgroups = calloc(ngroups_max, sizeof(gid_t));
+	if (procgroups == NULL)
+		err(1, "calloc");
+	n = getgroups(ngroups_max, procgroups);
+	if (n == -1)
+		err(1, "getgroups");
+	srvgroups = procgroups + (n > 0 ? 1 : 0);
+	nsrvgroups = n > 0 ? n - 1 : 0;
+	srvtoken = fileserver_credtoken_register(getuid(), getgid(),
+	    nsrvgroups, srvgroups);
+	if (srvtoken == -1)
+		err(1, "credtoken_register");
+
+	groups = calloc(users, sizeof(*groups));
+	tokens = calloc(users, sizeof(*tokens));
+	if (groups == NULL || tokens == NULL)
+		err(1, "calloc");
+	for (i = 0; i < users; i++) {
+		groups[i] = calloc(ngroups + 1, sizeof(gid_t));
+		if (groups[i] == NULL)
+			err(1, "calloc");
+		for (j = 0; j < ngroups; j++)
+			groups[i][j] = BENCH_ID_BASE + i + j;
+		tokens[i] = fileserver_credtoken_register(BENCH_ID_BASE + i,
+		    BENCH_ID_BASE + i, ngroups, groups[i]);
+		if (tokens[i] == -1)
+			err(1, "credtoken_register");
+	}
+
+	printf("%d users, %d groups, %ld iterations, %d rounds\n", users,
+	    ngroups, iterations, rounds);
+	printf("%-44s %10s %10s\n", "ns per switch and back", "median",
+	    "best");
+	run("setthreadtoken", cycletoken);
+	run("setthreadgroups+setthreadgid+setthreaduid", cycle3);
+	run("pushthreadcred+popthreadcred", cyclepush);
+
+	for (i = 0; i < users; i++)
+		fileserver_credtoken_unregister(tokens[i]);
+	fileserver_credtoken_unregister(srvtoken);
+	return (0);
+}
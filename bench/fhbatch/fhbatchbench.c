@@ -0,0 +1,197 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "libfileserver.h"
+
+/*
+ * Latency per operation of fhbatch, for batches of 1 to FHBATCH_MAX
+ * operations, against one syscall per operation: fhreadlink for
+ * FHBATCH_READLINK, fhgetattrs of the type only for FHBATCH_RESOLVE.
+ * The operations go over FHBATCH_MAX symlinks created in the given
+ * directory, all on the same mount so that a batch busies it once.
+ * Must run as root.
+ */
+
+#define	BENCH_LINKLEN	64
+
+static int rounds = 5;
+static long nops = 1000000;	/* operations per round */
+static int opcode = FHBATCH_READLINK;
+
+static fhandle_t fhs[FHBATCH_MAX];
+static char bufs[FHBATCH_MAX][BENCH_LINKLEN];
+static struct fhbatch_op ops[FHBATCH_MAX];
+
+static void
+single(int i)
+{
+	struct fhattrs fa;
+
+	if (opcode == FHBATCH_READLINK) {
+		if (fileserver_fhreadlink(&fhs[i], bufs[i],
+		    BENCH_LINKLEN) == -1)
+			err(1, "fhreadlink");
+	} else {
+		if (fileserver_fhgetattrs(&fhs[i], FHATTR_TYPE, &fa) == -1)
+			err(1, "fhgetattrs");
+	}
+}
+
+static void
+batch(int n)
+{
+	int i;
+
+	if (fileserver_fhbatch(ops, n) == -1)
+		err(1, "fhbatch");
+	for (i = 0; i < n; i++)
+		if (ops[i].fbo_error != 0)
+			errc(1, ops[i].fbo_error, "fhbatch op %d", i);
+}
+
+/* Median over the rounds of the ns per operation. */
+static double
+measure(int n, int batched)
+{
+	double *ns;
+	double median;
+	uint64_t start;
+	long calls, i;
+	int j, r;
+
+	calls = nops / n > 0 ? nops / n : 1;
+	ns = calloc(rounds, sizeof(*ns));
+	if (ns == NULL)
+		err(1, "calloc");
+	for (r = 0; r < rounds; r++) {
+		start = bench_nsec();
+		for (i = 0; i < calls; i++) {
+			if (batched)
+				batch(n);
+			else
+				for (j = 0; j < n; j++)
+					single(j);
+		}
+		ns[r] = (double)(bench_nsec() - start) / (calls * n);
+	}
+	median = bench_median(ns, rounds);
+	free(ns);
+	return (median);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: fhbatchbench [-n operations] [-o readlink | "
+	    "resolve] [-r rounds] directory\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	char path[MAXPATHLEN], target[BENCH_LINKLEN];
+	double bns, sns;
+	int ch, i, n;
+
+	while ((ch = getopt(argc, argv, "n:o:r:")) != -1) {
+		switch (ch) {
+		case 'n':
+			nops = atol(optarg);
+			break;
+		case 'o':
+			if (strcmp(optarg, "readlink") == 0)
+				opcode = FHBATCH_READLINK;
+			else if (strcmp(optarg, "resolve") == 0)
+				opcode = FHBATCH_RESOLVE;
+			else
+				usage();
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1 || nops <= 0 || rounds <= 0)
+		usage();
+
+	if (fileserver_init() == -1)
+		err(1, "fileserver_init");
+	if (!fileserver_has(FILESERVER_CAP_BATCH))
+		errx(1, "fhbatch is not loaded");
+	if (opcode == FHBATCH_RESOLVE &&
+	    !fileserver_has(FILESERVER_CAP_GETATTRS))
+		errx(1, "fhgetattrs is not loaded");
+
+	for (i = 0; i < FHBATCH_MAX; i++) {
+		snprintf(path, sizeof(path), "%s/fhbatchbench.%d", argv[0], i);
+		snprintf(target, sizeof(target), "fhbatchbench.target.%d", i);
+		(void)unlink(path);
+		if (symlink(target, path) == -1)
+			err(1, "symlink %s", path);
+		if (lgetfh(path, &fhs[i]) == -1)
+			err(1, "lgetfh %s", path);
+		ops[i].fbo_op = opcode;
+		ops[i].fbo_fhp = &fhs[i];
+		ops[i].fbo_buf = bufs[i];
+		ops[i].fbo_bufsize = BENCH_LINKLEN;
+	}
+
+	printf("%s, %ld operations, %d rounds\n",
+	    opcode == FHBATCH_READLINK ? "readlink" : "resolve", nops, rounds);
+	printf("%6s  %12s  %12s  %12s  %8s\n", "batch", "syscalls/op",
+	    "fhbatch ns", "single ns", "speedup");
+	for (n = 1; n <= FHBATCH_MAX; n *= 2) {
+		bns = measure(n, 1);
+		sns = measure(n, 0);
+		printf("%6d  %12.4f  %12.1f  %12.1f  %8.2f\n", n, 1.0 / n, bns,
+		    sns, sns / bns);
+	}
+
+	for (i = 0; i < FHBATCH_MAX; i++) {
+		snprintf(path, sizeof(path), "%s/fhbatchbench.%d", argv[0], i);
+		(void)unlink(path);
+	}
+	return (0);
+}
@@ -0,0 +1,327 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "libfileserver.h"
+
+/*
+ * Handle resolution through the fhresolve vnode cache, over 1M distinct
+ * files accessed with a Zipfian distribution, as the handles an NFS
+ * server sees from its clients.  The files are created under the given
+ * directory, 1000 per subdirectory, and resolved with fhgetattrs of the
+ * type only.  The access sequence is drawn beforehand and the ranks are
+ * shuffled over the files.  It runs with the cache as configured, then
+ * with kern.fhresolve.vnode_max set to 0, which disables it.  Must run
+ * as root.
+ */
+
+#define	BENCH_PERDIR	1000
+
+static int rounds = 5;
+static long nfiles = 1000000;
+static long iterations = 1000000;
+static double exponent = 0.99;
+static int keep;
+
+static const char *topdir;
+static u_int vnode_max;
+static fhandle_t *fhs;
+static u_int *seq;
+
+static uint64_t
+xorshift64(uint64_t *state)
+{
+	uint64_t x;
+
+	x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return (x * 2685821657736338717ULL);
+}
+
+/* Uniform in [0, 1). */
+static double
+uniform(uint64_t *state)
+{
+
+	return ((xorshift64(state) >> 11) * (1.0 / (1ULL << 53)));
+}
+
+/*
+ * Draw the access sequence: rank k is taken with a probability
+ * proportional to 1 / k^exponent, and maps to a random file.
+ */
+static void
+zipf(void)
+{
+	double *cdf;
+	double sum, u;
+	uint64_t state;
+	u_int *perm, t;
+	long i, j, lo, hi;
+
+	cdf = calloc(nfiles, sizeof(*cdf));
+	perm = calloc(nfiles, sizeof(*perm));
+	seq = calloc(iterations, sizeof(*seq));
+	if (cdf == NULL || perm == NULL || seq == NULL)
+		err(1, "calloc");
+	sum = 0;
+	for (i = 0; i < nfiles; i++) {
+		sum += 1.0 / pow(i + 1, exponent);
+		cdf[i] = sum;
+	}
+	state = 88172645463325252ULL;
+	for (i = 0; i < nfiles; i++)
+		perm[i] = i;
+	for (i = nfiles - 1; i > 0; i--) {
+		j = xorshift64(&state) % (i + 1);
+		t = perm[i];
+		perm[i] = perm[j];
+		perm[j] = t;
+	}
+	for (i = 0; i < iterations; i++) {
+		u = uniform(&state) * sum;
+		lo = 0;
+		hi = nfiles - 1;
+		while (lo < hi) {
+			j = (lo + hi) / 2;
+			if (cdf[j] < u)
+				lo = j + 1;
+			else
+				hi = j;
+		}
+		seq[i] = perm[lo];
+	}
+	free(perm);
+	free(cdf);
+}
+
+static void
+filepath(char *path, size_t size, long i)
+{
+
+	snprintf(path, size, "%s/fhcachebench.%ld/%ld", topdir,
+	    i / BENCH_PERDIR, i % BENCH_PERDIR);
+}
+
+static void
+create_files(void)
+{
+	char path[MAXPATHLEN];
+	long i;
+	int fd;
+
+	for (i = 0; i < nfiles; i++) {
+		if (i % BENCH_PERDIR == 0) {
+			snprintf(path, sizeof(path), "%s/fhcachebench.%ld",
+			    topdir, i / BENCH_PERDIR);
+			if (mkdir(path, 0755) == -1 && errno != EEXIST)
+				err(1, "mkdir %s", path);
+		}
+		filepath(path, sizeof(path), i);
+		fd = open(path, O_WRONLY | O_CREAT, 0644);
+		if (fd == -1)
+			err(1, "%s", path);
+		close(fd);
+		if (getfh(path, &fhs[i]) == -1)
+			err(1, "getfh %s", path);
+	}
+}
+
+static void
+remove_files(void)
+{
+	char path[MAXPATHLEN];
+	long i;
+
+	for (i = 0; i < nfiles; i++) {
+		filepath(path, sizeof(path), i);
+		(void)unlink(path);
+		if (i % BENCH_PERDIR == BENCH_PERDIR - 1 || i == nfiles - 1) {
+			snprintf(path, sizeof(path), "%s/fhcachebench.%ld",
+			    topdir, i / BENCH_PERDIR);
+			(void)rmdir(path);
+		}
+	}
+}
+
+static uint64_t
+counter(const char *name)
+{
+	uint64_t value;
+	size_t len;
+
+	len = sizeof(value);
+	if (sysctlbyname(name, &value, &len, NULL, 0) == -1)
+		err(1, "%s", name);
+	return (value);
+}
+
+static void
+set_vnode_max(u_int max)
+{
+
+	if (sysctlbyname("kern.fhresolve.vnode_max", NULL, NULL, &max,
+	    sizeof(max)) == -1)
+		err(1, "kern.fhresolve.vnode_max");
+}
+
+/* Also on the way out of an error. */
+static void
+restore_vnode_max(void)
+{
+
+	(void)sysctlbyname("kern.fhresolve.vnode_max", NULL, NULL,
+	    &vnode_max, sizeof(vnode_max));
+}
+
+static void
+run(const char *name)
+{
+	struct fhattrs fa;
+	double *ns;
+	uint64_t start, hits, misses, evictions;
+	long i;
+	int r;
+
+	ns = calloc(rounds, sizeof(*ns));
+	if (ns == NULL)
+		err(1, "calloc");
+	hits = counter("kern.fhresolve.vnode_hits");
+	misses = counter("kern.fhresolve.vnode_misses");
+	evictions = counter("kern.fhresolve.vnode_evictions");
+	for (r = 0; r < rounds; r++) {
+		start = bench_nsec();
+		for (i = 0; i < iterations; i++)
+			if (fileserver_fhgetattrs(&fhs[seq[i]], FHATTR_TYPE,
+			    &fa) == -1)
+				err(1, "fhgetattrs");
+		ns[r] = (double)(bench_nsec() - start) / iterations;
+	}
+	hits = counter("kern.fhresolve.vnode_hits") - hits;
+	misses = counter("kern.fhresolve.vnode_misses") - misses;
+	evictions = counter("kern.fhresolve.vnode_evictions") - evictions;
+	printf("%-16s  %10.1f  %10.1f  %8.1f%%  %12ju\n", name,
+	    bench_median(ns, rounds), ns[0],
+	    hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0,
+	    (uintmax_t)evictions);
+	free(ns);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: fhcachebench [-k] [-i iterations] "
+	    "[-n files] [-r rounds] [-s exponent]\n"
+	    "                    directory\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	char name[32];
+	size_t len;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "i:kn:r:s:")) != -1) {
+		switch (ch) {
+		case 'i':
+			iterations = atol(optarg);
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		case 'n':
+			nfiles = atol(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			exponent = strtod(optarg, NULL);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1 || iterations <= 0 || nfiles <= 0 || rounds <= 0 ||
+	    exponent < 0)
+		usage();
+	topdir = argv[0];
+
+	if (fileserver_init() == -1)
+		err(1, "fileserver_init");
+	if (!fileserver_has(FILESERVER_CAP_GETATTRS))
+		errx(1, "fhgetattrs is not loaded");
+
+	len = sizeof(vnode_max);
+	if (sysctlbyname("kern.fhresolve.vnode_max", &vnode_max, &len, NULL,
+	    0) == -1)
+		err(1, "kern.fhresolve.vnode_max");
+	atexit(restore_vnode_max);
+	fhs = calloc(nfiles, sizeof(*fhs));
+	if (fhs == NULL)
+		err(1, "calloc");
+	create_files();
+	zipf();
+
+	printf("%ld files, zipf exponent %.2f, %ld calls, %d rounds\n",
+	    nfiles, exponent, iterations, rounds);
+	printf("%-16s  %10s  %10s  %9s  %12s\n", "vnode_max", "median ns",
+	    "best ns", "hit rate", "evictions");
+	snprintf(name, sizeof(name), "%u", vnode_max);
+	run(name);
+	set_vnode_max(0);
+	run("0 (disabled)");
+	set_vnode_max(vnode_max);
+
+	if (!keep)
+		remove_files();
+	return (0);
+}
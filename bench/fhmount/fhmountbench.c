@@ -0,0 +1,216 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <sys/uio.h>
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "libfileserver.h"
+
+/*
+ * Cost per call of resolving handles spread over 10, 1,000 and 10,000
+ * mounts.  tmpfs filesystems are mounted under the given directory up
+ * to each count, and the roots of all of them are resolved in turn with
+ * fhgetattrs of the type only, which finds the mount in the fsid index
+ * of fhresolve, and with fhstat(2), which walks the mountlist.  The
+ * mounts are all unmounted at exit.  Must run as root.
+ */
+
+static int rounds = 5;
+static long iterations = 1000000;
+static int counts[] = { 10, 1000, 10000 };
+
+static const char *topdir;
+static fhandle_t *fhs;
+static int nmounts;
+
+static void
+mountpath(char *path, size_t size, int i)
+{
+
+	snprintf(path, size, "%s/fhmountbench.%d", topdir, i);
+}
+
+static void
+mount_tmpfs(int i)
+{
+	char path[MAXPATHLEN];
+	struct iovec iov[4];
+
+	mountpath(path, sizeof(path), i);
+	if (mkdir(path, 0755) == -1 && errno != EEXIST)
+		err(1, "mkdir %s", path);
+	iov[0].iov_base = __DECONST(char *, "fstype");
+	iov[0].iov_len = sizeof("fstype");
+	iov[1].iov_base = __DECONST(char *, "tmpfs");
+	iov[1].iov_len = sizeof("tmpfs");
+	iov[2].iov_base = __DECONST(char *, "fspath");
+	iov[2].iov_len = sizeof("fspath");
+	iov[3].iov_base = path;
+	iov[3].iov_len = strlen(path) + 1;
+	if (nmount(iov, 4, 0) == -1)
+		err(1, "nmount %s", path);
+	nmounts = i + 1;
+	if (getfh(path, &fhs[i]) == -1)
+		err(1, "getfh %s", path);
+}
+
+static void
+unmount_all(void)
+{
+	char path[MAXPATHLEN];
+
+	while (nmounts > 0) {
+		mountpath(path, sizeof(path), --nmounts);
+		if (unmount(path, 0) == -1)
+			warn("unmount %s", path);
+		else
+			(void)rmdir(path);
+	}
+}
+
+static uint64_t
+counter(const char *name)
+{
+	uint64_t value;
+	size_t len;
+
+	len = sizeof(value);
+	if (sysctlbyname(name, &value, &len, NULL, 0) == -1)
+		err(1, "%s", name);
+	return (value);
+}
+
+/* Median over the rounds of the ns per call. */
+static double
+measure(int n, int index)
+{
+	struct fhattrs fa;
+	struct stat sb;
+	double *ns;
+	double median;
+	uint64_t start;
+	long i;
+	int r;
+
+	ns = calloc(rounds, sizeof(*ns));
+	if (ns == NULL)
+		err(1, "calloc");
+	for (r = 0; r < rounds; r++) {
+		start = bench_nsec();
+		for (i = 0; i < iterations; i++) {
+			if (index) {
+				if (fileserver_fhgetattrs(&fhs[i % n],
+				    FHATTR_TYPE, &fa) == -1)
+					err(1, "fhgetattrs");
+			} else {
+				if (fhstat(&fhs[i % n], &sb) == -1)
+					err(1, "fhstat");
+			}
+		}
+		ns[r] = (double)(bench_nsec() - start) / iterations;
+	}
+	median = bench_median(ns, rounds);
+	free(ns);
+	return (median);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: fhmountbench [-i iterations] [-r rounds] "
+	    "directory\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t hits, misses;
+	double fhgetattrs_ns, fhstat_ns;
+	size_t c;
+	int ch, n;
+
+	while ((ch = getopt(argc, argv, "i:r:")) != -1) {
+		switch (ch) {
+		case 'i':
+			iterations = atol(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1 || iterations <= 0 || rounds <= 0)
+		usage();
+	topdir = argv[0];
+
+	if (fileserver_init() == -1)
+		err(1, "fileserver_init");
+	if (!fileserver_has(FILESERVER_CAP_GETATTRS))
+		errx(1, "fhgetattrs is not loaded");
+
+	fhs = calloc(counts[nitems(counts) - 1], sizeof(*fhs));
+	if (fhs == NULL)
+		err(1, "calloc");
+	atexit(unmount_all);
+
+	printf("%ld calls, %d rounds\n", iterations, rounds);
+	printf("%8s  %14s  %10s  %10s  %10s\n", "mounts", "fhgetattrs ns",
+	    "index hits", "misses", "fhstat ns");
+	for (c = 0; c < nitems(counts); c++) {
+		for (n = nmounts; n < counts[c]; n++)
+			mount_tmpfs(n);
+		hits = counter("kern.fhresolve.mount_hits");
+		misses = counter("kern.fhresolve.mount_misses");
+		fhgetattrs_ns = measure(counts[c], 1);
+		hits = counter("kern.fhresolve.mount_hits") - hits;
+		misses = counter("kern.fhresolve.mount_misses") - misses;
+		fhstat_ns = measure(counts[c], 0);
+		printf("%8d  %14.1f  %10ju  %10ju  %10.1f\n", counts[c],
+		    fhgetattrs_ns, (uintmax_t)hits, (uintmax_t)misses,
+		    fhstat_ns);
+	}
+	return (0);
+}
@@ -0,0 +1,278 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <err.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "libfileserver.h"
+
+/*
+ * Throughput and CPU per GB of sending a file over TCP on the loopback
+ * in chunks, each one after a small header as an NFS READ reply, with
+ * fhsendfile against pread and writev.  A thread drains the other end
+ * of the connection.  The file is read once first, so that both run
+ * from the page cache.  The CPU is given for the sending thread and for
+ * the whole process, the draining thread included.  Must run as root.
+ */
+
+#define	BENCH_HDRSIZE	128
+#define	BENCH_DRAINSIZE	(1024 * 1024)
+#define	BENCH_GB	1000000000.0
+
+static int rounds = 5;
+static size_t chunk = 1024 * 1024;
+static off_t total = 1024 * 1024 * 1024;
+
+static fhandle_t fh;
+static int fd;
+static off_t filesize;
+static int sock;
+static char hdr[BENCH_HDRSIZE];
+static char *buf;
+
+static uint64_t
+bench_threadcpunsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ((uint64_t)ts.tv_sec * BENCH_NSEC + ts.tv_nsec);
+}
+
+static void *
+drain(void *arg)
+{
+	char *dbuf;
+	int s;
+
+	s = *(int *)arg;
+	dbuf = malloc(BENCH_DRAINSIZE);
+	if (dbuf == NULL)
+		err(1, "malloc");
+	while (read(s, dbuf, BENCH_DRAINSIZE) > 0)
+		;
+	free(dbuf);
+	return (NULL);
+}
+
+static void
+send_fhsendfile(off_t off, size_t len)
+{
+	struct iovec iov;
+	off_t sbytes;
+
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(hdr);
+	if (fileserver_fhsendfile(&fh, off, len, sock, &iov, 1, &sbytes,
+	    0) == -1)
+		err(1, "fhsendfile");
+	if (sbytes != (off_t)(sizeof(hdr) + len))
+		errx(1, "fhsendfile sent %jd bytes", (intmax_t)sbytes);
+}
+
+static void
+send_preadwritev(off_t off, size_t len)
+{
+	struct iovec iov[2];
+	ssize_t n;
+
+	n = pread(fd, buf, len, off);
+	if (n != (ssize_t)len)
+		err(1, "pread");
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = buf;
+	iov[1].iov_len = len;
+	n = writev(sock, iov, 2);
+	if (n != (ssize_t)(sizeof(hdr) + len))
+		err(1, "writev");
+}
+
+static void
+run(const char *name, void (*send)(off_t, size_t))
+{
+	double *mbs, *tcpu, *pcpu;
+	uint64_t start, tstart, pstart;
+	off_t off, sent;
+	size_t len;
+	double gb, s;
+	int r;
+
+	mbs = calloc(rounds, sizeof(*mbs));
+	tcpu = calloc(rounds, sizeof(*tcpu));
+	pcpu = calloc(rounds, sizeof(*pcpu));
+	if (mbs == NULL || tcpu == NULL || pcpu == NULL)
+		err(1, "calloc");
+	for (r = 0; r < rounds; r++) {
+		start = bench_nsec();
+		tstart = bench_threadcpunsec();
+		pstart = bench_cpunsec();
+		off = 0;
+		for (sent = 0; sent < total; sent += len) {
+			if (off + (off_t)chunk > filesize)
+				off = 0;
+			len = chunk;
+			send(off, len);
+			off += len;
+		}
+		s = (double)(bench_nsec() - start) / BENCH_NSEC;
+		gb = sent / BENCH_GB;
+		mbs[r] = sent / s / 1000000;
+		tcpu[r] = (double)(bench_threadcpunsec() - tstart) /
+		    BENCH_NSEC / gb;
+		pcpu[r] = (double)(bench_cpunsec() - pstart) / BENCH_NSEC / gb;
+	}
+	/* Sorted by bench_median(), the best throughput is the last. */
+	printf("%-16s  %10.0f  %10.0f  %12.3f  %12.3f\n", name,
+	    bench_median(mbs, rounds), mbs[rounds - 1],
+	    bench_median(tcpu, rounds), bench_median(pcpu, rounds));
+	free(mbs);
+	free(tcpu);
+	free(pcpu);
+}
+
+static void
+connect_loopback(int *rsock)
+{
+	struct sockaddr_in sin;
+	socklen_t len;
+	int ls;
+
+	ls = socket(AF_INET, SOCK_STREAM, 0);
+	if (ls == -1)
+		err(1, "socket");
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(ls, (struct sockaddr *)&sin, sizeof(sin)) == -1)
+		err(1, "bind");
+	if (listen(ls, 1) == -1)
+		err(1, "listen");
+	len = sizeof(sin);
+	if (getsockname(ls, (struct sockaddr *)&sin, &len) == -1)
+		err(1, "getsockname");
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock == -1)
+		err(1, "socket");
+	if (connect(sock, (struct sockaddr *)&sin, sizeof(sin)) == -1)
+		err(1, "connect");
+	*rsock = accept(ls, NULL, NULL);
+	if (*rsock == -1)
+		err(1, "accept");
+	close(ls);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: fhsendfilebench [-b chunk] [-r rounds] "
+	    "[-t total] file\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	pthread_t thread;
+	struct stat sb;
+	off_t off;
+	int ch, error, rsock;
+
+	while ((ch = getopt(argc, argv, "b:r:t:")) != -1) {
+		switch (ch) {
+		case 'b':
+			chunk = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 't':
+			total = strtoll(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1 || chunk == 0 || rounds <= 0 || total <= 0)
+		usage();
+
+	if (fileserver_init() == -1)
+		err(1, "fileserver_init");
+	if (!fileserver_has(FILESERVER_CAP_SENDFILE))
+		errx(1, "fhsendfile is not loaded");
+
+	fd = open(argv[0], O_RDONLY);
+	if (fd == -1)
+		err(1, "%s", argv[0]);
+	if (fstat(fd, &sb) == -1)
+		err(1, "fstat");
+	filesize = sb.st_size;
+	if (filesize < (off_t)chunk)
+		errx(1, "%s is smaller than a chunk", argv[0]);
+	if (getfh(argv[0], &fh) == -1)
+		err(1, "getfh");
+	buf = malloc(chunk);
+	if (buf == NULL)
+		err(1, "malloc");
+	for (off = 0; off + (off_t)chunk <= filesize; off += chunk)
+		if (pread(fd, buf, chunk, off) == -1)
+			err(1, "pread");
+
+	connect_loopback(&rsock);
+	error = pthread_create(&thread, NULL, drain, &rsock);
+	if (error != 0)
+		errc(1, error, "pthread_create");
+
+	printf("%zu bytes chunks, %jd bytes per round, %d rounds\n", chunk,
+	    (intmax_t)total, rounds);
+	printf("%-16s  %10s  %10s  %12s  %12s\n", "", "MB/s", "best MB/s",
+	    "thread s/GB", "process s/GB");
+	run("fhsendfile", send_fhsendfile);
+	run("pread+writev", send_preadwritev);
+
+	close(sock);
+	pthread_join(thread, NULL);
+	return (0);
+}
@@ -0,0 +1,217 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "libfileserver.h"
+
+/*
+ * Scaling of fhreadlink and getfhat from 1 to 64 threads all working on
+ * the same vnode: a symlink read by handle, and a file looked up from
+ * its directory.  Both resolve their vnode with a shared lock where the
+ * filesystem allows it, so the operations per second should grow with
+ * the threads up to the number of CPUs.  Must run as root.
+ */
+
+#define	BENCH_THREADS_MAX	64
+#define	BENCH_LINKLEN		64
+
+enum { OP_FHREADLINK, OP_GETFHAT, OP_COUNT };
+
+static const char *opnames[OP_COUNT] = { "fhreadlink", "getfhat" };
+
+static int rounds = 5;
+static int seconds = 2;
+static int threads_max = BENCH_THREADS_MAX;
+
+static fhandle_t linkfh;
+static int dirfd;
+static pthread_barrier_t barrier;
+static volatile int stop;
+
+struct worker {
+	pthread_t	w_thread;
+	int		w_op;
+	long		w_ops;
+};
+
+static void *
+work(void *arg)
+{
+	struct worker *w;
+	fhandle_t fh;
+	char buf[BENCH_LINKLEN];
+	long n;
+
+	w = arg;
+	n = 0;
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		if (w->w_op == OP_FHREADLINK) {
+			if (fileserver_fhreadlink(&linkfh, buf,
+			    sizeof(buf)) == -1)
+				err(1, "fhreadlink");
+		} else {
+			if (fileserver_getfhat(dirfd, "file", &fh, 0) == -1)
+				err(1, "getfhat");
+		}
+		n++;
+	}
+	w->w_ops = n;
+	return (NULL);
+}
+
+/* Operations per second of all the threads. */
+static double
+measure(int op, int nthreads)
+{
+	struct worker *w;
+	long ops;
+	int error, i;
+
+	w = calloc(nthreads, sizeof(*w));
+	if (w == NULL)
+		err(1, "calloc");
+	error = pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	if (error != 0)
+		errc(1, error, "pthread_barrier_init");
+	stop = 0;
+	for (i = 0; i < nthreads; i++) {
+		w[i].w_op = op;
+		error = pthread_create(&w[i].w_thread, NULL, work, &w[i]);
+		if (error != 0)
+			errc(1, error, "pthread_create");
+	}
+	pthread_barrier_wait(&barrier);
+	sleep(seconds);
+	stop = 1;
+	ops = 0;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(w[i].w_thread, NULL);
+		ops += w[i].w_ops;
+	}
+	pthread_barrier_destroy(&barrier);
+	free(w);
+	return ((double)ops / seconds);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: fhsharedbench [-d seconds] [-r rounds] "
+	    "[-t threads] directory\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	char path[MAXPATHLEN];
+	double one, *opss, ops;
+	int ch, fd, n, op, r;
+
+	while ((ch = getopt(argc, argv, "d:r:t:")) != -1) {
+		switch (ch) {
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 't':
+			threads_max = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1 || seconds <= 0 || rounds <= 0 || threads_max <= 0)
+		usage();
+
+	if (fileserver_init() == -1)
+		err(1, "fileserver_init");
+
+	snprintf(path, sizeof(path), "%s/fhsharedbench.link", argv[0]);
+	(void)unlink(path);
+	if (symlink("fhsharedbench.target", path) == -1)
+		err(1, "symlink %s", path);
+	if (lgetfh(path, &linkfh) == -1)
+		err(1, "lgetfh %s", path);
+	snprintf(path, sizeof(path), "%s/fhsharedbench.dir", argv[0]);
+	if (mkdir(path, 0755) == -1 && errno != EEXIST)
+		err(1, "mkdir %s", path);
+	dirfd = open(path, O_RDONLY | O_DIRECTORY);
+	if (dirfd == -1)
+		err(1, "%s", path);
+	fd = openat(dirfd, "file", O_WRONLY | O_CREAT, 0644);
+	if (fd == -1)
+		err(1, "%s/file", path);
+	close(fd);
+
+	opss = calloc(rounds, sizeof(*opss));
+	if (opss == NULL)
+		err(1, "calloc");
+	printf("%d seconds, %d rounds\n", seconds, rounds);
+	printf("%-12s  %8s  %12s  %8s\n", "", "threads", "ops/s", "scaling");
+	for (op = 0; op < OP_COUNT; op++) {
+		one = 0;
+		for (n = 1; n <= threads_max; n *= 2) {
+			for (r = 0; r < rounds; r++)
+				opss[r] = measure(op, n);
+			ops = bench_median(opss, rounds);
+			if (n == 1)
+				one = ops;
+			printf("%-12s  %8d  %12.0f  %8.2f\n", opnames[op], n,
+			    ops, ops / one);
+		}
+	}
+	free(opss);
+
+	(void)unlinkat(dirfd, "file", 0);
+	close(dirfd);
+	(void)rmdir(path);
+	snprintf(path, sizeof(path), "%s/fhsharedbench.link", argv[0]);
+	(void)unlink(path);
+	return (0);
+}
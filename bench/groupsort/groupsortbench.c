@@ -0,0 +1,216 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/types.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "groupsort.h"
+
+/*
+ * Cost of groupsort() from group counts of 16 up to ngroups_max, on
+ * vectors already sorted, reversed and in random order, against the
+ * insertion sort crsetgroups_locked() used before.  Each sort works on
+ * a fresh copy of the vector, the time of the copy alone is taken out.
+ * The insertion sort is quadratic and only run up to -m groups.
+ *
+ * groupsort.h only needs <sys/types.h>, this builds on Linux too:
+ *	cc -O2 -I.. -I../../credintern -o groupsortbench groupsortbench.c
+ */
+
+#define	BENCH_WORK	(1 << 20)	/* groups sorted per round */
+
+enum { INPUT_SORTED, INPUT_REVERSED, INPUT_RANDOM, INPUT_COUNT };
+
+static const char *inputs[INPUT_COUNT] = { "sorted", "reversed", "random" };
+
+static int rounds = 5;
+static int insertion_max = 4096;
+
+/* crsetgroups_locked() before groupsort.h */
+static void
+insertionsort(gid_t *groups, int ngrp)
+{
+	int i, j;
+	gid_t g;
+
+	for (i = 1; i < ngrp; i++) {
+		g = groups[i];
+		for (j = i - 1; j >= 0 && g < groups[j]; j--)
+			groups[j + 1] = groups[j];
+		groups[j + 1] = g;
+	}
+}
+
+static void
+nosort(gid_t *groups, int ngrp)
+{
+
+	(void)groups;
+	(void)ngrp;
+}
+
+static uint32_t
+xorshift32(uint32_t *state)
+{
+	uint32_t x;
+
+	x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return (*state = x);
+}
+
+static void
+fill(gid_t *groups, int ngrp, int input)
+{
+	uint32_t state;
+	int i;
+
+	state = 2463534242U;
+	for (i = 0; i < ngrp; i++) {
+		switch (input) {
+		case INPUT_SORTED:
+			groups[i] = 1000 + i;
+			break;
+		case INPUT_REVERSED:
+			groups[i] = 1000 + ngrp - i;
+			break;
+		default:
+			groups[i] = xorshift32(&state) % (1U << 31);
+			break;
+		}
+	}
+}
+
+/* Median over the rounds of the ns per sort, the copy included. */
+static double
+measure(void (*sort)(gid_t *, int), const gid_t *orig, gid_t *work,
+    int ngrp)
+{
+	double *ns;
+	double median;
+	uint64_t start;
+	long i, iterations;
+	int r;
+
+	iterations = BENCH_WORK / ngrp > 0 ? BENCH_WORK / ngrp : 1;
+	ns = calloc(rounds, sizeof(*ns));
+	if (ns == NULL)
+		err(1, "calloc");
+	for (r = 0; r < rounds; r++) {
+		start = bench_nsec();
+		for (i = 0; i < iterations; i++) {
+			memcpy(work, orig, ngrp * sizeof(gid_t));
+			sort(work, ngrp);
+		}
+		ns[r] = (double)(bench_nsec() - start) / iterations;
+	}
+	median = bench_median(ns, rounds);
+	free(ns);
+	return (median);
+}
+
+static void
+bench(int ngrp)
+{
+	gid_t *orig, *work;
+	double copy, gs, is;
+	int input;
+
+	orig = calloc(ngrp, sizeof(gid_t));
+	work = calloc(ngrp, sizeof(gid_t));
+	if (orig == NULL || work == NULL)
+		err(1, "calloc");
+	for (input = 0; input < INPUT_COUNT; input++) {
+		fill(orig, ngrp, input);
+		copy = measure(nosort, orig, work, ngrp);
+		gs = measure(groupsort, orig, work, ngrp) - copy;
+		if (!groups_sorted(work, ngrp))
+			errx(1, "groupsort failed with %d groups", ngrp);
+		printf("%8d  %-8s  %12.1f  %10.2f", ngrp, inputs[input], gs,
+		    gs / ngrp);
+		if (ngrp <= insertion_max) {
+			is = measure(insertionsort, orig, work, ngrp) - copy;
+			printf("  %12.1f\n", is);
+		} else
+			printf("  %12s\n", "-");
+	}
+	free(orig);
+	free(work);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: groupsortbench [-m insertion_max] [-n ngroups_max] "
+	    "[-r rounds]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	long ngroups_max;
+	int ch, n;
+
+	ngroups_max = sysconf(_SC_NGROUPS_MAX);
+	while ((ch = getopt(argc, argv, "m:n:r:")) != -1) {
+		switch (ch) {
+		case 'm':
+			insertion_max = atoi(optarg);
+			break;
+		case 'n':
+			ngroups_max = atol(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (ngroups_max < 16 || rounds <= 0)
+		usage();
+
+	printf("%8s  %-8s  %12s  %10s  %12s\n", "ngroups", "input",
+	    "groupsort ns", "per group", "insertion ns");
+	for (n = 16; n < ngroups_max; n *= 2)
+		bench(n);
+	bench(ngroups_max);
+	return (0);
+}
@@ -0,0 +1,341 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/lock.h>
+#include <sys/rmlock.h>
+#include <sys/malloc.h>
+#include <sys/queue.h>
+#include <sys/hash.h>
+#include <sys/counter.h>
+#include <sys/sysctl.h>
+#include <sys/taskqueue.h>
+#include <sys/ucred.h>
+
+#include "credintern.h"
+
+struct credintern_entry {
+	LIST_ENTRY(credintern_entry) cie_link;
+	uint32_t	cie_hash;
+	struct ucred	*cie_cred;
+};
+
+LIST_HEAD(credintern_head, credintern_entry);
+
+static MALLOC_DEFINE(M_CREDINTERN, "credintern", "interned credentials");
+
+static struct credintern_head *credintern_hashtbl;
+static u_long credintern_hashmask;
+static struct rmlock credintern_lock;
+static struct timeout_task credintern_prune_task;
+static u_int credintern_count;
+static int credintern_stopping;
+
+static counter_u64_t credintern_lookups;
+static counter_u64_t credintern_hits;
+static counter_u64_t credintern_misses;
+static counter_u64_t credintern_evictions;
+
+static u_int credintern_max = 4096;
+static u_int credintern_prune_interval = 10;
+
+#define	CREDINTERN_HASH(h)	(&credintern_hashtbl[(h) & credintern_hashmask])
+
+static SYSCTL_NODE(_kern, OID_AUTO, credintern, CTLFLAG_RW, 0,
+    "Interned thread credentials");
+SYSCTL_COUNTER_U64(_kern_credintern, OID_AUTO, lookups, CTLFLAG_RD,
+    &credintern_lookups, "Lookups of an interned credential");
+SYSCTL_COUNTER_U64(_kern_credintern, OID_AUTO, hits, CTLFLAG_RD,
+    &credintern_hits, "Lookups that found an interned credential");
+SYSCTL_COUNTER_U64(_kern_credintern, OID_AUTO, misses, CTLFLAG_RD,
+    &credintern_misses, "Lookups that had to build a new credential");
+SYSCTL_COUNTER_U64(_kern_credintern, OID_AUTO, evictions, CTLFLAG_RD,
+    &credintern_evictions, "Unused credentials dropped from the table");
+SYSCTL_UINT(_kern_credintern, OID_AUTO, interned, CTLFLAG_RD,
+    &credintern_count, 0, "Number of interned credentials");
+SYSCTL_UINT(_kern_credintern, OID_AUTO, max, CTLFLAG_RWTUN,
+    &credintern_max, 0, "Maximum number of interned credentials");
+SYSCTL_UINT(_kern_credintern, OID_AUTO, prune_interval, CTLFLAG_RWTUN,
+    &credintern_prune_interval, 0,
+    "Seconds between scans for unused credentials");
+
+void
+credintern_key_init(struct credintern_key *key, struct ucred *base)
+{
+
+	key->cik_base = base;
+	key->cik_uid = base->cr_uid;
+	key->cik_gid = base->cr_groups[0];
+	key->cik_ngroups = base->cr_ngroups - 1;
+	key->cik_groups = &base->cr_groups[1];
+}
+
+static uint32_t
+credintern_hash(const struct credintern_key *key)
+{
+	uint32_t hash;
+
+	hash = jenkins_hash32((const uint32_t *)key->cik_groups,
+	    key->cik_ngroups, key->cik_ngroups);
+	hash = jenkins_hash32((const uint32_t *)&key->cik_gid, 1, hash);
+	return (jenkins_hash32((const uint32_t *)&key->cik_uid, 1, hash));
+}
+
+/*
+ * Everything that is not derived from the ids must be equal too, or a
+ * thread could pick up another jail, login class or audit session.
+ * Labelled credentials are never interned.
+ */
+static int
+credintern_match(struct ucred *cr, const struct credintern_key *key)
+{
+	struct ucred *base;
+
+	base = key->cik_base;
+	return (cr->cr_uid == key->cik_uid &&
+	    cr->cr_groups[0] == key->cik_gid &&
+	    cr->cr_ngroups == key->cik_ngroups + 1 &&
+	    cr->cr_ruid == base->cr_ruid &&
+	    cr->cr_svuid == base->cr_svuid &&
+	    cr->cr_rgid == base->cr_rgid &&
+	    cr->cr_svgid == base->cr_svgid &&
+	    cr->cr_prison == base->cr_prison &&
+	    cr->cr_loginclass == base->cr_loginclass &&
+	    cr->cr_flags == base->cr_flags &&
+	    cr->cr_label == NULL &&
+	    bcmp(&cr->cr_audit, &base->cr_audit, sizeof(cr->cr_audit)) == 0 &&
+	    bcmp(&cr->cr_groups[1], key->cik_groups,
+	    key->cik_ngroups * sizeof(gid_t)) == 0);
+}
+
+static struct ucred *
+credintern_lookup_locked(const struct credintern_key *key, uint32_t hash)
+{
+	struct credintern_entry *cie;
+
+	rm_assert(&credintern_lock, RA_LOCKED);
+	LIST_FOREACH(cie, CREDINTERN_HASH(hash), cie_link) {
+		if (cie->cie_hash == hash &&
+		    credintern_match(cie->cie_cred, key))
+			return (crhold(cie->cie_cred));
+	}
+	return (NULL);
+}
+
+/*
+ * Return a new reference on the interned credential matching key, or
+ * NULL if the caller has to build it.
+ */
+struct ucred *
+credintern_find(const struct credintern_key *key)
+{
+	struct rm_priotracker tracker;
+	struct ucred *cr;
+
+	if (key->cik_base->cr_label != NULL)
+		return (NULL);
+
+	counter_u64_add(credintern_lookups, 1);
+	rm_rlock(&credintern_lock, &tracker);
+	cr = credintern_lookup_locked(key, credintern_hash(key));
+	rm_runlock(&credintern_lock, &tracker);
+	counter_u64_add(cr != NULL ? credintern_hits : credintern_misses, 1);
+	return (cr);
+}
+
+/*
+ * Intern a freshly built credential.  The reference on cr is consumed
+ * and a reference on the interned credential is returned, which is cr
+ * itself unless another thread raced to intern an equal one.  When the
+ * table is full cr is returned as is and a prune is scheduled.
+ */
+struct ucred *
+credintern_insert(struct ucred *cr)
+{
+	struct credintern_key key;
+	struct credintern_entry *cie;
+	struct ucred *found;
+	uint32_t hash;
+	int full;
+
+	if (cr->cr_label != NULL)
+		return (cr);
+
+	credintern_key_init(&key, cr);
+	hash = credintern_hash(&key);
+	cie = malloc(sizeof(*cie), M_CREDINTERN, M_WAITOK);
+	cie->cie_hash = hash;
+	cie->cie_cred = cr;
+
+	full = 0;
+	rm_wlock(&credintern_lock);
+	found = credintern_lookup_locked(&key, hash);
+	if (found == NULL) {
+		if (credintern_count < credintern_max) {
+			LIST_INSERT_HEAD(CREDINTERN_HASH(hash), cie, cie_link);
+			credintern_count++;
+			crhold(cr);
+			cie = NULL;
+		} else
+			full = 1;
+	}
+	rm_wunlock(&credintern_lock);
+
+	free(cie, M_CREDINTERN);
+	if (full)
+		taskqueue_enqueue_timeout(taskqueue_thread,
+		    &credintern_prune_task, 0);
+	if (found != NULL) {
+		crfree(cr);
+		return (found);
+	}
+	return (cr);
+}
+
+/*
+ * Drop the credentials only the table still references.  No new
+ * reference can be taken on those but through the table, so reading
+ * cr_ref under the write lock is enough.
+ */
+static void
+credintern_prune(int all)
+{
+	struct credintern_head dead;
+	struct credintern_entry *cie, *tmp;
+	u_long i;
+
+	LIST_INIT(&dead);
+	rm_wlock(&credintern_lock);
+	for (i = 0; i <= credintern_hashmask; i++) {
+		LIST_FOREACH_SAFE(cie, &credintern_hashtbl[i], cie_link, tmp) {
+			if (!all && cie->cie_cred->cr_ref != 1)
+				continue;
+			LIST_REMOVE(cie, cie_link);
+			LIST_INSERT_HEAD(&dead, cie, cie_link);
+			credintern_count--;
+		}
+	}
+	rm_wunlock(&credintern_lock);
+
+	while ((cie = LIST_FIRST(&dead)) != NULL) {
+		LIST_REMOVE(cie, cie_link);
+		crfree(cie->cie_cred);
+		free(cie, M_CREDINTERN);
+		counter_u64_add(credintern_evictions, 1);
+	}
+}
+
+static void
+credintern_prune_task_fn(void *arg __unused, int pending __unused)
+{
+
+	credintern_prune(0);
+	if (!credintern_stopping)
+		taskqueue_enqueue_timeout(taskqueue_thread,
+		    &credintern_prune_task, credintern_prune_interval * hz);
+}
+
+/*
+ * A SYSUNINIT rather than MOD_UNLOAD, so that in the fileserver kld
+ * the table outlives the setthread* syscalls, unloaded after us.
+ */
+static void
+credintern_init(void *arg __unused)
+{
+
+	credintern_lookups = counter_u64_alloc(M_WAITOK);
+	credintern_hits = counter_u64_alloc(M_WAITOK);
+	credintern_misses = counter_u64_alloc(M_WAITOK);
+	credintern_evictions = counter_u64_alloc(M_WAITOK);
+	rm_init(&credintern_lock, "credintern");
+	credintern_hashtbl = hashinit(credintern_max / 4, M_CREDINTERN,
+	    &credintern_hashmask);
+	TIMEOUT_TASK_INIT(taskqueue_thread, &credintern_prune_task, 0,
+	    credintern_prune_task_fn, NULL);
+	taskqueue_enqueue_timeout(taskqueue_thread,
+	    &credintern_prune_task, credintern_prune_interval * hz);
+}
+SYSINIT(credintern, SI_SUB_SYSCALLS, SI_ORDER_FIRST, credintern_init, NULL);
+
+static void
+credintern_uninit(void *arg __unused)
+{
+
+	credintern_stopping = 1;
+	taskqueue_cancel_timeout(taskqueue_thread,
+	    &credintern_prune_task, NULL);
+	taskqueue_drain_timeout(taskqueue_thread,
+	    &credintern_prune_task);
+	credintern_prune(1);
+	hashdestroy(credintern_hashtbl, M_CREDINTERN,
+	    credintern_hashmask);
+	rm_destroy(&credintern_lock);
+	counter_u64_free(credintern_lookups);
+	counter_u64_free(credintern_hits);
+	counter_u64_free(credintern_misses);
+	counter_u64_free(credintern_evictions);
+}
+SYSUNINIT(credintern, SI_SUB_SYSCALLS, SI_ORDER_FIRST, credintern_uninit,
+    NULL);
+
+/*
+ * The function called at load/unload.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("credintern loaded\n");
+		break;
+	case MOD_UNLOAD :
+		printf("credintern unloaded\n");
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+static moduledata_t credintern_mod = {
+	"credintern",
+	load,
+	NULL
+};
+
+DECLARE_MODULE(credintern, credintern_mod, SI_SUB_SYSCALLS, SI_ORDER_FIRST);
+MODULE_VERSION(credintern, 1);
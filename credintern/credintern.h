@@ -0,0 +1,55 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#ifndef _CREDINTERN_H_
+#define	_CREDINTERN_H_
+
+/*
+ * Interned credentials shared by the setthread* modules.  A thread
+ * switching to a (euid, egid, groups) set that some other thread already
+ * uses gets a reference on the same ucred instead of a private copy.
+ *
+ * A key describes the credential a thread wants: everything but the
+ * effective uid and the groups vector is taken from cik_base.  The
+ * supplementary groups must be sorted, as in cr_groups[1..].
+ */
+struct credintern_key {
+	struct ucred	*cik_base;
+	uid_t		cik_uid;
+	gid_t		cik_gid;
+	int		cik_ngroups;
+	const gid_t	*cik_groups;
+};
+
+void	credintern_key_init(struct credintern_key *key, struct ucred *base);
+struct ucred *credintern_find(const struct credintern_key *key);
+struct ucred *credintern_insert(struct ucred *cr);
+
+#endif /* !_CREDINTERN_H_ */
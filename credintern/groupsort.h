@@ -0,0 +1,110 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#ifndef _GROUPSORT_H_
+#define	_GROUPSORT_H_
+
+/*
+ * Sort a groups vector so groupmember can perform a binary search.
+ *
+ * Vectors coming from idmapping are often already sorted, so check for
+ * that first in linear time.  Short vectors use insertion sort, longer
+ * ones heap sort, which works in place and stays O(n log n) in the worst
+ * case.  This only depends on gid_t so it can be built in userland too.
+ */
+
+#include <sys/types.h>
+
+#define	GROUPSORT_INSERTION_MAX	16
+
+static inline int
+groups_sorted(const gid_t *groups, int ngrp)
+{
+	int i;
+
+	for (i = 1; i < ngrp; i++) {
+		if (groups[i - 1] > groups[i])
+			return (0);
+	}
+	return (1);
+}
+
+static inline void
+groups_siftdown(gid_t *groups, int root, int ngrp)
+{
+	int child;
+	gid_t g;
+
+	g = groups[root];
+	for (;;) {
+		child = 2 * root + 1;
+		if (child >= ngrp)
+			break;
+		if (child + 1 < ngrp && groups[child] < groups[child + 1])
+			child++;
+		if (g >= groups[child])
+			break;
+		groups[root] = groups[child];
+		root = child;
+	}
+	groups[root] = g;
+}
+
+static inline void
+groupsort(gid_t *groups, int ngrp)
+{
+	int i;
+	int j;
+	gid_t g;
+
+	if (groups_sorted(groups, ngrp))
+		return;
+
+	if (ngrp <= GROUPSORT_INSERTION_MAX) {
+		for (i = 1; i < ngrp; i++) {
+			g = groups[i];
+			for (j = i-1; j >= 0 && g < groups[j]; j--)
+				groups[j + 1] = groups[j];
+			groups[j + 1] = g;
+		}
+		return;
+	}
+
+	for (i = ngrp / 2 - 1; i >= 0; i--)
+		groups_siftdown(groups, i, ngrp);
+	for (i = ngrp - 1; i > 0; i--) {
+		g = groups[0];
+		groups[0] = groups[i];
+		groups[i] = g;
+		groups_siftdown(groups, 0, i);
+	}
+}
+
+#endif /* !_GROUPSORT_H_ */
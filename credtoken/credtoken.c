@@ -0,0 +1,586 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * Copyright (c) 1999 Assar Westerlund
+ * Copyright (c) 1982, 1986, 1989, 1990, 1991, 1993
+ *	The Regents of the University of California.
+ * (c) UNIX System Laboratories, Inc.
+ * Copyright (c) 2000-2001 Robert N. M. Watson.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/priv.h>
+#include <sys/resourcevar.h>
+#include <sys/lock.h>
+#include <sys/rmlock.h>
+#include <sys/malloc.h>
+#include <sys/queue.h>
+#include <sys/eventhandler.h>
+#include <sys/sdt.h>
+
+#include <security/audit/audit.h>
+
+#include "groupsort.h"
+#include "syscallstat.h"
+
+/*
+ * Credential tokens: a process registers a (euid, egid, groups) set once
+ * and gets back a small integer.  Switching a thread to a token then only
+ * takes a reference on the prebuilt ucred.  Tokens belong to the process
+ * that registered them and are dropped at exec and exit, or as soon as
+ * the process credential is no longer the one they were registered
+ * under (setuid, jail_attach...).
+ */
+
+#define	CREDTOKEN_MIN	16
+#define	CREDTOKEN_MAX	65536
+
+/*
+ * Each argument takes a full register, pad the ones smaller than that
+ * the way sysproto.h does.
+ */
+struct credtoken_register_args {
+	char	uid_l_[PADL_(uid_t)]; uid_t uid; char uid_r_[PADR_(uid_t)];
+	char	gid_l_[PADL_(gid_t)]; gid_t gid; char gid_r_[PADR_(gid_t)];
+	char	gidsetsize_l_[PADL_(u_int)]; u_int gidsetsize; char gidsetsize_r_[PADR_(u_int)];
+	char	gidset_l_[PADL_(gid_t *)]; gid_t *gidset; char gidset_r_[PADR_(gid_t *)];
+};
+
+struct credtoken_unregister_args {
+	int	token;
+};
+
+struct setthreadtoken_args {
+	int	token;
+};
+
+int sys_credtoken_register(struct thread *td, void *params);
+int sys_credtoken_unregister(struct thread *td, void *params);
+int sys_setthreadtoken(struct thread *td, void *params);
+
+/*
+ * Entry and return probes, the return giving the errno and the
+ * duration.  setthreadtoken returns EPERM for a token of a former
+ * process credential.
+ */
+SDT_PROVIDER_DEFINE(credtoken);
+SDT_PROBE_DEFINE3(credtoken, , credtoken_register, entry, "uid_t", "gid_t",
+    "u_int");
+SDT_PROBE_DEFINE2(credtoken, , credtoken_register, return, "int", "int64_t");
+SDT_PROBE_DEFINE1(credtoken, , credtoken_unregister, entry, "int");
+SDT_PROBE_DEFINE2(credtoken, , credtoken_unregister, return, "int", "int64_t");
+SDT_PROBE_DEFINE1(credtoken, , setthreadtoken, entry, "int");
+SDT_PROBE_DEFINE2(credtoken, , setthreadtoken, return, "int", "int64_t");
+
+struct credtoken_proc {
+	LIST_ENTRY(credtoken_proc) ctp_link;
+	struct proc	*ctp_proc;
+	struct ucred	*ctp_proccred;	/* p_ucred at registration */
+	u_int		ctp_size;
+	struct ucred	**ctp_creds;
+};
+
+LIST_HEAD(credtoken_head, credtoken_proc);
+
+static MALLOC_DEFINE(M_CREDTOKEN, "credtoken", "credential tokens");
+
+static struct credtoken_head *credtoken_hashtbl;
+static u_long credtoken_hashmask;
+static struct rmlock credtoken_lock;
+static eventhandler_tag credtoken_exec_tag;
+static eventhandler_tag credtoken_exit_tag;
+
+#define	CREDTOKEN_HASH(p)	\
+	(&credtoken_hashtbl[(p)->p_pid & credtoken_hashmask])
+
+static struct credtoken_proc *
+credtoken_find(struct proc *p)
+{
+	struct credtoken_proc *ctp;
+
+	rm_assert(&credtoken_lock, RA_LOCKED);
+	LIST_FOREACH(ctp, CREDTOKEN_HASH(p), ctp_link) {
+		if (ctp->ctp_proc == p)
+			return (ctp);
+	}
+	return (NULL);
+}
+
+static void
+credtoken_free(struct credtoken_proc *ctp)
+{
+	u_int i;
+
+	for (i = 0; i < ctp->ctp_size; i++) {
+		if (ctp->ctp_creds[i] != NULL)
+			crfree(ctp->ctp_creds[i]);
+	}
+	crfree(ctp->ctp_proccred);
+	free(ctp->ctp_creds, M_CREDTOKEN);
+	free(ctp, M_CREDTOKEN);
+}
+
+/*
+ * Drop the table of p if it was registered under another process
+ * credential than proccred.
+ */
+static void
+credtoken_proc_invalidate(struct proc *p, struct ucred *proccred)
+{
+	struct credtoken_proc *ctp;
+
+	rm_wlock(&credtoken_lock);
+	ctp = credtoken_find(p);
+	if (ctp != NULL && ctp->ctp_proccred != proccred)
+		LIST_REMOVE(ctp, ctp_link);
+	else
+		ctp = NULL;
+	rm_wunlock(&credtoken_lock);
+	if (ctp != NULL)
+		credtoken_free(ctp);
+}
+
+static void
+crsetgroups_locked(struct ucred *cr, gid_t egid, int ngrp, gid_t *groups)
+{
+
+	KASSERT(cr->cr_agroups >= ngrp + 1, ("cr_ngroups is too small"));
+
+	cr->cr_groups[0] = egid;
+	bcopy(groups, &cr->cr_groups[1], ngrp * sizeof(gid_t));
+	cr->cr_ngroups = ngrp + 1;
+
+	/*
+	 * Sort all groups except cr_groups[0] to allow groupmember to
+	 * perform a binary search.
+	 */
+	groupsort(&cr->cr_groups[1], ngrp);
+}
+
+/*
+ * Build the credential a token stands for, with the same checks as
+ * setthreadcred.  Nothing is checked again when switching to it.
+ */
+static int
+credtoken_build(struct thread *td, uid_t euid, gid_t egid, u_int ngrp,
+    gid_t *groups, struct ucred **crp)
+{
+	struct ucred *newcred, *oldcred;
+	struct uidinfo *euip;
+	int error;
+
+	MPASS(ngrp <= ngroups_max);
+	AUDIT_ARG_EUID(euid);
+	AUDIT_ARG_EGID(egid);
+	AUDIT_ARG_GROUPSET(groups, ngrp);
+
+	oldcred = td->td_ucred;
+
+#ifdef MAC
+	error = mac_cred_check_seteuid(oldcred, euid);
+	if (error)
+		return (error);
+	error = mac_cred_check_setegid(oldcred, egid);
+	if (error)
+		return (error);
+	error = mac_cred_check_setgroups(oldcred, ngrp, groups);
+	if (error)
+		return (error);
+#endif
+
+	/* code taken from seteuid, setegid and setgroups */
+	if (euid != oldcred->cr_ruid &&		/* allow seteuid(getuid()) */
+	    euid != oldcred->cr_svuid &&	/* allow seteuid(saved uid) */
+	    (error = priv_check_cred(oldcred, PRIV_CRED_SETEUID, 0)) != 0)
+		return (error);
+	if (egid != oldcred->cr_rgid &&		/* allow setegid(getgid()) */
+	    egid != oldcred->cr_svgid &&	/* allow setegid(saved gid) */
+	    (error = priv_check_cred(oldcred, PRIV_CRED_SETEGID, 0)) != 0)
+		return (error);
+	error = priv_check_cred(oldcred, PRIV_CRED_SETGROUPS, 0);
+	if (error)
+		return (error);
+
+	newcred = crget();
+	crextend(newcred, ngrp + 1);
+	euip = uifind(euid);
+	crcopy(newcred, oldcred);
+
+	if (oldcred->cr_uid != euid)
+		change_euid(newcred, euip);
+	crsetgroups_locked(newcred, egid, ngrp, groups);
+	uifree(euip);
+	*crp = newcred;
+	return (0);
+}
+
+/*
+ * Store cr in a free slot of the process table, growing it if needed.
+ * The lock is sleepable so the table can be allocated while holding it.
+ * A table registered under a former process credential is replaced.
+ */
+static int
+credtoken_insert(struct proc *p, struct ucred *cr, int *tokenp)
+{
+	struct credtoken_proc *ctp;
+	struct ucred **newcreds;
+	struct ucred *proccred;
+	u_int i, newsize;
+
+	PROC_LOCK(p);
+	proccred = crhold(p->p_ucred);
+	PROC_UNLOCK(p);
+	credtoken_proc_invalidate(p, proccred);
+
+	rm_wlock(&credtoken_lock);
+	ctp = credtoken_find(p);
+	if (ctp == NULL) {
+		ctp = malloc(sizeof(*ctp), M_CREDTOKEN, M_WAITOK | M_ZERO);
+		ctp->ctp_proc = p;
+		ctp->ctp_proccred = proccred;
+		proccred = NULL;
+		LIST_INSERT_HEAD(CREDTOKEN_HASH(p), ctp, ctp_link);
+	}
+	for (i = 0; i < ctp->ctp_size; i++) {
+		if (ctp->ctp_creds[i] == NULL)
+			break;
+	}
+	if (i == ctp->ctp_size) {
+		if (ctp->ctp_size >= CREDTOKEN_MAX) {
+			rm_wunlock(&credtoken_lock);
+			if (proccred != NULL)
+				crfree(proccred);
+			return (ENOSPC);
+		}
+		newsize = ctp->ctp_size == 0 ? CREDTOKEN_MIN :
+		    ctp->ctp_size * 2;
+		newcreds = malloc(newsize * sizeof(*newcreds), M_CREDTOKEN,
+		    M_WAITOK | M_ZERO);
+		if (ctp->ctp_size != 0)
+			bcopy(ctp->ctp_creds, newcreds,
+			    ctp->ctp_size * sizeof(*newcreds));
+		free(ctp->ctp_creds, M_CREDTOKEN);
+		ctp->ctp_creds = newcreds;
+		ctp->ctp_size = newsize;
+	}
+	ctp->ctp_creds[i] = cr;
+	rm_wunlock(&credtoken_lock);
+	if (proccred != NULL)
+		crfree(proccred);
+	*tokenp = i;
+	return (0);
+}
+
+static void
+credtoken_proc_clear(void *arg __unused, struct proc *p)
+{
+	struct credtoken_proc *ctp;
+
+	rm_wlock(&credtoken_lock);
+	ctp = credtoken_find(p);
+	if (ctp != NULL)
+		LIST_REMOVE(ctp, ctp_link);
+	rm_wunlock(&credtoken_lock);
+	if (ctp != NULL)
+		credtoken_free(ctp);
+}
+
+static void
+credtoken_proc_exec(void *arg, struct proc *p,
+    struct image_params *imgp __unused)
+{
+
+	credtoken_proc_clear(arg, p);
+}
+
+/*
+ * The function for implementing the register syscall.
+ */
+static int
+kern_credtoken_register(struct thread *td, struct credtoken_register_args *uap)
+{
+	gid_t smallgroups[XU_NGROUPS];
+	gid_t *groups;
+	struct ucred *cr;
+	u_int gidsetsize;
+	int error, token;
+
+	/* cr_groups[0] is reserved for the egid */
+	gidsetsize = uap->gidsetsize;
+	if (gidsetsize > ngroups_max)
+		return (EINVAL);
+
+	if (gidsetsize > XU_NGROUPS)
+		groups = malloc(gidsetsize * sizeof(gid_t), M_TEMP, M_WAITOK);
+	else
+		groups = smallgroups;
+
+	error = copyin(uap->gidset, groups, gidsetsize * sizeof(gid_t));
+	if (error == 0)
+		error = credtoken_build(td, uap->uid, uap->gid, gidsetsize,
+		    groups, &cr);
+
+	if (gidsetsize > XU_NGROUPS)
+		free(groups, M_TEMP);
+	if (error != 0)
+		return (error);
+
+	error = credtoken_insert(td->td_proc, cr, &token);
+	if (error != 0) {
+		crfree(cr);
+		return (error);
+	}
+	td->td_retval[0] = token;
+	return (0);
+}
+
+int sys_credtoken_register(struct thread *td, void *params)
+{
+	struct credtoken_register_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct credtoken_register_args*)params;
+
+	SDT_PROBE3(credtoken, , credtoken_register, entry, uap->uid, uap->gid,
+	    uap->gidsetsize);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_credtoken_register(td, uap);
+	SDT_PROBE2(credtoken, , credtoken_register, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The function for implementing the unregister syscall.  Threads
+ * currently running with the token keep their reference.
+ */
+static int
+kern_credtoken_unregister(struct thread *td,
+    struct credtoken_unregister_args *uap)
+{
+	struct credtoken_proc *ctp;
+	struct ucred *cr;
+
+	cr = NULL;
+	rm_wlock(&credtoken_lock);
+	ctp = credtoken_find(td->td_proc);
+	if (ctp != NULL && uap->token >= 0 && uap->token < ctp->ctp_size) {
+		cr = ctp->ctp_creds[uap->token];
+		ctp->ctp_creds[uap->token] = NULL;
+	}
+	rm_wunlock(&credtoken_lock);
+	if (cr == NULL)
+		return (EINVAL);
+	crfree(cr);
+	return (0);
+}
+
+int sys_credtoken_unregister(struct thread *td, void *params)
+{
+	struct credtoken_unregister_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct credtoken_unregister_args*)params;
+
+	SDT_PROBE1(credtoken, , credtoken_unregister, entry, uap->token);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_credtoken_unregister(td, uap);
+	SDT_PROBE2(credtoken, , credtoken_unregister, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The function for implementing the switch syscall.  The token was
+ * checked at registration against the process credential of that time,
+ * it is refused once the process runs with another one or in another
+ * jail.
+ */
+static int
+kern_setthreadtoken(struct thread *td, struct setthreadtoken_args *uap)
+{
+	struct rm_priotracker tracker;
+	struct credtoken_proc *ctp;
+	struct ucred *newcred, *oldcred, *proccred;
+	struct proc *p;
+	bool stale;
+
+	/* Only compared, the table holds a reference if it is the same. */
+	p = td->td_proc;
+	PROC_LOCK(p);
+	proccred = p->p_ucred;
+	PROC_UNLOCK(p);
+
+	newcred = NULL;
+	stale = false;
+	rm_rlock(&credtoken_lock, &tracker);
+	ctp = credtoken_find(p);
+	if (ctp != NULL && ctp->ctp_proccred != proccred)
+		stale = true;
+	else if (ctp != NULL && uap->token >= 0 &&
+	    uap->token < ctp->ctp_size) {
+		newcred = ctp->ctp_creds[uap->token];
+		if (newcred != NULL) {
+			if (newcred->cr_prison == proccred->cr_prison)
+				crhold(newcred);
+			else {
+				newcred = NULL;
+				stale = true;
+			}
+		}
+	}
+	rm_runlock(&credtoken_lock, &tracker);
+	if (stale) {
+		credtoken_proc_invalidate(p, proccred);
+		return (EPERM);
+	}
+	if (newcred == NULL)
+		return (EINVAL);
+
+	oldcred = td->td_ucred;
+	td->td_ucred = newcred;
+	crfree(oldcred);
+	return (0);
+}
+
+int sys_setthreadtoken(struct thread *td, void *params)
+{
+	struct setthreadtoken_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct setthreadtoken_args*)params;
+
+	SDT_PROBE1(credtoken, , setthreadtoken, entry, uap->token);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_setthreadtoken(td, uap);
+	SDT_PROBE2(credtoken, , setthreadtoken, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+static void
+credtoken_init(void *arg __unused)
+{
+
+	rm_init_flags(&credtoken_lock, "credtoken", RM_SLEEPABLE);
+	credtoken_hashtbl = hashinit(maxproc / 16, M_CREDTOKEN,
+	    &credtoken_hashmask);
+	credtoken_exec_tag = EVENTHANDLER_REGISTER(process_exec,
+	    credtoken_proc_exec, NULL, EVENTHANDLER_PRI_ANY);
+	credtoken_exit_tag = EVENTHANDLER_REGISTER(process_exit,
+	    credtoken_proc_clear, NULL, EVENTHANDLER_PRI_ANY);
+}
+SYSINIT(credtoken, SI_SUB_SYSCALLS, SI_ORDER_FIRST, credtoken_init, NULL);
+
+static void
+credtoken_uninit(void *arg __unused)
+{
+	struct credtoken_proc *ctp;
+	u_long i;
+
+	EVENTHANDLER_DEREGISTER(process_exec, credtoken_exec_tag);
+	EVENTHANDLER_DEREGISTER(process_exit, credtoken_exit_tag);
+	for (i = 0; i <= credtoken_hashmask; i++) {
+		while ((ctp = LIST_FIRST(&credtoken_hashtbl[i])) != NULL) {
+			LIST_REMOVE(ctp, ctp_link);
+			credtoken_free(ctp);
+		}
+	}
+	hashdestroy(credtoken_hashtbl, M_CREDTOKEN, credtoken_hashmask);
+	rm_destroy(&credtoken_lock);
+}
+SYSUNINIT(credtoken, SI_SUB_SYSCALLS, SI_ORDER_FIRST, credtoken_uninit, NULL);
+
+/*
+ * The `sysent's for the new syscalls
+ */
+static struct sysent credtoken_register_sysent = {
+	4,			/* sy_narg */
+	sys_credtoken_register	/* sy_call */
+};
+
+static struct sysent credtoken_unregister_sysent = {
+	1,			/* sy_narg */
+	sys_credtoken_unregister /* sy_call */
+};
+
+static struct sysent setthreadtoken_sysent = {
+	1,			/* sy_narg */
+	sys_setthreadtoken	/* sy_call */
+};
+
+/*
+ * The offsets in sysent where the syscalls are allocated.
+ */
+static int credtoken_register_offset = NO_SYSCALL;
+static int credtoken_unregister_offset = NO_SYSCALL;
+static int setthreadtoken_offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload, arg points to the offset.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("%s syscall loaded at %d\n", module_getname(module),
+		    *(int *)arg);
+		break;
+	case MOD_UNLOAD :
+		printf("%s syscall unloaded from %d\n", module_getname(module),
+		    *(int *)arg);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(credtoken_register, &credtoken_register_offset,
+    &credtoken_register_sysent, load, &credtoken_register_offset);
+SYSCALL_MODULE(credtoken_unregister, &credtoken_unregister_offset,
+    &credtoken_unregister_sysent, load, &credtoken_unregister_offset);
+SYSCALL_MODULE(setthreadtoken, &setthreadtoken_offset,
+    &setthreadtoken_sysent, load, &setthreadtoken_offset);
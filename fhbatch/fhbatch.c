@@ -0,0 +1,465 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * Copyright (c) 1999 Assar Westerlund
+ * Copyright (c) 1989, 1993
+ *      The Regents of the University of California.  All rights reserved.
+ * (c) UNIX System Laboratories, Inc.
+ * All or some portions of this file are derived from material licensed
+ * to the University of California by American Telephone and Telegraph
+ * Co. or Unix System Laboratories, Inc. and are reproduced herein with
+ * the permission of UNIX System Laboratories, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/namei.h>
+#include <sys/mount.h>
+#include <sys/priv.h>
+#include <sys/vnode.h>
+#include <sys/file.h>
+#include <sys/capsicum.h>
+#include <sys/buf.h>
+#include <sys/malloc.h>
+#include <sys/uio.h>
+#include <sys/sdt.h>
+
+#include "fhresolve.h"
+#include "fileserver.h"
+#include "syscallstat.h"
+
+/*
+ * Run a vector of getfhat, fhreadlink and fhlink operations in a single
+ * kernel entry.  Each operation gets its own errno in fbo_error, a
+ * failing one does not stop the batch.  Consecutive operations on the
+ * same fsid share a single fhresolve_busyfs().  The mount is never kept busy
+ * across namei(), which could wait for an unmount of that mount.
+ */
+
+struct fhbatch_args {
+	struct fhbatch_op	*ops;
+	u_int			nops;
+};
+
+int sys_fhbatch(struct thread *td, void *params);
+
+/*
+ * The per operation errors stay in the vector, fhbatch:::return only
+ * gives the one of the call and its duration.  The handles are not
+ * resolved through fhresolve, fhbatch:::fhtovp gives the fsid, errno
+ * and duration of each.
+ */
+SDT_PROVIDER_DEFINE(fhbatch);
+SDT_PROBE_DEFINE2(fhbatch, , fhbatch, entry, "struct fhbatch_op *", "u_int");
+SDT_PROBE_DEFINE2(fhbatch, , fhbatch, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(fhbatch, , , fhtovp, "fsid_t *", "int", "int64_t");
+
+extern int hardlink_check_uid;
+extern int hardlink_check_gid;
+
+/*
+ * The mount busied for the previous operation, if any.
+ */
+struct fhbatch_mount {
+	struct mount	*fbm_mp;
+	fsid_t		fbm_fsid;
+};
+
+static void
+fhbatch_unbusy(struct fhbatch_mount *fbm)
+{
+
+	if (fbm->fbm_mp != NULL) {
+		vfs_unbusy(fbm->fbm_mp);
+		fbm->fbm_mp = NULL;
+	}
+}
+
+static int
+fhbatch_fhtovp(struct fhbatch_mount *fbm, fhandle_t *fh, int flags,
+    struct vnode **vpp)
+{
+	sbintime_t start;
+	int error;
+
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	if (fbm->fbm_mp != NULL &&
+	    bcmp(&fbm->fbm_fsid, &fh->fh_fsid, sizeof(fsid_t)) != 0)
+		fhbatch_unbusy(fbm);
+	if (fbm->fbm_mp == NULL) {
+		if ((fbm->fbm_mp = fhresolve_busyfs(&fh->fh_fsid)) == NULL) {
+			SDT_PROBE3(fhbatch, , , fhtovp, &fh->fh_fsid, ESTALE,
+			    syscallstat_elapsed(start));
+			return (ESTALE);
+		}
+		fbm->fbm_fsid = fh->fh_fsid;
+	}
+	/* Shared only where namei() would take a shared lock too. */
+	if ((flags & LK_TYPE_MASK) == LK_SHARED &&
+	    (fbm->fbm_mp->mnt_kern_flag & MNTK_LOOKUP_SHARED) == 0)
+		flags = (flags & ~LK_TYPE_MASK) | LK_EXCLUSIVE;
+	error = VFS_FHTOVP(fbm->fbm_mp, &fh->fh_fid, flags, vpp);
+	SDT_PROBE3(fhbatch, , , fhtovp, &fh->fh_fsid, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+static int
+can_hardlink(struct vnode *vp, struct ucred *cred)
+{
+	struct vattr va;
+	int error;
+
+	if (!hardlink_check_uid && !hardlink_check_gid)
+		return (0);
+
+	error = VOP_GETATTR(vp, &va, cred);
+	if (error != 0)
+		return (error);
+
+	if (hardlink_check_uid && cred->cr_uid != va.va_uid) {
+		error = priv_check_cred(cred, PRIV_VFS_LINK, 0);
+		if (error != 0)
+			return (error);
+	}
+
+	if (hardlink_check_gid && !groupmember(va.va_gid, cred)) {
+		error = priv_check_cred(cred, PRIV_VFS_LINK, 0);
+		if (error != 0)
+			return (error);
+	}
+
+	return (0);
+}
+
+/* code taken from sys_getfhat */
+static int
+fhbatch_getfhat(struct thread *td, struct fhbatch_mount *fbm,
+    struct fhbatch_op *op)
+{
+	struct nameidata nd;
+	fhandle_t fh;
+	struct vnode *vp;
+	int error;
+
+	NDINIT_AT(&nd, LOOKUP, (op->fbo_flag & AT_SYMLINK_NOFOLLOW ? NOFOLLOW : FOLLOW) | LOCKLEAF | LOCKSHARED | AUDITVNODE1,
+		op->fbo_path ? UIO_USERSPACE : UIO_SYSSPACE, op->fbo_path ? op->fbo_path : ".", op->fbo_fd, td);
+
+	fhbatch_unbusy(fbm);
+	error = namei(&nd);
+	if (error != 0)
+		return (error);
+	NDFREE(&nd, NDF_ONLY_PNBUF);
+	vp = nd.ni_vp;
+
+	bzero(&fh, sizeof(fh));
+	fh.fh_fsid = vp->v_mount->mnt_stat.f_fsid;
+	error = VOP_VPTOFH(vp, &fh.fh_fid);
+	vput(vp);
+	if (error == 0)
+		error = copyout(&fh, op->fbo_fhp, sizeof (fh));
+	return (error);
+}
+
+static int
+fhbatch_resolve(struct fhbatch_mount *fbm, struct fhbatch_op *op)
+{
+	fhandle_t fh;
+	struct vnode *vp;
+	int error;
+
+	error = copyin(op->fbo_fhp, &fh, sizeof(fh));
+	if (error != 0)
+		return (error);
+
+	error = fhbatch_fhtovp(fbm, &fh, LK_SHARED, &vp);
+	if (error != 0)
+		return (error);
+	op->fbo_retval = vp->v_type;
+	vput(vp);
+	return (0);
+}
+
+/* code taken from sys_fhreadlink */
+static int
+fhbatch_readlink(struct thread *td, struct fhbatch_mount *fbm,
+    struct fhbatch_op *op)
+{
+	fhandle_t fh;
+	struct vnode *vp;
+	struct uio auio;
+	struct iovec aiov;
+	int error;
+
+	if (op->fbo_bufsize > IOSIZE_MAX)
+		return (EINVAL);
+
+	error = copyin(op->fbo_fhp, &fh, sizeof(fh));
+	if (error != 0)
+		return (error);
+
+	error = fhbatch_fhtovp(fbm, &fh, LK_SHARED, &vp);
+	if (error != 0)
+		return (error);
+
+#ifdef VV_READLINK
+	if (vp->v_type != VLNK && (vp->v_vflag & VV_READLINK) == 0)
+#else
+	if (vp->v_type != VLNK)
+#endif
+		error = EINVAL;
+	else {
+		aiov.iov_base = op->fbo_buf;
+		aiov.iov_len = op->fbo_bufsize;
+		auio.uio_iov = &aiov;
+		auio.uio_iovcnt = 1;
+		auio.uio_offset = 0;
+		auio.uio_rw = UIO_READ;
+		auio.uio_segflg = UIO_USERSPACE;
+		auio.uio_td = td;
+		auio.uio_resid = op->fbo_bufsize;
+		error = VOP_READLINK(vp, &auio, td->td_ucred);
+		op->fbo_retval = op->fbo_bufsize - auio.uio_resid;
+	}
+	vput(vp);
+	return (error);
+}
+
+/* code taken from sys_fhlink */
+static int
+fhbatch_link(struct thread *td, struct fhbatch_mount *fbm,
+    struct fhbatch_op *op)
+{
+	fhandle_t fh;
+	struct mount *mp;
+	struct vnode *vp;
+	struct nameidata nd;
+	cap_rights_t rights;
+	int error;
+
+	error = copyin(op->fbo_fhp, &fh, sizeof(fh));
+	if (error != 0)
+		return (error);
+
+again:
+	/* bwillwrite() may sleep, not with the mount of the last op busy. */
+	fhbatch_unbusy(fbm);
+	bwillwrite();
+	error = fhbatch_fhtovp(fbm, &fh, LK_SHARED, &vp);
+	fhbatch_unbusy(fbm);
+	if (error != 0)
+		return (error);
+
+	VOP_UNLOCK(vp, 0);
+	if (vp->v_type == VDIR) {
+		vrele(vp);
+		return (EPERM);		/* POSIX */
+	}
+
+#ifdef CAP_LINKAT_TARGET
+	NDINIT_ATRIGHTS(&nd, CREATE,
+	    LOCKPARENT | SAVENAME | AUDITVNODE2 | NOCACHE, UIO_USERSPACE, op->fbo_path, op->fbo_fd,
+	    cap_rights_init(&rights, CAP_LINKAT_TARGET), td);
+#else
+	NDINIT_ATRIGHTS(&nd, CREATE,
+	    LOCKPARENT | SAVENAME | AUDITVNODE2 | NOCACHE, UIO_USERSPACE, op->fbo_path, op->fbo_fd,
+	    cap_rights_init(&rights, CAP_LINKAT), td);
+#endif
+	if ((error = namei(&nd)) == 0) {
+		if (nd.ni_vp != NULL) {
+			NDFREE(&nd, NDF_ONLY_PNBUF);
+			if (nd.ni_dvp == nd.ni_vp)
+				vrele(nd.ni_dvp);
+			else
+				vput(nd.ni_dvp);
+			vrele(nd.ni_vp);
+			vrele(vp);
+			return (EEXIST);
+		} else if (nd.ni_dvp->v_mount != vp->v_mount) {
+			NDFREE(&nd, NDF_ONLY_PNBUF);
+			vput(nd.ni_dvp);
+			vrele(vp);
+			return (EXDEV);
+		} else if ((error = vn_lock(vp, LK_EXCLUSIVE)) == 0) {
+			error = can_hardlink(vp, td->td_ucred);
+#ifdef MAC
+			if (error == 0)
+				error = mac_vnode_check_link(td->td_ucred,
+				    nd.ni_dvp, vp, &nd.ni_cnd);
+#endif
+			if (error != 0) {
+				vput(vp);
+				vput(nd.ni_dvp);
+				NDFREE(&nd, NDF_ONLY_PNBUF);
+				return (error);
+			}
+			error = vn_start_write(vp, &mp, V_NOWAIT);
+			if (error != 0) {
+				vput(vp);
+				vput(nd.ni_dvp);
+				NDFREE(&nd, NDF_ONLY_PNBUF);
+				error = vn_start_write(NULL, &mp,
+				    V_XSLEEP | PCATCH);
+				if (error != 0)
+					return (error);
+				goto again;
+			}
+			error = VOP_LINK(nd.ni_dvp, vp, &nd.ni_cnd);
+			VOP_UNLOCK(vp, 0);
+			vput(nd.ni_dvp);
+			vn_finished_write(mp);
+			NDFREE(&nd, NDF_ONLY_PNBUF);
+		}
+		else {
+			vput(nd.ni_dvp);
+			NDFREE(&nd, NDF_ONLY_PNBUF);
+			vrele(vp);
+			goto again;
+		}
+	}
+	vrele(vp);
+	return (error);
+}
+
+/*
+ * The function for implementing the syscall.
+ */
+static int
+kern_fhbatch(struct thread *td, struct fhbatch_args *uap)
+{
+	struct fhbatch_mount fbm;
+	struct fhbatch_op *ops, *op;
+	u_int i;
+	int error;
+
+	error = priv_check(td, PRIV_VFS_GETFH);
+	if (error != 0)
+		return (error);
+
+	if (uap->nops > FHBATCH_MAX)
+		return (EINVAL);
+
+	ops = malloc(uap->nops * sizeof(*ops), M_TEMP, M_WAITOK);
+	error = copyin(uap->ops, ops, uap->nops * sizeof(*ops));
+	if (error != 0) {
+		free(ops, M_TEMP);
+		return (error);
+	}
+
+	fbm.fbm_mp = NULL;
+	for (i = 0; i < uap->nops; i++) {
+		op = &ops[i];
+		op->fbo_retval = 0;
+		switch (op->fbo_op) {
+		case FHBATCH_GETFHAT:
+			op->fbo_error = fhbatch_getfhat(td, &fbm, op);
+			break;
+		case FHBATCH_RESOLVE:
+			op->fbo_error = fhbatch_resolve(&fbm, op);
+			break;
+		case FHBATCH_READLINK:
+			op->fbo_error = fhbatch_readlink(td, &fbm, op);
+			break;
+		case FHBATCH_LINK:
+			op->fbo_error = fhbatch_link(td, &fbm, op);
+			break;
+		default:
+			op->fbo_error = EINVAL;
+			break;
+		}
+	}
+	fhbatch_unbusy(&fbm);
+
+	error = copyout(ops, uap->ops, uap->nops * sizeof(*ops));
+	free(ops, M_TEMP);
+	if (error == 0)
+		td->td_retval[0] = uap->nops;
+	return (error);
+}
+
+int sys_fhbatch(struct thread *td, void *params)
+{
+	struct fhbatch_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhbatch_args*)params;
+
+	SDT_PROBE2(fhbatch, , fhbatch, entry, uap->ops, uap->nops);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_fhbatch(td, uap);
+	SDT_PROBE2(fhbatch, , fhbatch, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The `sysent' for the new syscall
+ */
+static struct sysent fhbatch_sysent = {
+	2,			/* sy_narg */
+	sys_fhbatch		/* sy_call */
+};
+
+/*
+ * The offset in sysent where the syscall is allocated.
+ */
+static int offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("fhbatch syscall loaded at %d\n", offset);
+		break;
+	case MOD_UNLOAD :
+		printf("fhbatch syscall unloaded from %d\n", offset);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(fhbatch, &offset, &fhbatch_sysent, load, NULL);
+MODULE_DEPEND(fhbatch, fhresolve, 1, 1, 1);
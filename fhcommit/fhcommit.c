@@ -0,0 +1,293 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * Copyright (c) 1999 Assar Westerlund
+ * Copyright (c) 1989, 1993
+ *      The Regents of the University of California.  All rights reserved.
+ * (c) UNIX System Laboratories, Inc.
+ * All or some portions of this file are derived from material licensed
+ * to the University of California by American Telephone and Telegraph
+ * Co. or Unix System Laboratories, Inc. and are reproduced herein with
+ * the permission of UNIX System Laboratories, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/mount.h>
+#include <sys/priv.h>
+#include <sys/vnode.h>
+#include <sys/buf.h>
+#include <sys/malloc.h>
+#include <sys/lock.h>
+#include <sys/rwlock.h>
+#include <sys/sdt.h>
+
+#include <vm/vm.h>
+#include <vm/vm_object.h>
+
+#include "fhresolve.h"
+#include "fileserver.h"
+#include "syscallstat.h"
+
+/*
+ * fsync(2) each file of a vector of handles, for NFS COMMIT.  The
+ * operations are grouped by fsid: for a group the mount is busied
+ * once and the dirty pages of the range of each file are pushed
+ * asynchronously, so that the data writes of the group are in flight
+ * together.  Then each file is synced in turn with a VOP_FSYNC
+ * MNT_WAIT of the whole file: the range only bounds the asynchronous
+ * page clean, and each file still pays its own log flush.  Each
+ * operation gets its own errno in fco_error.
+ */
+
+struct fhcommit_args {
+	struct fhcommit_op	*ops;
+	u_int			nops;
+};
+
+int sys_fhcommit(struct thread *td, void *params);
+
+/*
+ * The per handle errors stay in the vector, fhcommit:::return only
+ * gives the one of the call and its duration.  The handles are not
+ * resolved through fhresolve, fhcommit:::fhtovp gives the fsid and
+ * errno of each.
+ */
+SDT_PROVIDER_DEFINE(fhcommit);
+SDT_PROBE_DEFINE2(fhcommit, , fhcommit, entry, "struct fhcommit_op *", "u_int");
+SDT_PROBE_DEFINE2(fhcommit, , fhcommit, return, "int", "int64_t");
+SDT_PROBE_DEFINE2(fhcommit, , , fhtovp, "fsid_t *", "int");
+
+static int
+fhcommit_cmp(void *thunk, const void *a, const void *b)
+{
+	struct fhcommit_op *ops;
+
+	ops = thunk;
+	return (bcmp(&ops[*(const u_int *)a].fco_fh.fh_fsid,
+	    &ops[*(const u_int *)b].fco_fh.fh_fsid, sizeof(fsid_t)));
+}
+
+/*
+ * code taken from kern_fsync
+ */
+static int
+fhcommit_sync(struct thread *td, struct vnode *vp, struct fhcommit_op *op,
+    int waitfor)
+{
+	struct mount *mp;
+	vm_object_t obj;
+	vm_pindex_t start, end;
+	int error, lock_flags;
+
+	error = vn_start_write(vp, &mp, V_WAIT | PCATCH);
+	if (error != 0)
+		return (error);
+	if (MNT_SHARED_WRITES(mp) ||
+	    ((mp == NULL) && MNT_SHARED_WRITES(vp->v_mount)))
+		lock_flags = LK_SHARED;
+	else
+		lock_flags = LK_EXCLUSIVE;
+	vn_lock(vp, lock_flags | LK_RETRY);
+	if ((vp->v_iflag & VI_DOOMED) != 0) {
+		error = ESTALE;
+	} else if (waitfor == MNT_NOWAIT) {
+		obj = vp->v_object;
+		if (obj != NULL) {
+			start = OFF_TO_IDX(op->fco_offset);
+			if (op->fco_length == 0)
+				end = 0;
+			else
+				end = OFF_TO_IDX(op->fco_offset +
+				    op->fco_length + PAGE_MASK);
+			VM_OBJECT_WLOCK(obj);
+			vm_object_page_clean(obj, start, end, 0);
+			VM_OBJECT_WUNLOCK(obj);
+		}
+	} else
+		error = VOP_FSYNC(vp, MNT_WAIT, td);
+	VOP_UNLOCK(vp, 0);
+	vn_finished_write(mp);
+	return (error);
+}
+
+/*
+ * The function for implementing the syscall.
+ */
+static int
+kern_fhcommit(struct thread *td, struct fhcommit_args *uap)
+{
+	struct fhcommit_op *ops, *op;
+	struct vnode **vps;
+	struct mount *mp;
+	u_int *order;
+	u_int i, j, k;
+	int error;
+
+	error = priv_check(td, PRIV_VFS_FHOPEN);
+	if (error != 0)
+		return (error);
+
+	if (uap->nops > FHCOMMIT_MAX)
+		return (EINVAL);
+
+	ops = malloc(uap->nops * sizeof(*ops), M_TEMP, M_WAITOK);
+	error = copyin(uap->ops, ops, uap->nops * sizeof(*ops));
+	if (error != 0) {
+		free(ops, M_TEMP);
+		return (error);
+	}
+
+	vps = malloc(uap->nops * sizeof(*vps), M_TEMP, M_WAITOK | M_ZERO);
+	order = malloc(uap->nops * sizeof(*order), M_TEMP, M_WAITOK);
+	for (i = 0; i < uap->nops; i++) {
+		order[i] = i;
+		op = &ops[i];
+		if (op->fco_offset < 0 || op->fco_length < 0 ||
+		    op->fco_offset > OFF_MAX - op->fco_length)
+			op->fco_error = EINVAL;
+		else
+			op->fco_error = 0;
+	}
+	qsort_r(order, uap->nops, sizeof(*order), ops, fhcommit_cmp);
+
+	for (i = 0; i < uap->nops; i = j) {
+		/* [i, j) is a group of operations on the same fsid. */
+		for (j = i + 1; j < uap->nops; j++)
+			if (fhcommit_cmp(ops, &order[i], &order[j]) != 0)
+				break;
+
+		mp = fhresolve_busyfs(&ops[order[i]].fco_fh.fh_fsid);
+		for (k = i; k < j; k++) {
+			op = &ops[order[k]];
+			if (op->fco_error != 0)
+				continue;
+			if (mp == NULL) {
+				op->fco_error = ESTALE;
+				SDT_PROBE2(fhcommit, , , fhtovp,
+				    &op->fco_fh.fh_fsid, ESTALE);
+				continue;
+			}
+			op->fco_error = VFS_FHTOVP(mp, &op->fco_fh.fh_fid,
+			    LK_SHARED, &vps[order[k]]);
+			SDT_PROBE2(fhcommit, , , fhtovp, &op->fco_fh.fh_fsid,
+			    op->fco_error);
+			if (op->fco_error == 0)
+				VOP_UNLOCK(vps[order[k]], 0);
+			else
+				vps[order[k]] = NULL;
+		}
+		if (mp != NULL)
+			vfs_unbusy(mp);
+
+		/* Start the writes of the whole group... */
+		for (k = i; k < j; k++)
+			if (vps[order[k]] != NULL)
+				ops[order[k]].fco_error = fhcommit_sync(td,
+				    vps[order[k]], &ops[order[k]], MNT_NOWAIT);
+		/* ...then wait for each file. */
+		for (k = i; k < j; k++) {
+			if (vps[order[k]] == NULL)
+				continue;
+			if (ops[order[k]].fco_error == 0)
+				ops[order[k]].fco_error = fhcommit_sync(td,
+				    vps[order[k]], &ops[order[k]], MNT_WAIT);
+			vrele(vps[order[k]]);
+		}
+	}
+	free(order, M_TEMP);
+	free(vps, M_TEMP);
+
+	error = copyout(ops, uap->ops, uap->nops * sizeof(*ops));
+	free(ops, M_TEMP);
+	if (error == 0)
+		td->td_retval[0] = uap->nops;
+	return (error);
+}
+
+int sys_fhcommit(struct thread *td, void *params)
+{
+	struct fhcommit_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhcommit_args*)params;
+
+	SDT_PROBE2(fhcommit, , fhcommit, entry, uap->ops, uap->nops);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_fhcommit(td, uap);
+	SDT_PROBE2(fhcommit, , fhcommit, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The `sysent' for the new syscall
+ */
+static struct sysent fhcommit_sysent = {
+	2,			/* sy_narg */
+	sys_fhcommit		/* sy_call */
+};
+
+/*
+ * The offset in sysent where the syscall is allocated.
+ */
+static int offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("fhcommit syscall loaded at %d\n", offset);
+		break;
+	case MOD_UNLOAD :
+		printf("fhcommit syscall unloaded from %d\n", offset);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(fhcommit, &offset, &fhcommit_sysent, load, NULL);
+MODULE_DEPEND(fhcommit, fhresolve, 1, 1, 1);
@@ -0,0 +1,278 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * Copyright (c) 1999 Assar Westerlund
+ * Copyright (c) 1989, 1993
+ *      The Regents of the University of California.  All rights reserved.
+ * (c) UNIX System Laboratories, Inc.
+ * All or some portions of this file are derived from material licensed
+ * to the University of California by American Telephone and Telegraph
+ * Co. or Unix System Laboratories, Inc. and are reproduced herein with
+ * the permission of UNIX System Laboratories, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/mount.h>
+#include <sys/priv.h>
+#include <sys/vnode.h>
+#include <sys/malloc.h>
+#include <sys/sysctl.h>
+#include <sys/uio.h>
+#include <sys/sdt.h>
+
+#include "fhresolve.h"
+#include "syscallstat.h"
+
+/*
+ * copy_file_range(2)-like copy between two files given by handle, for
+ * NFSv4.2 COPY.  The data never leaves the kernel.  A call copies at
+ * most kern.fhcopyrange.max_bytes and updates both offsets, so a long
+ * copy is done in several calls and can be resumed after an error.
+ */
+
+#define	FHCOPYRANGE_BUFSIZE	MAXPHYS
+
+struct fhcopyrange_args {
+	fhandle_t	*infhp;
+	off_t		*inoffp;
+	fhandle_t	*outfhp;
+	off_t		*outoffp;
+	size_t		len;
+	u_int		flags;
+};
+
+int sys_fhcopyrange(struct thread *td, void *params);
+
+/*
+ * Both handle resolutions are under fhresolve:::fhtovp.
+ */
+SDT_PROVIDER_DEFINE(fhcopyrange);
+SDT_PROBE_DEFINE3(fhcopyrange, , fhcopyrange, entry, "fhandle_t *",
+    "fhandle_t *", "size_t");
+SDT_PROBE_DEFINE2(fhcopyrange, , fhcopyrange, return, "int", "int64_t");
+
+static u_long fhcopyrange_max_bytes = 64 * 1024 * 1024;
+
+static SYSCTL_NODE(_kern, OID_AUTO, fhcopyrange, CTLFLAG_RW, 0,
+    "fhcopyrange");
+SYSCTL_ULONG(_kern_fhcopyrange, OID_AUTO, max_bytes, CTLFLAG_RWTUN,
+    &fhcopyrange_max_bytes, 0, "Bytes copied at most by one call");
+
+/*
+ * Resolve a handle to a referenced, unlocked regular file the calling
+ * thread may access with `accmode'.
+ */
+static int
+fhcopyrange_fhtovp(struct thread *td, fhandle_t *fhp, accmode_t accmode,
+    struct vnode **vpp)
+{
+	struct vnode *vp;
+	int error;
+
+	error = fhresolve_fhtovp(fhp, LK_SHARED, &vp);
+	if (error != 0)
+		return (error);
+
+	if (vp->v_type != VREG)
+		error = vp->v_type == VDIR ? EISDIR : EINVAL;
+	if (error == 0 && (accmode & VWRITE) != 0)
+		error = vn_writechk(vp);
+	if (error == 0)
+		error = VOP_ACCESS(vp, accmode, td->td_ucred, td);
+	if (error != 0) {
+		vput(vp);
+		return (error);
+	}
+	VOP_UNLOCK(vp, 0);
+	*vpp = vp;
+	return (0);
+}
+
+/*
+ * The function for implementing the syscall.
+ */
+static int
+kern_fhcopyrange(struct thread *td, struct fhcopyrange_args *uap)
+{
+	fhandle_t infh, outfh;
+	struct vnode *invp, *outvp;
+	off_t inoff, outoff;
+	size_t len, copied, xfer;
+	ssize_t resid;
+	char *buf;
+	int error;
+
+	error = priv_check(td, PRIV_VFS_FHOPEN);
+	if (error != 0)
+		return (error);
+
+	if (uap->flags != 0)
+		return (EINVAL);
+
+	error = copyin(uap->infhp, &infh, sizeof(infh));
+	if (error == 0)
+		error = copyin(uap->inoffp, &inoff, sizeof(inoff));
+	if (error == 0)
+		error = copyin(uap->outfhp, &outfh, sizeof(outfh));
+	if (error == 0)
+		error = copyin(uap->outoffp, &outoff, sizeof(outoff));
+	if (error != 0)
+		return (error);
+
+	len = MIN(uap->len, fhcopyrange_max_bytes);
+	if (inoff < 0 || outoff < 0 ||
+	    len > OFF_MAX - inoff || len > OFF_MAX - outoff)
+		return (EINVAL);
+
+	error = fhcopyrange_fhtovp(td, &infh, VREAD, &invp);
+	if (error != 0)
+		return (error);
+	error = fhcopyrange_fhtovp(td, &outfh, VWRITE, &outvp);
+	if (error != 0) {
+		vrele(invp);
+		return (error);
+	}
+
+	/* code taken from kern_copy_file_range */
+	if (invp == outvp && inoff < outoff + (off_t)len &&
+	    outoff < inoff + (off_t)len) {
+		error = EINVAL;
+		goto out;
+	}
+	if (len == 0) {
+		td->td_retval[0] = 0;
+		goto out;
+	}
+
+	/*
+	 * FreeBSD 11 has no VOP to clone blocks, copy through a kernel
+	 * buffer.  Each chunk is read and then written with vn_rdwr(),
+	 * which takes the range, vnode and write locks itself, so the
+	 * two vnodes are never locked at the same time.
+	 */
+	buf = malloc(MIN(len, FHCOPYRANGE_BUFSIZE), M_TEMP, M_WAITOK);
+	copied = 0;
+	while (copied < len) {
+		xfer = MIN(len - copied, FHCOPYRANGE_BUFSIZE);
+		error = vn_rdwr(UIO_READ, invp, buf, xfer, inoff,
+		    UIO_SYSSPACE, 0, td->td_ucred, NOCRED, &resid, td);
+		if (error != 0)
+			break;
+		xfer -= resid;
+		if (xfer == 0)
+			break;		/* EOF */
+		error = vn_rdwr(UIO_WRITE, outvp, buf, xfer, outoff,
+		    UIO_SYSSPACE, 0, td->td_ucred, NOCRED, &resid, td);
+		xfer -= resid;
+		copied += xfer;
+		inoff += xfer;
+		outoff += xfer;
+		if (error != 0 || resid != 0)
+			break;
+	}
+	free(buf, M_TEMP);
+
+	/* Report the progress made before an error, as write(2) does. */
+	if (copied > 0) {
+		error = copyout(&inoff, uap->inoffp, sizeof(inoff));
+		if (error == 0)
+			error = copyout(&outoff, uap->outoffp, sizeof(outoff));
+		if (error == 0)
+			td->td_retval[0] = copied;
+	} else if (error == 0)
+		td->td_retval[0] = 0;
+out:
+	vrele(outvp);
+	vrele(invp);
+	return (error);
+}
+
+int
+sys_fhcopyrange(struct thread *td, void *params)
+{
+	struct fhcopyrange_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhcopyrange_args*)params;
+
+	SDT_PROBE3(fhcopyrange, , fhcopyrange, entry, uap->infhp, uap->outfhp,
+	    uap->len);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_fhcopyrange(td, uap);
+	SDT_PROBE2(fhcopyrange, , fhcopyrange, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The `sysent' for the new syscall
+ */
+static struct sysent fhcopyrange_sysent = {
+	6,			/* sy_narg */
+	sys_fhcopyrange		/* sy_call */
+};
+
+/*
+ * The offset in sysent where the syscall is allocated.
+ */
+static int offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("fhcopyrange syscall loaded at %d\n", offset);
+		break;
+	case MOD_UNLOAD :
+		printf("fhcopyrange syscall unloaded from %d\n", offset);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(fhcopyrange, &offset, &fhcopyrange_sysent, load, NULL);
+MODULE_DEPEND(fhcopyrange, fhresolve, 1, 1, 1);
@@ -0,0 +1,422 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * Copyright (c) 1999 Assar Westerlund
+ * Copyright (c) 1989, 1993
+ *      The Regents of the University of California.  All rights reserved.
+ * (c) UNIX System Laboratories, Inc.
+ * All or some portions of this file are derived from material licensed
+ * to the University of California by American Telephone and Telegraph
+ * Co. or Unix System Laboratories, Inc. and are reproduced herein with
+ * the permission of UNIX System Laboratories, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/namei.h>
+#include <sys/mount.h>
+#include <sys/priv.h>
+#include <sys/vnode.h>
+#include <sys/file.h>
+#include <sys/filedesc.h>
+#include <sys/buf.h>
+#include <sys/malloc.h>
+#include <sys/stat.h>
+#include <sys/sdt.h>
+
+#include <vm/uma.h>
+
+#include "fhresolve.h"
+#include "syscallstat.h"
+
+/*
+ * Create a directory, symbolic link or special file by name in a
+ * directory given by handle, and return the handle and attributes of
+ * the new object taken from the vnode the filesystem created.
+ */
+
+struct fhmkdirat_args {
+	fhandle_t	*dfhp;
+	const char	*name;
+	char		mode_l_[PADL_(mode_t)]; mode_t mode; char mode_r_[PADR_(mode_t)];
+	fhandle_t	*fhp;
+	struct stat	*sbp;
+};
+
+struct fhsymlinkat_args {
+	const char	*target;
+	fhandle_t	*dfhp;
+	const char	*name;
+	fhandle_t	*fhp;
+	struct stat	*sbp;
+};
+
+struct fhmknodat_args {
+	fhandle_t	*dfhp;
+	const char	*name;
+	char		mode_l_[PADL_(mode_t)]; mode_t mode; char mode_r_[PADR_(mode_t)];
+	char		dev_l_[PADL_(dev_t)]; dev_t dev; char dev_r_[PADR_(dev_t)];
+	fhandle_t	*fhp;
+	struct stat	*sbp;
+};
+
+int sys_fhmkdirat(struct thread *td, void *params);
+int sys_fhsymlinkat(struct thread *td, void *params);
+int sys_fhmknodat(struct thread *td, void *params);
+
+/*
+ * The parent handle resolution is under fhresolve:::fhtovp.
+ */
+SDT_PROVIDER_DEFINE(fhcreate);
+SDT_PROBE_DEFINE3(fhcreate, , fhmkdirat, entry, "fhandle_t *", "char *",
+    "mode_t");
+SDT_PROBE_DEFINE2(fhcreate, , fhmkdirat, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(fhcreate, , fhsymlinkat, entry, "fhandle_t *", "char *",
+    "char *");
+SDT_PROBE_DEFINE2(fhcreate, , fhsymlinkat, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(fhcreate, , fhmknodat, entry, "fhandle_t *", "char *",
+    "mode_t");
+SDT_PROBE_DEFINE2(fhcreate, , fhmknodat, return, "int", "int64_t");
+
+/*
+ * Resolve the parent handle to an unlocked, referenced directory.
+ */
+static int
+fhcreate_dvp(fhandle_t *fh, struct vnode **dvpp)
+{
+	struct vnode *dvp;
+	int error;
+
+	error = fhresolve_fhtovp(fh, LK_SHARED, &dvp);
+	if (error != 0)
+		return (error);
+
+	if (dvp->v_type != VDIR) {
+		vput(dvp);
+		return (ENOTDIR);
+	}
+	VOP_UNLOCK(dvp, 0);
+	*dvpp = dvp;
+	return (0);
+}
+
+/*
+ * code taken from kern_mkdirat, kern_symlinkat and kern_mknodat
+ *
+ * vap->va_type selects the operation.  The parent is resolved again on
+ * each restart, as sys_fhlink does.
+ */
+static int
+kern_fhcreate(struct thread *td, fhandle_t *dfhp, const char *uname,
+    struct vattr *vap, const char *target, fhandle_t *ufhp,
+    struct stat *usbp)
+{
+	struct nameidata nd;
+	char name[NAME_MAX + 1];
+	fhandle_t fh;
+	struct stat sb;
+	struct mount *mp;
+	struct vnode *dvp, *vp;
+	int error;
+
+	error = priv_check(td, PRIV_VFS_GETFH);
+	if (error != 0)
+		return (error);
+
+	error = copyin(dfhp, &fh, sizeof(fh));
+	if (error != 0)
+		return (error);
+	error = copyinstr(uname, name, sizeof(name), NULL);
+	if (error != 0)
+		return (error);
+	if (name[0] == '\0')
+		return (ENOENT);
+	if (strchr(name, '/') != NULL)
+		return (EINVAL);
+
+restart:
+	bwillwrite();
+	error = fhcreate_dvp(&fh, &dvp);
+	if (error != 0)
+		return (error);
+
+	/* namei() consumes the reference on the start directory. */
+	NDINIT_ATVP(&nd, CREATE, LOCKPARENT | SAVENAME | AUDITVNODE1 | NOCACHE,
+	    UIO_SYSSPACE, name, dvp, td);
+	if (vap->va_type == VDIR)
+		nd.ni_cnd.cn_flags |= WILLBEDIR;
+	if ((error = namei(&nd)) != 0)
+		return (error);
+	if (nd.ni_vp != NULL) {
+		NDFREE(&nd, NDF_ONLY_PNBUF);
+		if (nd.ni_vp == nd.ni_dvp)
+			vrele(nd.ni_dvp);
+		else
+			vput(nd.ni_dvp);
+		vrele(nd.ni_vp);
+		return (EEXIST);
+	}
+	if (vn_start_write(nd.ni_dvp, &mp, V_NOWAIT) != 0) {
+		NDFREE(&nd, NDF_ONLY_PNBUF);
+		vput(nd.ni_dvp);
+		if ((error = vn_start_write(NULL, &mp, V_XSLEEP | PCATCH)) != 0)
+			return (error);
+		goto restart;
+	}
+#ifdef MAC
+	error = mac_vnode_check_create(td->td_ucred, nd.ni_dvp, &nd.ni_cnd,
+	    vap);
+	if (error != 0)
+		goto out;
+#endif
+	switch (vap->va_type) {
+	case VDIR:
+		error = VOP_MKDIR(nd.ni_dvp, &nd.ni_vp, &nd.ni_cnd, vap);
+		break;
+	case VLNK:
+		error = VOP_SYMLINK(nd.ni_dvp, &nd.ni_vp, &nd.ni_cnd, vap,
+		    __DECONST(char *, target));
+		break;
+	default:
+		error = VOP_MKNOD(nd.ni_dvp, &nd.ni_vp, &nd.ni_cnd, vap);
+		break;
+	}
+#ifdef MAC
+out:
+#endif
+	NDFREE(&nd, NDF_ONLY_PNBUF);
+	vput(nd.ni_dvp);
+	if (error == 0) {
+		/* The new vnode comes back locked, use it directly. */
+		vp = nd.ni_vp;
+		bzero(&fh, sizeof(fh));
+		fh.fh_fsid = vp->v_mount->mnt_stat.f_fsid;
+		error = VOP_VPTOFH(vp, &fh.fh_fid);
+		if (error == 0 && usbp != NULL)
+			error = vn_stat(vp, &sb, td->td_ucred, NOCRED, td);
+		vput(vp);
+	}
+	vn_finished_write(mp);
+	if (error == 0)
+		error = copyout(&fh, ufhp, sizeof (fh));
+	if (error == 0 && usbp != NULL)
+		error = copyout(&sb, usbp, sizeof (sb));
+	return (error);
+}
+
+/*
+ * The function for implementing the mkdir syscall.
+ */
+static int
+kern_fhmkdirat(struct thread *td, struct fhmkdirat_args *uap)
+{
+	struct vattr vattr;
+
+	VATTR_NULL(&vattr);
+	vattr.va_type = VDIR;
+	vattr.va_mode = (uap->mode & ACCESSPERMS) &~ td->td_proc->p_fd->fd_cmask;
+	return (kern_fhcreate(td, uap->dfhp, uap->name, &vattr, NULL, uap->fhp,
+	    uap->sbp));
+}
+
+int sys_fhmkdirat(struct thread *td, void *params)
+{
+	struct fhmkdirat_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhmkdirat_args*)params;
+
+	SDT_PROBE3(fhcreate, , fhmkdirat, entry, uap->dfhp, uap->name,
+	    uap->mode);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_fhmkdirat(td, uap);
+	SDT_PROBE2(fhcreate, , fhmkdirat, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The function for implementing the symlink syscall.
+ */
+static int
+kern_fhsymlinkat(struct thread *td, struct fhsymlinkat_args *uap)
+{
+	struct vattr vattr;
+	char *target;
+	int error;
+
+	target = uma_zalloc(namei_zone, M_WAITOK);
+	error = copyinstr(uap->target, target, MAXPATHLEN, NULL);
+	if (error == 0) {
+		VATTR_NULL(&vattr);
+		vattr.va_type = VLNK;
+		vattr.va_mode = ACCESSPERMS &~ td->td_proc->p_fd->fd_cmask;
+		error = kern_fhcreate(td, uap->dfhp, uap->name, &vattr, target,
+		    uap->fhp, uap->sbp);
+	}
+	uma_zfree(namei_zone, target);
+	return (error);
+}
+
+int sys_fhsymlinkat(struct thread *td, void *params)
+{
+	struct fhsymlinkat_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhsymlinkat_args*)params;
+
+	SDT_PROBE3(fhcreate, , fhsymlinkat, entry, uap->dfhp, uap->name,
+	    uap->target);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_fhsymlinkat(td, uap);
+	SDT_PROBE2(fhcreate, , fhsymlinkat, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The function for implementing the mknod syscall.  Fifos and sockets
+ * can be created too, since NFS creates them the same way.
+ */
+static int
+kern_fhmknodat(struct thread *td, struct fhmknodat_args *uap)
+{
+	struct vattr vattr;
+	int error;
+
+	VATTR_NULL(&vattr);
+	switch (uap->mode & S_IFMT) {
+	case S_IFCHR:
+		vattr.va_type = VCHR;
+		break;
+	case S_IFBLK:
+		vattr.va_type = VBLK;
+		break;
+	case S_IFIFO:
+		vattr.va_type = VFIFO;
+		break;
+	case S_IFSOCK:
+		vattr.va_type = VSOCK;
+		break;
+	default:
+		return (EINVAL);
+	}
+	if (vattr.va_type == VCHR || vattr.va_type == VBLK) {
+		error = priv_check(td, PRIV_VFS_MKNOD_DEV);
+		if (error != 0)
+			return (error);
+		vattr.va_rdev = uap->dev;
+	}
+	vattr.va_mode = (uap->mode & ALLPERMS) &~ td->td_proc->p_fd->fd_cmask;
+	return (kern_fhcreate(td, uap->dfhp, uap->name, &vattr, NULL, uap->fhp,
+	    uap->sbp));
+}
+
+int sys_fhmknodat(struct thread *td, void *params)
+{
+	struct fhmknodat_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhmknodat_args*)params;
+
+	SDT_PROBE3(fhcreate, , fhmknodat, entry, uap->dfhp, uap->name,
+	    uap->mode);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_fhmknodat(td, uap);
+	SDT_PROBE2(fhcreate, , fhmknodat, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The `sysent's for the new syscalls
+ */
+static struct sysent fhmkdirat_sysent = {
+	5,			/* sy_narg */
+	sys_fhmkdirat		/* sy_call */
+};
+
+static struct sysent fhsymlinkat_sysent = {
+	5,			/* sy_narg */
+	sys_fhsymlinkat		/* sy_call */
+};
+
+static struct sysent fhmknodat_sysent = {
+	6,			/* sy_narg */
+	sys_fhmknodat		/* sy_call */
+};
+
+/*
+ * The offsets in sysent where the syscalls are allocated.
+ */
+static int fhmkdirat_offset = NO_SYSCALL;
+static int fhsymlinkat_offset = NO_SYSCALL;
+static int fhmknodat_offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload, arg points to the offset.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("%s syscall loaded at %d\n", module_getname(module),
+		    *(int *)arg);
+		break;
+	case MOD_UNLOAD :
+		printf("%s syscall unloaded from %d\n", module_getname(module),
+		    *(int *)arg);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(fhmkdirat, &fhmkdirat_offset, &fhmkdirat_sysent, load,
+    &fhmkdirat_offset);
+SYSCALL_MODULE(fhsymlinkat, &fhsymlinkat_offset, &fhsymlinkat_sysent, load,
+    &fhsymlinkat_offset);
+SYSCALL_MODULE(fhmknodat, &fhmknodat_offset, &fhmknodat_sysent, load,
+    &fhmknodat_offset);
+MODULE_DEPEND(fhmkdirat, fhresolve, 1, 1, 1);
@@ -0,0 +1,242 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * Copyright (c) 1999 Assar Westerlund
+ * Copyright (c) 1989, 1993
+ *      The Regents of the University of California.  All rights reserved.
+ * (c) UNIX System Laboratories, Inc.
+ * All or some portions of this file are derived from material licensed
+ * to the University of California by American Telephone and Telegraph
+ * Co. or Unix System Laboratories, Inc. and are reproduced herein with
+ * the permission of UNIX System Laboratories, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/mount.h>
+#include <sys/priv.h>
+#include <sys/vnode.h>
+#include <sys/sdt.h>
+
+#include "fhresolve.h"
+#include "fileserver.h"
+#include "syscallstat.h"
+
+/*
+ * Attributes of a file given by handle, for NFSv4 GETATTR.  Only the
+ * fields asked for in the mask are filled, fa_valid tells which ones
+ * were: FHATTR_CHANGE and FHATTR_BIRTHTIME are cleared when the
+ * filesystem does not maintain them.  The vnode is resolved with a
+ * shared lock and VOP_GETATTR is skipped when only the type and the
+ * fsid are asked for.
+ */
+
+#define	FHATTR_NOGETATTR	(FHATTR_TYPE | FHATTR_FSID)
+
+struct fhgetattrs_args {
+	fhandle_t	*fhp;
+	u_int		mask;
+	struct fhattrs	*attrp;
+};
+
+int sys_fhgetattrs(struct thread *td, void *params);
+
+/*
+ * The handle resolution is under fhresolve:::fhtovp.
+ */
+SDT_PROVIDER_DEFINE(fhgetattrs);
+SDT_PROBE_DEFINE2(fhgetattrs, , fhgetattrs, entry, "fhandle_t *", "u_int");
+SDT_PROBE_DEFINE2(fhgetattrs, , fhgetattrs, return, "int", "int64_t");
+
+/* code taken from vn_stat */
+static int
+fhgetattrs_fill(struct thread *td, struct vnode *vp, u_int mask,
+    struct fhattrs *fa)
+{
+	struct vattr vattr;
+	struct vattr *vap;
+	int error;
+
+	bzero(fa, sizeof(*fa));
+	fa->fa_valid = mask;
+	if (mask & FHATTR_TYPE)
+		fa->fa_type = vp->v_type;
+	if (mask & FHATTR_FSID)
+		fa->fa_fsid = vp->v_mount->mnt_stat.f_fsid;
+	if ((mask & ~FHATTR_NOGETATTR) == 0)
+		return (0);
+
+#ifdef MAC
+	error = mac_vnode_check_stat(td->td_ucred, NOCRED, vp);
+	if (error != 0)
+		return (error);
+#endif
+
+	vap = &vattr;
+	vap->va_birthtime.tv_sec = -1;
+	vap->va_birthtime.tv_nsec = 0;
+	vap->va_filerev = VNOVAL;
+	error = VOP_GETATTR(vp, vap, td->td_ucred);
+	if (error != 0)
+		return (error);
+
+	if (mask & FHATTR_MODE)
+		fa->fa_mode = vap->va_mode;
+	if (mask & FHATTR_NLINK)
+		fa->fa_nlink = vap->va_nlink;
+	if (mask & FHATTR_OWNER) {
+		fa->fa_uid = vap->va_uid;
+		fa->fa_gid = vap->va_gid;
+	}
+	if (mask & FHATTR_SIZE) {
+		fa->fa_size = vap->va_size;
+		fa->fa_bytes = vap->va_bytes;
+	}
+	if (mask & FHATTR_FILEID)
+		fa->fa_fileid = vap->va_fileid;
+	if (mask & FHATTR_CHANGE) {
+		if (vap->va_filerev != (u_quad_t)VNOVAL)
+			fa->fa_change = vap->va_filerev;
+		else
+			fa->fa_valid &= ~FHATTR_CHANGE;
+	}
+	if (mask & FHATTR_ATIME)
+		fa->fa_atime = vap->va_atime;
+	if (mask & FHATTR_MTIME)
+		fa->fa_mtime = vap->va_mtime;
+	if (mask & FHATTR_CTIME)
+		fa->fa_ctime = vap->va_ctime;
+	if (mask & FHATTR_BIRTHTIME) {
+		if (vap->va_birthtime.tv_sec != -1)
+			fa->fa_birthtime = vap->va_birthtime;
+		else
+			fa->fa_valid &= ~FHATTR_BIRTHTIME;
+	}
+	if (mask & FHATTR_RDEV)
+		fa->fa_rdev = vap->va_rdev;
+	if (mask & FHATTR_FLAGS)
+		fa->fa_flags = vap->va_flags;
+	if (mask & FHATTR_GEN)
+		fa->fa_gen = vap->va_gen;
+	return (0);
+}
+
+/*
+ * The function for implementing the syscall.
+ */
+static int
+kern_fhgetattrs(struct thread *td, struct fhgetattrs_args *uap)
+{
+	fhandle_t fh;
+	struct fhattrs fa;
+	struct vnode *vp;
+	int error;
+
+	error = priv_check(td, PRIV_VFS_FHSTAT);
+	if (error != 0)
+		return (error);
+
+	if ((uap->mask & ~FHATTR_ALL) != 0)
+		return (EINVAL);
+
+	error = copyin(uap->fhp, &fh, sizeof(fh));
+	if (error != 0)
+		return (error);
+
+	error = fhresolve_fhtovp(&fh, LK_SHARED, &vp);
+	if (error != 0)
+		return (error);
+
+	error = fhgetattrs_fill(td, vp, uap->mask, &fa);
+	vput(vp);
+	if (error == 0)
+		error = copyout(&fa, uap->attrp, sizeof(fa));
+	return (error);
+}
+
+int sys_fhgetattrs(struct thread *td, void *params)
+{
+	struct fhgetattrs_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhgetattrs_args*)params;
+
+	SDT_PROBE2(fhgetattrs, , fhgetattrs, entry, uap->fhp, uap->mask);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_fhgetattrs(td, uap);
+	SDT_PROBE2(fhgetattrs, , fhgetattrs, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The `sysent' for the new syscall
+ */
+static struct sysent fhgetattrs_sysent = {
+	3,			/* sy_narg */
+	sys_fhgetattrs		/* sy_call */
+};
+
+/*
+ * The offset in sysent where the syscall is allocated.
+ */
+static int offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("fhgetattrs syscall loaded at %d\n", offset);
+		break;
+	case MOD_UNLOAD :
+		printf("fhgetattrs syscall unloaded from %d\n", offset);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(fhgetattrs, &offset, &fhgetattrs_sysent, load, NULL);
+MODULE_DEPEND(fhgetattrs, fhresolve, 1, 1, 1);
@@ -0,0 +1,390 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * Copyright (c) 1999 Assar Westerlund
+ * Copyright (c) 1989, 1993
+ *      The Regents of the University of California.  All rights reserved.
+ * (c) UNIX System Laboratories, Inc.
+ * All or some portions of this file are derived from material licensed
+ * to the University of California by American Telephone and Telegraph
+ * Co. or Unix System Laboratories, Inc. and are reproduced herein with
+ * the permission of UNIX System Laboratories, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/namei.h>
+#include <sys/mount.h>
+#include <sys/priv.h>
+#include <sys/vnode.h>
+#include <sys/file.h>
+#include <sys/buf.h>
+#include <sys/malloc.h>
+#include <sys/uio.h>
+#include <sys/sdt.h>
+
+#include "fhresolve.h"
+#include "fileserver.h"
+#include "syscallstat.h"
+
+/*
+ * Positional I/O on a regular file given by handle, without an open
+ * file.  There is no open to check access once, so it is checked
+ * against the calling thread's td_ucred on every call.
+ */
+
+#define	FHIO_FLAGS	(FHIO_DIRECT | FHIO_SYNC | FHIO_SEQUENTIAL)
+
+/* The offset takes two argument words on 32-bit platforms. */
+#ifdef __LP64__
+#define	FHIO_OFF_NARG	1
+#else
+#define	FHIO_OFF_NARG	2
+#endif
+
+struct fhpread_args {
+	fhandle_t	*fhp;
+	void		*buf;
+	size_t		nbyte;
+	off_t		offset;
+	int		flags;
+};
+
+struct fhpreadv_args {
+	fhandle_t	*fhp;
+	struct iovec	*iovp;
+	u_int		iovcnt;
+	off_t		offset;
+	int		flags;
+};
+
+int sys_fhpread(struct thread *td, void *params);
+int sys_fhpwrite(struct thread *td, void *params);
+int sys_fhpreadv(struct thread *td, void *params);
+int sys_fhpwritev(struct thread *td, void *params);
+
+/*
+ * The return probes give the errno and the duration, the phases are
+ * under fhresolve:::fhtovp.
+ */
+SDT_PROVIDER_DEFINE(fhio);
+SDT_PROBE_DEFINE3(fhio, , fhpread, entry, "fhandle_t *", "off_t", "size_t");
+SDT_PROBE_DEFINE2(fhio, , fhpread, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(fhio, , fhpwrite, entry, "fhandle_t *", "off_t", "size_t");
+SDT_PROBE_DEFINE2(fhio, , fhpwrite, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(fhio, , fhpreadv, entry, "fhandle_t *", "off_t", "u_int");
+SDT_PROBE_DEFINE2(fhio, , fhpreadv, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(fhio, , fhpwritev, entry, "fhandle_t *", "off_t", "u_int");
+SDT_PROBE_DEFINE2(fhio, , fhpwritev, return, "int", "int64_t");
+
+/*
+ * code taken from vn_read, vn_write and dofileread
+ */
+static int
+kern_fhio(struct thread *td, fhandle_t *ufhp, struct uio *auio, int flags)
+{
+	fhandle_t fh;
+	struct mount *mp;
+	struct vnode *vp;
+	struct ucred *cred;
+	void *rl_cookie;
+	ssize_t cnt;
+	int error, ioflag, lkflags;
+
+	error = priv_check(td, PRIV_VFS_FHOPEN);
+	if (error != 0)
+		return (error);
+
+	if ((flags & ~FHIO_FLAGS) != 0 || auio->uio_offset < 0 ||
+	    auio->uio_resid > OFF_MAX - auio->uio_offset)
+		return (EINVAL);
+
+	error = copyin(ufhp, &fh, sizeof(fh));
+	if (error != 0)
+		return (error);
+
+	/* code taken from vn_write: a write is all or nothing */
+	ioflag = auio->uio_rw == UIO_WRITE ? IO_UNIT : 0;
+	if (flags & FHIO_DIRECT)
+		ioflag |= IO_DIRECT;
+	if ((flags & FHIO_SYNC) && auio->uio_rw == UIO_WRITE)
+		ioflag |= IO_SYNC;
+	if (flags & FHIO_SEQUENTIAL)
+		ioflag |= IO_SEQMAX << IO_SEQSHIFT;
+
+	if (auio->uio_rw == UIO_WRITE)
+		bwillwrite();
+
+	error = fhresolve_fhtovp(&fh, LK_SHARED, &vp);
+	if (error != 0)
+		return (error);
+	VOP_UNLOCK(vp, 0);
+
+	if (vp->v_type != VREG) {
+		error = vp->v_type == VDIR ? EISDIR : EINVAL;
+		vrele(vp);
+		return (error);
+	}
+
+	cred = td->td_ucred;
+	cnt = auio->uio_resid;
+	mp = NULL;
+	if (auio->uio_rw == UIO_READ) {
+		rl_cookie = vn_rangelock_rlock(vp, auio->uio_offset,
+		    auio->uio_offset + auio->uio_resid);
+		vn_lock(vp, LK_SHARED | LK_RETRY);
+	} else {
+		rl_cookie = vn_rangelock_wlock(vp, auio->uio_offset,
+		    auio->uio_offset + auio->uio_resid);
+		error = vn_start_write(vp, &mp, V_WAIT | PCATCH);
+		if (error != 0) {
+			vn_rangelock_unlock(vp, rl_cookie);
+			vrele(vp);
+			return (error);
+		}
+		if (MNT_SHARED_WRITES(mp) ||
+		    (mp == NULL && MNT_SHARED_WRITES(vp->v_mount)))
+			lkflags = LK_SHARED;
+		else
+			lkflags = LK_EXCLUSIVE;
+		vn_lock(vp, lkflags | LK_RETRY);
+	}
+
+	if ((vp->v_iflag & VI_DOOMED) != 0) {
+		error = ESTALE;
+		goto out;
+	}
+
+	if (auio->uio_rw == UIO_READ) {
+#ifdef MAC
+		error = mac_vnode_check_read(cred, NOCRED, vp);
+		if (error == 0)
+#endif
+			error = VOP_ACCESS(vp, VREAD, cred, td);
+		if (error == 0)
+			error = VOP_READ(vp, auio, ioflag, cred);
+	} else {
+		error = vn_writechk(vp);
+#ifdef MAC
+		if (error == 0)
+			error = mac_vnode_check_write(cred, NOCRED, vp);
+#endif
+		if (error == 0)
+			error = VOP_ACCESS(vp, VWRITE, cred, td);
+		if (error == 0)
+			error = VOP_WRITE(vp, auio, ioflag, cred);
+	}
+out:
+	VOP_UNLOCK(vp, 0);
+	if (auio->uio_rw == UIO_WRITE)
+		vn_finished_write(mp);
+	vn_rangelock_unlock(vp, rl_cookie);
+	vrele(vp);
+
+	if (error != 0 && auio->uio_resid != cnt &&
+	    (error == ERESTART || error == EINTR || error == EWOULDBLOCK))
+		error = 0;
+	if (error == 0)
+		td->td_retval[0] = cnt - auio->uio_resid;
+	return (error);
+}
+
+static int
+fhio_rdwr(struct thread *td, struct fhpread_args *uap, enum uio_rw rw)
+{
+	struct uio auio;
+	struct iovec aiov;
+
+	if (uap->nbyte > IOSIZE_MAX)
+		return (EINVAL);
+	aiov.iov_base = uap->buf;
+	aiov.iov_len = uap->nbyte;
+	auio.uio_iov = &aiov;
+	auio.uio_iovcnt = 1;
+	auio.uio_offset = uap->offset;
+	auio.uio_resid = uap->nbyte;
+	auio.uio_segflg = UIO_USERSPACE;
+	auio.uio_rw = rw;
+	auio.uio_td = td;
+	return (kern_fhio(td, uap->fhp, &auio, uap->flags));
+}
+
+static int
+fhio_rdwrv(struct thread *td, struct fhpreadv_args *uap, enum uio_rw rw)
+{
+	struct uio *auio;
+	int error;
+
+	error = copyinuio(uap->iovp, uap->iovcnt, &auio);
+	if (error != 0)
+		return (error);
+	auio->uio_offset = uap->offset;
+	auio->uio_rw = rw;
+	auio->uio_td = td;
+	error = kern_fhio(td, uap->fhp, auio, uap->flags);
+	free(auio, M_IOV);
+	return (error);
+}
+
+/*
+ * The functions for implementing the syscalls.
+ */
+int sys_fhpread(struct thread *td, void *params)
+{
+	struct fhpread_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhpread_args*)params;
+
+	SDT_PROBE3(fhio, , fhpread, entry, uap->fhp, uap->offset, uap->nbyte);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = fhio_rdwr(td, uap, UIO_READ);
+	SDT_PROBE2(fhio, , fhpread, return, error, syscallstat_elapsed(start));
+	return (error);
+}
+
+int sys_fhpwrite(struct thread *td, void *params)
+{
+	struct fhpread_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhpread_args*)params;
+
+	SDT_PROBE3(fhio, , fhpwrite, entry, uap->fhp, uap->offset, uap->nbyte);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = fhio_rdwr(td, uap, UIO_WRITE);
+	SDT_PROBE2(fhio, , fhpwrite, return, error, syscallstat_elapsed(start));
+	return (error);
+}
+
+int sys_fhpreadv(struct thread *td, void *params)
+{
+	struct fhpreadv_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhpreadv_args*)params;
+
+	SDT_PROBE3(fhio, , fhpreadv, entry, uap->fhp, uap->offset, uap->iovcnt);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = fhio_rdwrv(td, uap, UIO_READ);
+	SDT_PROBE2(fhio, , fhpreadv, return, error, syscallstat_elapsed(start));
+	return (error);
+}
+
+int sys_fhpwritev(struct thread *td, void *params)
+{
+	struct fhpreadv_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhpreadv_args*)params;
+
+	SDT_PROBE3(fhio, , fhpwritev, entry, uap->fhp, uap->offset,
+	    uap->iovcnt);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = fhio_rdwrv(td, uap, UIO_WRITE);
+	SDT_PROBE2(fhio, , fhpwritev, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The `sysent's for the new syscalls
+ */
+static struct sysent fhpread_sysent = {
+	4 + FHIO_OFF_NARG,	/* sy_narg */
+	sys_fhpread		/* sy_call */
+};
+
+static struct sysent fhpwrite_sysent = {
+	4 + FHIO_OFF_NARG,	/* sy_narg */
+	sys_fhpwrite		/* sy_call */
+};
+
+static struct sysent fhpreadv_sysent = {
+	4 + FHIO_OFF_NARG,	/* sy_narg */
+	sys_fhpreadv		/* sy_call */
+};
+
+static struct sysent fhpwritev_sysent = {
+	4 + FHIO_OFF_NARG,	/* sy_narg */
+	sys_fhpwritev		/* sy_call */
+};
+
+/*
+ * The offsets in sysent where the syscalls are allocated.
+ */
+static int fhpread_offset = NO_SYSCALL;
+static int fhpwrite_offset = NO_SYSCALL;
+static int fhpreadv_offset = NO_SYSCALL;
+static int fhpwritev_offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload, arg points to the offset.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("%s syscall loaded at %d\n", module_getname(module),
+		    *(int *)arg);
+		break;
+	case MOD_UNLOAD :
+		printf("%s syscall unloaded from %d\n", module_getname(module),
+		    *(int *)arg);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(fhpread, &fhpread_offset, &fhpread_sysent, load,
+    &fhpread_offset);
+SYSCALL_MODULE(fhpwrite, &fhpwrite_offset, &fhpwrite_sysent, load,
+    &fhpwrite_offset);
+SYSCALL_MODULE(fhpreadv, &fhpreadv_offset, &fhpreadv_sysent, load,
+    &fhpreadv_offset);
+SYSCALL_MODULE(fhpwritev, &fhpwritev_offset, &fhpwritev_sysent, load,
+    &fhpwritev_offset);
+MODULE_DEPEND(fhpread, fhresolve, 1, 1, 1);
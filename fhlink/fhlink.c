@@ -53,6 +53,12 @@
 #include <sys/file.h>
 #include <sys/capsicum.h>
 #include <sys/buf.h>
+#include <sys/counter.h>
+#include <sys/sysctl.h>
+#include <sys/sdt.h>
+
+#include "fhresolve.h"
+#include "syscallstat.h"
 
 struct fhlink_args {
 	fhandle_t	*fhp;
@@ -60,7 +66,56 @@ struct fhlink_args {
 	const char	*to;
 };
 
+struct fhlinkat_args {
+	fhandle_t	*fhp;
+	fhandle_t	*todfhp;
+	const char	*to;
+};
+
 int sys_fhlink(struct thread *td, void *params);
+int sys_fhlinkat(struct thread *td, void *params);
+
+static counter_u64_t fhlink_retries_suspended;
+static counter_u64_t fhlink_retries_doomed;
+static counter_u64_t fhlink_retries_exhausted;
+static int fhlink_max_retries = 8;
+
+static struct syscallstat *fhlink_stats;
+static struct syscallstat *fhlinkat_stats;
+
+#define	FHLINK_PHASE_FHTOVP	0
+#define	FHLINK_PHASE_NAMEI	1
+#define	FHLINK_PHASE_LINK	2
+
+static const char * const fhlink_phases[] = { "fhtovp", "namei", "link" };
+
+/*
+ * fhlink:::fhtovp, namei and link fire after each phase with its error
+ * and duration in nanoseconds, retry with the reason the link starts
+ * over.  The fsid is the one of the source handle.
+ */
+SDT_PROVIDER_DEFINE(fhlink);
+SDT_PROBE_DEFINE3(fhlink, , fhlink, entry, "fhandle_t *", "int", "char *");
+SDT_PROBE_DEFINE2(fhlink, , fhlink, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(fhlink, , fhlinkat, entry, "fhandle_t *", "fhandle_t *",
+    "char *");
+SDT_PROBE_DEFINE2(fhlink, , fhlinkat, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(fhlink, , , fhtovp, "fsid_t *", "int", "int64_t");
+SDT_PROBE_DEFINE3(fhlink, , , namei, "fsid_t *", "int", "int64_t");
+SDT_PROBE_DEFINE3(fhlink, , , link, "fsid_t *", "int", "int64_t");
+SDT_PROBE_DEFINE2(fhlink, , , retry, "fsid_t *", "char *");
+
+static SYSCTL_NODE(_kern, OID_AUTO, fhlink, CTLFLAG_RW, 0,
+    "fhlink and fhlinkat");
+SYSCTL_COUNTER_U64(_kern_fhlink, OID_AUTO, retries_suspended, CTLFLAG_RD,
+    &fhlink_retries_suspended,
+    "Retries after waiting for a suspended filesystem");
+SYSCTL_COUNTER_U64(_kern_fhlink, OID_AUTO, retries_doomed, CTLFLAG_RD,
+    &fhlink_retries_doomed, "Retries after the source vnode was reclaimed");
+SYSCTL_COUNTER_U64(_kern_fhlink, OID_AUTO, retries_exhausted, CTLFLAG_RD,
+    &fhlink_retries_exhausted, "fhlinkat calls failed with EAGAIN");
+SYSCTL_INT(_kern_fhlink, OID_AUTO, max_retries, CTLFLAG_RWTUN,
+    &fhlink_max_retries, 0, "Retries fhlinkat makes before EAGAIN");
 
 extern int hardlink_check_uid;
 extern int hardlink_check_gid;
@@ -93,12 +148,10 @@ can_hardlink(struct vnode *vp, struct ucred *cred)
 	return (0);
 }
 
-/*
- * The function for implementing the syscall.
- */
-int sys_fhlink(struct thread *td, void *params)
+static int
+kern_fhlink(struct thread *td, struct fhlink_args *uap)
 {
-	struct fhlink_args *uap;
+	sbintime_t t;
 	fhandle_t fh;
 	struct mount *mp;
 	struct vnode *vp;
@@ -106,8 +159,6 @@ int sys_fhlink(struct thread *td, void *params)
 	cap_rights_t rights;
 	int error;
 
-	uap = (struct fhlink_args*)params;
-
 	error = priv_check(td, PRIV_VFS_GETFH);
 	if (error != 0)
 		return (error);
@@ -118,11 +169,11 @@ int sys_fhlink(struct thread *td, void *params)
 
 again:
 	bwillwrite();
-	if ((mp = vfs_busyfs(&fh.fh_fsid)) == NULL)
-		return (ESTALE);
-
-	error = VFS_FHTOVP(mp, &fh.fh_fid, LK_SHARED, &vp);
-        vfs_unbusy(mp);
+	t = syscallstat_start();
+	error = fhresolve_fhtovp(&fh, LK_SHARED, &vp);
+	syscallstat_phase(fhlink_stats, FHLINK_PHASE_FHTOVP, t);
+	SDT_PROBE3(fhlink, , , fhtovp, &fh.fh_fsid, error,
+	    syscallstat_elapsed(t));
         if (error != 0)
                 return (error);
 
@@ -142,7 +193,12 @@ again:
 	    LOCKPARENT | SAVENAME | AUDITVNODE2 | NOCACHE, UIO_USERSPACE, uap->to, uap->tofd,
 	    cap_rights_init(&rights, CAP_LINKAT), td);
 #endif
-	if ((error = namei(&nd)) == 0) {
+	t = syscallstat_start();
+	error = namei(&nd);
+	syscallstat_phase(fhlink_stats, FHLINK_PHASE_NAMEI, t);
+	SDT_PROBE3(fhlink, , , namei, &fh.fh_fsid, error,
+	    syscallstat_elapsed(t));
+	if (error == 0) {
 		if (nd.ni_vp != NULL) {
 			NDFREE(&nd, NDF_ONLY_PNBUF);
 			if (nd.ni_dvp == nd.ni_vp)
@@ -184,9 +240,17 @@ again:
 				    V_XSLEEP | PCATCH);
 				if (error != 0)
 					return (error);
+				counter_u64_add(fhlink_retries_suspended, 1);
+				syscallstat_retry(fhlink_stats);
+				SDT_PROBE2(fhlink, , , retry, &fh.fh_fsid,
+				    "suspended");
 				goto again;
 			}
+			t = syscallstat_start();
 			error = VOP_LINK(nd.ni_dvp, vp, &nd.ni_cnd);
+			syscallstat_phase(fhlink_stats, FHLINK_PHASE_LINK, t);
+			SDT_PROBE3(fhlink, , , link, &fh.fh_fsid, error,
+			    syscallstat_elapsed(t));
 			VOP_UNLOCK(vp, 0);
 			vput(nd.ni_dvp);
 			vn_finished_write(mp);
@@ -196,6 +260,9 @@ again:
 			vput(nd.ni_dvp);
 			NDFREE(&nd, NDF_ONLY_PNBUF);
 			vrele(vp);
+			counter_u64_add(fhlink_retries_doomed, 1);
+			syscallstat_retry(fhlink_stats);
+			SDT_PROBE2(fhlink, , , retry, &fh.fh_fsid, "doomed");
 			goto again;
 		}
 	}
@@ -204,20 +271,257 @@ again:
 }
 
 /*
- * The `sysent' for the new syscall
+ * The function for implementing the syscall.
+ */
+int sys_fhlink(struct thread *td, void *params)
+{
+	struct fhlink_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhlink_args*)params;
+
+	SDT_PROBE3(fhlink, , fhlink, entry, uap->fhp, uap->tofd, uap->to);
+	start = syscallstat_start();
+	error = kern_fhlink(td, uap);
+	syscallstat_end(fhlink_stats, start, error);
+	SDT_PROBE2(fhlink, , fhlink, return, error, syscallstat_elapsed(start));
+	return (error);
+}
+
+static int
+fhlinkat_fhtovp(fhandle_t *fh, int flags, struct vnode **vpp)
+{
+	int error;
+
+	error = fhresolve_fhtovp(fh, flags, vpp);
+	if (error != 0)
+		return (error);
+
+	VOP_UNLOCK(*vpp, 0);
+	return (0);
+}
+
+/*
+ * Same as kern_fhlink with the target directory given by handle.
+ *
+ * The source is only resolved again when its vnode was reclaimed, and
+ * the loop gives up with EAGAIN after kern.fhlink.max_retries passes
+ * rather than spinning while the filesystem stays suspended.
+ */
+static int
+kern_fhlinkat(struct thread *td, struct fhlinkat_args *uap)
+{
+	sbintime_t t;
+	char name[NAME_MAX + 1];
+	fhandle_t fh, tofh;
+	struct mount *mp;
+	struct vnode *vp, *dvp;
+	struct nameidata nd;
+	int error, retries;
+
+	error = priv_check(td, PRIV_VFS_GETFH);
+	if (error != 0)
+		return (error);
+
+	error = copyin(uap->fhp, &fh, sizeof(fh));
+	if (error != 0)
+		return (error);
+	error = copyin(uap->todfhp, &tofh, sizeof(tofh));
+	if (error != 0)
+		return (error);
+	error = copyinstr(uap->to, name, sizeof(name), NULL);
+	if (error != 0)
+		return (error);
+	if (name[0] == '\0')
+		return (ENOENT);
+	if (strchr(name, '/') != NULL)
+		return (EINVAL);
+
+	bwillwrite();
+	t = syscallstat_start();
+	error = fhlinkat_fhtovp(&fh, LK_SHARED, &vp);
+	syscallstat_phase(fhlinkat_stats, FHLINK_PHASE_FHTOVP, t);
+	SDT_PROBE3(fhlink, , , fhtovp, &fh.fh_fsid, error,
+	    syscallstat_elapsed(t));
+	if (error != 0)
+		return (error);
+	if (vp->v_type == VDIR) {
+		vrele(vp);
+		return (EPERM);		/* POSIX */
+	}
+
+	for (retries = 0; ; retries++) {
+		if (retries > fhlink_max_retries) {
+			counter_u64_add(fhlink_retries_exhausted, 1);
+			error = EAGAIN;
+			break;
+		}
+		if (retries > 0)
+			bwillwrite();
+		if ((vp->v_iflag & VI_DOOMED) != 0) {
+			vrele(vp);
+			counter_u64_add(fhlink_retries_doomed, 1);
+			syscallstat_retry(fhlinkat_stats);
+			SDT_PROBE2(fhlink, , , retry, &fh.fh_fsid, "doomed");
+			error = fhlinkat_fhtovp(&fh, LK_SHARED, &vp);
+			if (error != 0)
+				return (error);
+			continue;
+		}
+
+		error = fhlinkat_fhtovp(&tofh, LK_SHARED, &dvp);
+		if (error != 0)
+			break;
+		if (dvp->v_type != VDIR) {
+			vrele(dvp);
+			error = ENOTDIR;
+			break;
+		}
+
+		/* namei() consumes the reference on the start directory. */
+		NDINIT_ATVP(&nd, CREATE,
+		    LOCKPARENT | SAVENAME | AUDITVNODE2 | NOCACHE, UIO_SYSSPACE,
+		    name, dvp, td);
+		t = syscallstat_start();
+		error = namei(&nd);
+		syscallstat_phase(fhlinkat_stats, FHLINK_PHASE_NAMEI, t);
+		SDT_PROBE3(fhlink, , , namei, &fh.fh_fsid, error,
+		    syscallstat_elapsed(t));
+		if (error != 0)
+			break;
+		if (nd.ni_vp != NULL) {
+			NDFREE(&nd, NDF_ONLY_PNBUF);
+			if (nd.ni_dvp == nd.ni_vp)
+				vrele(nd.ni_dvp);
+			else
+				vput(nd.ni_dvp);
+			vrele(nd.ni_vp);
+			error = EEXIST;
+			break;
+		}
+		if (nd.ni_dvp->v_mount != vp->v_mount) {
+			NDFREE(&nd, NDF_ONLY_PNBUF);
+			vput(nd.ni_dvp);
+			error = EXDEV;
+			break;
+		}
+		if (vn_lock(vp, LK_EXCLUSIVE) != 0) {
+			/*
+			 * Reclaimed, resolved again on the next pass, which
+			 * counts and reports the retry.
+			 */
+			vput(nd.ni_dvp);
+			NDFREE(&nd, NDF_ONLY_PNBUF);
+			continue;
+		}
+		error = can_hardlink(vp, td->td_ucred);
+#ifdef MAC
+		if (error == 0)
+			error = mac_vnode_check_link(td->td_ucred,
+			    nd.ni_dvp, vp, &nd.ni_cnd);
+#endif
+		if (error != 0) {
+			VOP_UNLOCK(vp, 0);
+			vput(nd.ni_dvp);
+			NDFREE(&nd, NDF_ONLY_PNBUF);
+			break;
+		}
+		error = vn_start_write(vp, &mp, V_NOWAIT);
+		if (error != 0) {
+			VOP_UNLOCK(vp, 0);
+			vput(nd.ni_dvp);
+			NDFREE(&nd, NDF_ONLY_PNBUF);
+			error = vn_start_write(NULL, &mp, V_XSLEEP | PCATCH);
+			if (error != 0)
+				break;
+			counter_u64_add(fhlink_retries_suspended, 1);
+			syscallstat_retry(fhlinkat_stats);
+			SDT_PROBE2(fhlink, , , retry, &fh.fh_fsid, "suspended");
+			continue;
+		}
+		t = syscallstat_start();
+		error = VOP_LINK(nd.ni_dvp, vp, &nd.ni_cnd);
+		syscallstat_phase(fhlinkat_stats, FHLINK_PHASE_LINK, t);
+		SDT_PROBE3(fhlink, , , link, &fh.fh_fsid, error,
+		    syscallstat_elapsed(t));
+		VOP_UNLOCK(vp, 0);
+		vput(nd.ni_dvp);
+		vn_finished_write(mp);
+		NDFREE(&nd, NDF_ONLY_PNBUF);
+		break;
+	}
+	vrele(vp);
+	return (error);
+}
+
+/*
+ * The function for implementing the syscall with a target directory.
+ */
+int sys_fhlinkat(struct thread *td, void *params)
+{
+	struct fhlinkat_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhlinkat_args*)params;
+
+	SDT_PROBE3(fhlink, , fhlinkat, entry, uap->fhp, uap->todfhp, uap->to);
+	start = syscallstat_start();
+	error = kern_fhlinkat(td, uap);
+	syscallstat_end(fhlinkat_stats, start, error);
+	SDT_PROBE2(fhlink, , fhlinkat, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+static void
+fhlink_init(void *arg __unused)
+{
+
+	fhlink_retries_suspended = counter_u64_alloc(M_WAITOK);
+	fhlink_retries_doomed = counter_u64_alloc(M_WAITOK);
+	fhlink_retries_exhausted = counter_u64_alloc(M_WAITOK);
+	fhlink_stats = syscallstat_register("fhlink", fhlink_phases,
+	    nitems(fhlink_phases));
+	fhlinkat_stats = syscallstat_register("fhlinkat", fhlink_phases,
+	    nitems(fhlink_phases));
+}
+SYSINIT(fhlink, SI_SUB_SYSCALLS, SI_ORDER_FIRST, fhlink_init, NULL);
+
+static void
+fhlink_uninit(void *arg __unused)
+{
+
+	counter_u64_free(fhlink_retries_suspended);
+	counter_u64_free(fhlink_retries_doomed);
+	counter_u64_free(fhlink_retries_exhausted);
+	syscallstat_deregister(fhlink_stats);
+	syscallstat_deregister(fhlinkat_stats);
+}
+SYSUNINIT(fhlink, SI_SUB_SYSCALLS, SI_ORDER_FIRST, fhlink_uninit, NULL);
+
+/*
+ * The `sysent's for the new syscalls
  */
 static struct sysent fhlink_sysent = {
 	3,			/* sy_narg */
 	sys_fhlink		/* sy_call */
 };
 
+static struct sysent fhlinkat_sysent = {
+	3,			/* sy_narg */
+	sys_fhlinkat		/* sy_call */
+};
+
 /*
- * The offset in sysent where the syscall is allocated.
+ * The offsets in sysent where the syscalls are allocated.
  */
-static int offset = NO_SYSCALL;
+static int fhlink_offset = NO_SYSCALL;
+static int fhlinkat_offset = NO_SYSCALL;
 
 /*
- * The function called at load/unload.
+ * The function called at load/unload, arg points to the offset.
  */
 static int
 load(struct module *module, int cmd, void *arg)
@@ -226,10 +530,12 @@ load(struct module *module, int cmd, void *arg)
 
 	switch (cmd) {
 	case MOD_LOAD :
-		printf("fhlink syscall loaded at %d\n", offset);
+		printf("%s syscall loaded at %d\n", module_getname(module),
+		    *(int *)arg);
 		break;
 	case MOD_UNLOAD :
-		printf("fhlink syscall unloaded from %d\n", offset);
+		printf("%s syscall unloaded from %d\n", module_getname(module),
+		    *(int *)arg);
 		break;
 	default :
 		error = EOPNOTSUPP;
@@ -238,4 +544,8 @@ load(struct module *module, int cmd, void *arg)
 	return (error);
 }
 
-SYSCALL_MODULE(fhlink, &offset, &fhlink_sysent, load, NULL);
+SYSCALL_MODULE(fhlink, &fhlink_offset, &fhlink_sysent, load, &fhlink_offset);
+SYSCALL_MODULE(fhlinkat, &fhlinkat_offset, &fhlinkat_sysent, load,
+    &fhlinkat_offset);
+MODULE_DEPEND(fhlink, fhresolve, 1, 1, 1);
+MODULE_DEPEND(fhlink, syscallstat, 1, 1, 1);
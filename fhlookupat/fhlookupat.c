@@ -0,0 +1,183 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/namei.h>
+#include <sys/mount.h>
+#include <sys/priv.h>
+#include <sys/vnode.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/sdt.h>
+
+#include "fhresolve.h"
+#include "syscallstat.h"
+
+struct fhlookupat_args {
+	fhandle_t	*dfhp;
+	const char	*name;
+	fhandle_t	*fhp;
+	struct stat	*sbp;
+};
+
+int sys_fhlookupat(struct thread *td, void *params);
+
+/*
+ * The handle resolution is under fhresolve:::fhtovp.
+ */
+SDT_PROVIDER_DEFINE(fhlookupat);
+SDT_PROBE_DEFINE2(fhlookupat, , fhlookupat, entry, "fhandle_t *", "char *");
+SDT_PROBE_DEFINE2(fhlookupat, , fhlookupat, return, "int", "int64_t");
+
+/*
+ * The function for implementing the syscall.
+ *
+ * Look a single component up in the directory given by handle, ".."
+ * included, and return the handle of the child and optionally its
+ * attributes.  Symbolic links are not followed.  The lookup goes
+ * through namei() so hot names are served from the namecache.
+ */
+static int
+kern_fhlookupat(struct thread *td, struct fhlookupat_args *uap)
+{
+	struct nameidata nd;
+	char name[NAME_MAX + 1];
+	fhandle_t fh;
+	struct stat sb;
+	struct vnode *dvp, *vp;
+	int error;
+
+	error = priv_check(td, PRIV_VFS_GETFH);
+	if (error != 0)
+		return (error);
+
+	error = copyin(uap->dfhp, &fh, sizeof(fh));
+	if (error != 0)
+		return (error);
+	error = copyinstr(uap->name, name, sizeof(name), NULL);
+	if (error != 0)
+		return (error);
+	if (name[0] == '\0')
+		return (ENOENT);
+	if (strchr(name, '/') != NULL)
+		return (EINVAL);
+
+	error = fhresolve_fhtovp(&fh, LK_SHARED, &dvp);
+	if (error != 0)
+		return (error);
+
+	if (dvp->v_type != VDIR) {
+		vput(dvp);
+		return (ENOTDIR);
+	}
+	VOP_UNLOCK(dvp, 0);
+
+	/* namei() consumes the reference on the start directory. */
+	NDINIT_ATVP(&nd, LOOKUP, NOFOLLOW | LOCKLEAF | LOCKSHARED | AUDITVNODE1,
+	    UIO_SYSSPACE, name, dvp, td);
+	error = namei(&nd);
+	if (error != 0)
+		return (error);
+	NDFREE(&nd, NDF_ONLY_PNBUF);
+	vp = nd.ni_vp;
+
+	/* code taken from sys_getfhat */
+	bzero(&fh, sizeof(fh));
+	fh.fh_fsid = vp->v_mount->mnt_stat.f_fsid;
+	error = VOP_VPTOFH(vp, &fh.fh_fid);
+	if (error == 0 && uap->sbp != NULL)
+		error = vn_stat(vp, &sb, td->td_ucred, NOCRED, td);
+	vput(vp);
+	if (error == 0)
+		error = copyout(&fh, uap->fhp, sizeof (fh));
+	if (error == 0 && uap->sbp != NULL)
+		error = copyout(&sb, uap->sbp, sizeof (sb));
+	return (error);
+}
+
+int sys_fhlookupat(struct thread *td, void *params)
+{
+	struct fhlookupat_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhlookupat_args*)params;
+
+	SDT_PROBE2(fhlookupat, , fhlookupat, entry, uap->dfhp, uap->name);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_fhlookupat(td, uap);
+	SDT_PROBE2(fhlookupat, , fhlookupat, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The `sysent' for the new syscall
+ */
+static struct sysent fhlookupat_sysent = {
+	4,			/* sy_narg */
+	sys_fhlookupat		/* sy_call */
+};
+
+/*
+ * The offset in sysent where the syscall is allocated.
+ */
+static int offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("fhlookupat syscall loaded at %d\n", offset);
+		break;
+	case MOD_UNLOAD :
+		printf("fhlookupat syscall unloaded from %d\n", offset);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(fhlookupat, &offset, &fhlookupat_sysent, load, NULL);
+MODULE_DEPEND(fhlookupat, fhresolve, 1, 1, 1);
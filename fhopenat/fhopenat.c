@@ -0,0 +1,335 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * Copyright (c) 1999 Assar Westerlund
+ * Copyright (c) 1989, 1993
+ *      The Regents of the University of California.  All rights reserved.
+ * (c) UNIX System Laboratories, Inc.
+ * All or some portions of this file are derived from material licensed
+ * to the University of California by American Telephone and Telegraph
+ * Co. or Unix System Laboratories, Inc. and are reproduced herein with
+ * the permission of UNIX System Laboratories, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/namei.h>
+#include <sys/mount.h>
+#include <sys/priv.h>
+#include <sys/vnode.h>
+#include <sys/file.h>
+#include <sys/filedesc.h>
+#include <sys/fcntl.h>
+#include <sys/buf.h>
+#include <sys/stat.h>
+#include <sys/sdt.h>
+
+#include "fhresolve.h"
+#include "syscallstat.h"
+
+struct fhopenat_args {
+	fhandle_t	*dfhp;
+	const char	*name;
+	char		flags_l_[PADL_(int)]; int flags; char flags_r_[PADR_(int)];
+	char		mode_l_[PADL_(int)]; int mode; char mode_r_[PADR_(int)];
+	fhandle_t	*fhp;
+	struct stat	*sbp;
+	int		*createdp;
+};
+
+int sys_fhopenat(struct thread *td, void *params);
+
+/*
+ * The handle resolution is under fhresolve:::fhtovp.
+ */
+SDT_PROVIDER_DEFINE(fhopenat);
+SDT_PROBE_DEFINE3(fhopenat, , fhopenat, entry, "fhandle_t *", "char *", "int");
+SDT_PROBE_DEFINE2(fhopenat, , fhopenat, return, "int", "int64_t");
+
+/*
+ * Look name up in dvp, creating it if asked to, and return it locked.
+ * code taken from vn_open_cred, with the start directory given as a
+ * vnode: vn_open_cred restarts namei() itself, and namei() consumes the
+ * start directory, so the restart is done here with a fresh resolve.
+ */
+static int
+fhopenat_lookup(struct thread *td, fhandle_t *fh, char *name, int *fmodep,
+    int cmode, struct vnode **vpp)
+{
+	struct nameidata nd;
+	struct vattr vat;
+	struct vattr *vap = &vat;
+	struct mount *mp;
+	struct vnode *dvp;
+	int error, fmode;
+
+	fmode = *fmodep;
+restart:
+	if (fmode & O_CREAT)
+		bwillwrite();
+	error = fhresolve_fhtovp(fh, LK_SHARED, &dvp);
+	if (error != 0)
+		return (error);
+	if (dvp->v_type != VDIR) {
+		vput(dvp);
+		return (ENOTDIR);
+	}
+	VOP_UNLOCK(dvp, 0);
+
+	/* namei() consumes the reference on the start directory. */
+	if ((fmode & O_CREAT) == 0) {
+		NDINIT_ATVP(&nd, LOOKUP, NOFOLLOW | LOCKLEAF | AUDITVNODE1,
+		    UIO_SYSSPACE, name, dvp, td);
+		if ((error = namei(&nd)) != 0)
+			return (error);
+		NDFREE(&nd, NDF_ONLY_PNBUF);
+		*vpp = nd.ni_vp;
+		return (0);
+	}
+
+	NDINIT_ATVP(&nd, CREATE,
+	    ISOPEN | LOCKPARENT | LOCKLEAF | SAVENAME | NOFOLLOW | AUDITVNODE1,
+	    UIO_SYSSPACE, name, dvp, td);
+	if ((error = namei(&nd)) != 0)
+		return (error);
+	if (nd.ni_vp == NULL) {
+		VATTR_NULL(vap);
+		vap->va_type = VREG;
+		vap->va_mode = cmode;
+		if (fmode & O_EXCL)
+			vap->va_vaflags |= VA_EXCLUSIVE;
+		if (vn_start_write(nd.ni_dvp, &mp, V_NOWAIT) != 0) {
+			NDFREE(&nd, NDF_ONLY_PNBUF);
+			vput(nd.ni_dvp);
+			if ((error = vn_start_write(NULL, &mp,
+			    V_XSLEEP | PCATCH)) != 0)
+				return (error);
+			goto restart;
+		}
+#ifdef MAC
+		error = mac_vnode_check_create(td->td_ucred, nd.ni_dvp,
+		    &nd.ni_cnd, vap);
+		if (error == 0)
+#endif
+			error = VOP_CREATE(nd.ni_dvp, &nd.ni_vp, &nd.ni_cnd,
+			    vap);
+		NDFREE(&nd, NDF_ONLY_PNBUF);
+		vput(nd.ni_dvp);
+		vn_finished_write(mp);
+		if (error != 0)
+			return (error);
+		fmode &= ~O_TRUNC;
+	} else {
+		NDFREE(&nd, NDF_ONLY_PNBUF);
+		if (nd.ni_dvp == nd.ni_vp)
+			vrele(nd.ni_dvp);
+		else
+			vput(nd.ni_dvp);
+		if (fmode & O_EXCL) {
+			vput(nd.ni_vp);
+			return (EEXIST);
+		}
+		fmode &= ~O_CREAT;
+	}
+	*fmodep = fmode;
+	*vpp = nd.ni_vp;
+	return (0);
+}
+
+/*
+ * The function for implementing the syscall.
+ *
+ * Open, and create if O_CREAT is given, name in the directory given by
+ * handle.  Returns the new fd, and fills the handle and attributes of
+ * the file from the same vnode, before it is unlocked.  *createdp tells
+ * whether the file was created by this call.  Symbolic links are not
+ * followed.
+ */
+static int
+kern_fhopenat(struct thread *td, struct fhopenat_args *uap)
+{
+	char name[NAME_MAX + 1];
+	fhandle_t fh;
+	struct stat sb;
+	struct file *fp;
+	struct vnode *vp;
+	int cmode, created, error, fmode, indx;
+
+	error = priv_check(td, PRIV_VFS_FHOPEN);
+	if (error != 0)
+		return (error);
+
+	/* code taken from kern_openat */
+	fmode = FFLAGS(uap->flags);
+	if ((fmode & (FREAD | FWRITE)) == 0)
+		return (EINVAL);
+	cmode = ((uap->mode & ~td->td_proc->p_fd->fd_cmask) & ALLPERMS) &
+	    ~S_ISTXT;
+
+	error = copyin(uap->dfhp, &fh, sizeof(fh));
+	if (error != 0)
+		return (error);
+	error = copyinstr(uap->name, name, sizeof(name), NULL);
+	if (error != 0)
+		return (error);
+	if (name[0] == '\0')
+		return (ENOENT);
+	if (strchr(name, '/') != NULL)
+		return (EINVAL);
+
+	indx = -1;
+	error = falloc_noinstall(td, &fp);
+	if (error != 0)
+		return (error);
+	/*
+	 * An extra reference on `fp' has been held for us by
+	 * falloc_noinstall().
+	 */
+
+	error = fhopenat_lookup(td, &fh, name, &fmode, cmode, &vp);
+	if (error != 0)
+		goto bad;
+	created = (fmode & O_CREAT) != 0;
+
+	/* code taken from sys_fhopen */
+#ifdef INVARIANTS
+	td->td_dupfd = -1;
+#endif
+	error = vn_open_vnode(vp, fmode, td->td_ucred, td, fp);
+	if (error != 0) {
+		KASSERT(fp->f_ops == &badfileops,
+		    ("VOP_OPEN in fhopenat() set f_ops"));
+		KASSERT(td->td_dupfd < 0,
+		    ("fhopenat() encountered fdopen()"));
+		vput(vp);
+		goto bad;
+	}
+#ifdef INVARIANTS
+	td->td_dupfd = 0;
+#endif
+	fp->f_vnode = vp;
+	fp->f_seqcount = 1;
+	finit(fp, (fmode & FMASK) | (fp->f_flag & FHASLOCK), DTYPE_VNODE, vp,
+	    &vnops);
+
+	/* code taken from sys_getfhat */
+	bzero(&fh, sizeof(fh));
+	fh.fh_fsid = vp->v_mount->mnt_stat.f_fsid;
+	error = VOP_VPTOFH(vp, &fh.fh_fid);
+	if (error == 0 && uap->sbp != NULL && (fmode & O_TRUNC) == 0)
+		error = vn_stat(vp, &sb, td->td_ucred, NOCRED, td);
+	VOP_UNLOCK(vp, 0);
+	if (error != 0)
+		goto bad;
+
+	if ((fmode & O_TRUNC) != 0) {
+		error = fo_truncate(fp, 0, td->td_ucred, td);
+		if (error != 0)
+			goto bad;
+		/* The attributes changed, fetch them after truncating. */
+		if (uap->sbp != NULL)
+			error = fo_stat(fp, &sb, td->td_ucred, td);
+		if (error != 0)
+			goto bad;
+	}
+
+	error = copyout(&fh, uap->fhp, sizeof (fh));
+	if (error == 0 && uap->sbp != NULL)
+		error = copyout(&sb, uap->sbp, sizeof (sb));
+	if (error == 0 && uap->createdp != NULL)
+		error = copyout(&created, uap->createdp, sizeof (created));
+	if (error == 0)
+		error = finstall(td, fp, &indx, fmode, NULL);
+bad:
+	fdrop(fp, td);
+	td->td_retval[0] = indx;
+	return (error);
+}
+
+int sys_fhopenat(struct thread *td, void *params)
+{
+	struct fhopenat_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhopenat_args*)params;
+
+	SDT_PROBE3(fhopenat, , fhopenat, entry, uap->dfhp, uap->name,
+	    uap->flags);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_fhopenat(td, uap);
+	SDT_PROBE2(fhopenat, , fhopenat, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The `sysent' for the new syscall
+ */
+static struct sysent fhopenat_sysent = {
+	7,			/* sy_narg */
+	sys_fhopenat		/* sy_call */
+};
+
+/*
+ * The offset in sysent where the syscall is allocated.
+ */
+static int offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("fhopenat syscall loaded at %d\n", offset);
+		break;
+	case MOD_UNLOAD :
+		printf("fhopenat syscall unloaded from %d\n", offset);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(fhopenat, &offset, &fhopenat_sysent, load, NULL);
+MODULE_DEPEND(fhopenat, fhresolve, 1, 1, 1);
@@ -0,0 +1,332 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/namei.h>
+#include <sys/mount.h>
+#include <sys/priv.h>
+#include <sys/vnode.h>
+#include <sys/file.h>
+#include <sys/malloc.h>
+#include <sys/uio.h>
+#include <sys/dirent.h>
+#include <sys/stat.h>
+#include <sys/sdt.h>
+
+#include "fhresolve.h"
+#include "fileserver.h"
+#include "syscallstat.h"
+
+/*
+ * Read a directory given by handle and return, for each entry, its name,
+ * a resume cookie, its file handle and its attributes.  The cookies are
+ * the ones of the filesystem, so a listing can be resumed across calls
+ * from any record.  Returns the number of bytes filled, 0 at the end of
+ * the directory.  "." and ".." are not returned.
+ */
+
+#define	FHDIRPLUS_RECLEN(namlen)	\
+	roundup2(sizeof(struct fhdirplus) + (namlen) + 1, sizeof(uint64_t))
+
+#define	FHREADDIRPLUS_READSIZE	8192
+
+struct fhreaddirplus_args {
+	fhandle_t	*fhp;
+	off_t		*cookiep;
+	char		*buf;
+	size_t		bufsize;
+};
+
+int sys_fhreaddirplus(struct thread *td, void *params);
+
+/*
+ * The directory handle resolution is under fhresolve:::fhtovp, the
+ * children are looked up without it.
+ */
+SDT_PROVIDER_DEFINE(fhreaddirplus);
+SDT_PROBE_DEFINE2(fhreaddirplus, , fhreaddirplus, entry, "fhandle_t *",
+    "size_t");
+SDT_PROBE_DEFINE2(fhreaddirplus, , fhreaddirplus, return, "int", "int64_t");
+
+/*
+ * Get the child locked shared, by inode number when the filesystem
+ * supports it, else with a lookup in the locked directory.
+ */
+static int
+fhreaddirplus_child(struct thread *td, struct vnode *dvp, struct dirent *dp,
+    struct vnode **vpp)
+{
+	struct componentname cn;
+	int error;
+
+	error = VFS_VGET(dvp->v_mount, dp->d_fileno, LK_SHARED, vpp);
+	if (error != EOPNOTSUPP)
+		return (error);
+
+	bzero(&cn, sizeof(cn));
+	cn.cn_nameiop = LOOKUP;
+	cn.cn_flags = ISLASTCN | LOCKPARENT | LOCKLEAF;
+	cn.cn_lkflags = LK_SHARED;
+	cn.cn_thread = td;
+	cn.cn_cred = td->td_ucred;
+	cn.cn_nameptr = dp->d_name;
+	cn.cn_namelen = dp->d_namlen;
+	return (VOP_LOOKUP(dvp, vpp, &cn));
+}
+
+static void
+fhreaddirplus_fill(struct thread *td, struct vnode *dvp, struct dirent *dp,
+    struct fhdirplus *fdp)
+{
+	struct vnode *vp;
+	int error;
+
+	error = fhreaddirplus_child(td, dvp, dp, &vp);
+	if (error == 0) {
+		/* code taken from sys_getfhat */
+		fdp->fdp_fh.fh_fsid = vp->v_mount->mnt_stat.f_fsid;
+		error = VOP_VPTOFH(vp, &fdp->fdp_fh.fh_fid);
+		if (error == 0)
+			error = vn_stat(vp, &fdp->fdp_stat, td->td_ucred,
+			    NOCRED, td);
+		vput(vp);
+	}
+	fdp->fdp_error = error;
+}
+
+static int
+kern_fhreaddirplus(struct thread *td, struct vnode *dvp, off_t *cookiep,
+    char *outbuf, size_t outsize, size_t *outlenp)
+{
+	struct fhdirplus *fdp;
+	struct dirent *dp;
+	struct uio auio;
+	struct iovec aiov;
+	u_long *cookies;
+	char *rdbuf, *cpos, *cend;
+	size_t outlen, reclen;
+	off_t off;
+	int eof, error, full, i, ncookies;
+
+	rdbuf = malloc(FHREADDIRPLUS_READSIZE, M_TEMP, M_WAITOK);
+	off = *cookiep;
+	outlen = 0;
+	full = 0;
+	eof = 0;
+	error = 0;
+	while (!eof && !full) {
+		aiov.iov_base = rdbuf;
+		aiov.iov_len = FHREADDIRPLUS_READSIZE;
+		auio.uio_iov = &aiov;
+		auio.uio_iovcnt = 1;
+		auio.uio_offset = off;
+		auio.uio_rw = UIO_READ;
+		auio.uio_segflg = UIO_SYSSPACE;
+		auio.uio_td = td;
+		auio.uio_resid = FHREADDIRPLUS_READSIZE;
+		ncookies = 0;
+		cookies = NULL;
+		error = VOP_READDIR(dvp, &auio, td->td_ucred, &eof, &ncookies,
+		    &cookies);
+		if (error != 0)
+			break;
+		if (auio.uio_resid == FHREADDIRPLUS_READSIZE) {
+			eof = 1;
+			free(cookies, M_TEMP);
+			break;
+		}
+		if (cookies == NULL) {
+			/* No stable cookies, the listing could not resume. */
+			error = EOPNOTSUPP;
+			break;
+		}
+
+		cpos = rdbuf;
+		cend = rdbuf + FHREADDIRPLUS_READSIZE - auio.uio_resid;
+		for (i = 0; cpos < cend && i < ncookies; i++) {
+			dp = (struct dirent *)cpos;
+			cpos += dp->d_reclen;
+			if (dp->d_reclen == 0)
+				break;
+			if (dp->d_fileno == 0 ||
+			    (dp->d_namlen == 1 && dp->d_name[0] == '.') ||
+			    (dp->d_namlen == 2 && dp->d_name[0] == '.' &&
+			    dp->d_name[1] == '.')) {
+				off = cookies[i];
+				continue;
+			}
+			reclen = FHDIRPLUS_RECLEN(dp->d_namlen);
+			if (outlen + reclen > outsize) {
+				full = 1;
+				break;
+			}
+			fdp = (struct fhdirplus *)(outbuf + outlen);
+			bzero(fdp, reclen);
+			fdp->fdp_reclen = reclen;
+			fdp->fdp_namlen = dp->d_namlen;
+			fdp->fdp_cookie = cookies[i];
+			bcopy(dp->d_name, fdp->fdp_name, dp->d_namlen);
+			fhreaddirplus_fill(td, dvp, dp, fdp);
+			outlen += reclen;
+			off = cookies[i];
+		}
+		free(cookies, M_TEMP);
+	}
+	free(rdbuf, M_TEMP);
+
+	if (error == 0 && full && outlen == 0)
+		error = EINVAL;		/* buffer too small for one record */
+	if (error == 0) {
+		*cookiep = off;
+		*outlenp = outlen;
+	}
+	return (error);
+}
+
+/*
+ * The function for implementing the syscall.
+ */
+static int
+user_fhreaddirplus(struct thread *td, struct fhreaddirplus_args *uap)
+{
+	fhandle_t fh;
+	struct vnode *vp;
+	char *outbuf;
+	size_t bufsize, outlen;
+	off_t cookie;
+	int error;
+
+	error = priv_check(td, PRIV_VFS_GETFH);
+	if (error != 0)
+		return (error);
+
+	bufsize = MIN(uap->bufsize, FHREADDIRPLUS_MAXBUF);
+
+	error = copyin(uap->fhp, &fh, sizeof(fh));
+	if (error != 0)
+		return (error);
+	error = copyin(uap->cookiep, &cookie, sizeof(cookie));
+	if (error != 0)
+		return (error);
+
+	error = fhresolve_fhtovp(&fh, LK_SHARED, &vp);
+	if (error != 0)
+		return (error);
+
+	if (vp->v_type != VDIR) {
+		vput(vp);
+		return (ENOTDIR);
+	}
+
+	/* code taken from kern_getdirentries */
+#ifdef MAC
+	error = mac_vnode_check_readdir(td->td_ucred, vp);
+	if (error == 0)
+#endif
+		error = VOP_ACCESS(vp, VREAD | VEXEC, td->td_ucred, td);
+	if (error != 0) {
+		vput(vp);
+		return (error);
+	}
+
+	outbuf = malloc(bufsize, M_TEMP, M_WAITOK);
+	error = kern_fhreaddirplus(td, vp, &cookie, outbuf, bufsize, &outlen);
+	vput(vp);
+
+	if (error == 0)
+		error = copyout(outbuf, uap->buf, outlen);
+	if (error == 0)
+		error = copyout(&cookie, uap->cookiep, sizeof(cookie));
+	if (error == 0)
+		td->td_retval[0] = outlen;
+	free(outbuf, M_TEMP);
+	return (error);
+}
+
+int sys_fhreaddirplus(struct thread *td, void *params)
+{
+	struct fhreaddirplus_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhreaddirplus_args*)params;
+
+	SDT_PROBE2(fhreaddirplus, , fhreaddirplus, entry, uap->fhp,
+	    uap->bufsize);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = user_fhreaddirplus(td, uap);
+	SDT_PROBE2(fhreaddirplus, , fhreaddirplus, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The `sysent' for the new syscall
+ */
+static struct sysent fhreaddirplus_sysent = {
+	4,			/* sy_narg */
+	sys_fhreaddirplus	/* sy_call */
+};
+
+/*
+ * The offset in sysent where the syscall is allocated.
+ */
+static int offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("fhreaddirplus syscall loaded at %d\n", offset);
+		break;
+	case MOD_UNLOAD :
+		printf("fhreaddirplus syscall unloaded from %d\n", offset);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(fhreaddirplus, &offset, &fhreaddirplus_sysent, load, NULL);
+MODULE_DEPEND(fhreaddirplus, fhresolve, 1, 1, 1);
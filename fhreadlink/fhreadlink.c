@@ -51,6 +51,10 @@
 #include <sys/priv.h>
 #include <sys/vnode.h>
 #include <sys/file.h>
+#include <sys/sdt.h>
+
+#include "fhresolve.h"
+#include "syscallstat.h"
 
 struct fhreadlink_args {
 	fhandle_t	*fhp;
@@ -60,21 +64,30 @@ struct fhreadlink_args {
 
 int sys_fhreadlink(struct thread *td, void *params);
 
-/*
- * The function for implementing the syscall.
- */
-int sys_fhreadlink(struct thread *td, void *params)
+static struct syscallstat *fhreadlink_stats;
+
+#define	FHREADLINK_PHASE_FHTOVP		0
+#define	FHREADLINK_PHASE_READLINK	1
+
+static const char * const fhreadlink_phases[] = { "fhtovp", "readlink" };
+
+SDT_PROVIDER_DEFINE(fhreadlink);
+SDT_PROBE_DEFINE3(fhreadlink, , fhreadlink, entry, "fhandle_t *", "char *",
+    "size_t");
+SDT_PROBE_DEFINE2(fhreadlink, , fhreadlink, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(fhreadlink, , , fhtovp, "fsid_t *", "int", "int64_t");
+SDT_PROBE_DEFINE3(fhreadlink, , , readlink, "fsid_t *", "int", "int64_t");
+
+static int
+kern_fhreadlink(struct thread *td, struct fhreadlink_args *uap)
 {
-	struct fhreadlink_args *uap;
 	fhandle_t fh;
-	struct mount *mp;
 	struct vnode *vp;
 	struct uio auio;
 	struct iovec aiov;
+	sbintime_t t;
 	int error;
 
-	uap = (struct fhreadlink_args*)params;
-
 	error = priv_check(td, PRIV_VFS_GETFH);
 	if (error != 0)
 		return (error);
@@ -86,11 +99,15 @@ int sys_fhreadlink(struct thread *td, void *params)
 	if (error != 0)
 		return (error);
 
-	if ((mp = vfs_busyfs(&fh.fh_fsid)) == NULL)
-		return (ESTALE);
-
-	error = VFS_FHTOVP(mp, &fh.fh_fid, LK_EXCLUSIVE, &vp);
-        vfs_unbusy(mp);
+	/*
+	 * VOP_READLINK only needs a shared lock, fhresolve_fhtovp()
+	 * falls back to an exclusive one where namei() would.
+	 */
+	t = syscallstat_start();
+	error = fhresolve_fhtovp(&fh, LK_SHARED, &vp);
+	syscallstat_phase(fhreadlink_stats, FHREADLINK_PHASE_FHTOVP, t);
+	SDT_PROBE3(fhreadlink, , , fhtovp, &fh.fh_fsid, error,
+	    syscallstat_elapsed(t));
         if (error != 0)
                 return (error);
 
@@ -111,13 +128,57 @@ int sys_fhreadlink(struct thread *td, void *params)
 		auio.uio_segflg = UIO_USERSPACE;
 		auio.uio_td = td;
 		auio.uio_resid = uap->bufsize;
+		t = syscallstat_start();
 		error = VOP_READLINK(vp, &auio, td->td_ucred);
+		syscallstat_phase(fhreadlink_stats,
+		    FHREADLINK_PHASE_READLINK, t);
+		SDT_PROBE3(fhreadlink, , , readlink, &fh.fh_fsid, error,
+		    syscallstat_elapsed(t));
 		td->td_retval[0] = uap->bufsize - auio.uio_resid;
         }
 	vput(vp);
 	return (error);
 }
 
+/*
+ * The function for implementing the syscall.
+ */
+int sys_fhreadlink(struct thread *td, void *params)
+{
+	struct fhreadlink_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhreadlink_args*)params;
+
+	SDT_PROBE3(fhreadlink, , fhreadlink, entry, uap->fhp, uap->buf,
+	    uap->bufsize);
+	start = syscallstat_start();
+	error = kern_fhreadlink(td, uap);
+	syscallstat_end(fhreadlink_stats, start, error);
+	SDT_PROBE2(fhreadlink, , fhreadlink, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+static void
+fhreadlink_init(void *arg __unused)
+{
+
+	fhreadlink_stats = syscallstat_register("fhreadlink", fhreadlink_phases,
+	    nitems(fhreadlink_phases));
+}
+SYSINIT(fhreadlink, SI_SUB_SYSCALLS, SI_ORDER_FIRST, fhreadlink_init, NULL);
+
+static void
+fhreadlink_uninit(void *arg __unused)
+{
+
+	syscallstat_deregister(fhreadlink_stats);
+}
+SYSUNINIT(fhreadlink, SI_SUB_SYSCALLS, SI_ORDER_FIRST, fhreadlink_uninit,
+    NULL);
+
 /*
  * The `sysent' for the new syscall
  */
@@ -154,3 +215,5 @@ load(struct module *module, int cmd, void *arg)
 }
 
 SYSCALL_MODULE(fhreadlink, &offset, &fhreadlink_sysent, load, NULL);
+MODULE_DEPEND(fhreadlink, fhresolve, 1, 1, 1);
+MODULE_DEPEND(fhreadlink, syscallstat, 1, 1, 1);
@@ -0,0 +1,533 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * Copyright (c) 1999 Assar Westerlund
+ * Copyright (c) 1989, 1993
+ *      The Regents of the University of California.  All rights reserved.
+ * (c) UNIX System Laboratories, Inc.
+ * All or some portions of this file are derived from material licensed
+ * to the University of California by American Telephone and Telegraph
+ * Co. or Unix System Laboratories, Inc. and are reproduced herein with
+ * the permission of UNIX System Laboratories, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/namei.h>
+#include <sys/mount.h>
+#include <sys/priv.h>
+#include <sys/vnode.h>
+#include <sys/file.h>
+#include <sys/fcntl.h>
+#include <sys/buf.h>
+#include <sys/sdt.h>
+
+#include "fhresolve.h"
+#include "syscallstat.h"
+
+/*
+ * Rename and remove names in directories given by handle rather than
+ * by fd.  Names are single components.
+ */
+
+struct fhrenameat_args {
+	fhandle_t	*fromdfhp;
+	const char	*from;
+	fhandle_t	*todfhp;
+	const char	*to;
+};
+
+struct fhunlinkat_args {
+	fhandle_t	*dfhp;
+	const char	*name;
+	int		flag;
+};
+
+int sys_fhrenameat(struct thread *td, void *params);
+int sys_fhunlinkat(struct thread *td, void *params);
+
+/*
+ * The directory handle resolutions are under fhresolve:::fhtovp.
+ */
+SDT_PROVIDER_DEFINE(fhremove);
+SDT_PROBE_DEFINE4(fhremove, , fhrenameat, entry, "fhandle_t *", "char *",
+    "fhandle_t *", "char *");
+SDT_PROBE_DEFINE2(fhremove, , fhrenameat, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(fhremove, , fhunlinkat, entry, "fhandle_t *", "char *",
+    "int");
+SDT_PROBE_DEFINE2(fhremove, , fhunlinkat, return, "int", "int64_t");
+
+static int
+fhremove_copyin(const fhandle_t *ufhp, fhandle_t *fh, const char *uname,
+    char *name)
+{
+	int error;
+
+	error = copyin(ufhp, fh, sizeof(*fh));
+	if (error != 0)
+		return (error);
+	error = copyinstr(uname, name, NAME_MAX + 1, NULL);
+	if (error != 0)
+		return (error);
+	if (name[0] == '\0')
+		return (ENOENT);
+	if (strchr(name, '/') != NULL)
+		return (EINVAL);
+	return (0);
+}
+
+/*
+ * Resolve a directory handle to an unlocked, referenced vnode.
+ */
+static int
+fhremove_dvp(fhandle_t *fh, struct vnode **dvpp)
+{
+	struct vnode *dvp;
+	int error;
+
+	error = fhresolve_fhtovp(fh, LK_SHARED, &dvp);
+	if (error != 0)
+		return (error);
+
+	if (dvp->v_type != VDIR) {
+		vput(dvp);
+		return (ENOTDIR);
+	}
+	VOP_UNLOCK(dvp, 0);
+	*dvpp = dvp;
+	return (0);
+}
+
+/*
+ * code taken from kern_renameat
+ *
+ * Both directories are resolved again on each restart, as sys_fhlink
+ * does.  namei() consumes the reference on the start directories.
+ */
+static int
+kern_fhrenameat(struct thread *td, fhandle_t *fromfh, char *from,
+    fhandle_t *tofh, char *to)
+{
+	struct mount *mp = NULL;
+	struct vnode *tvp, *fvp, *tdvp, *dvp;
+	struct nameidata fromnd, tond;
+	int error;
+
+again:
+	bwillwrite();
+	error = fhremove_dvp(fromfh, &dvp);
+	if (error != 0)
+		return (error);
+#ifdef MAC
+	NDINIT_ATVP(&fromnd, DELETE, LOCKPARENT | LOCKLEAF | SAVESTART |
+	    AUDITVNODE1, UIO_SYSSPACE, from, dvp, td);
+#else
+	NDINIT_ATVP(&fromnd, DELETE, WANTPARENT | SAVESTART | AUDITVNODE1,
+	    UIO_SYSSPACE, from, dvp, td);
+#endif
+	if ((error = namei(&fromnd)) != 0)
+		return (error);
+#ifdef MAC
+	error = mac_vnode_check_rename_from(td->td_ucred, fromnd.ni_dvp,
+	    fromnd.ni_vp, &fromnd.ni_cnd);
+	VOP_UNLOCK(fromnd.ni_dvp, 0);
+	if (fromnd.ni_dvp != fromnd.ni_vp)
+		VOP_UNLOCK(fromnd.ni_vp, 0);
+#endif
+	fvp = fromnd.ni_vp;
+	if (error == 0)
+		error = fhremove_dvp(tofh, &dvp);
+	if (error != 0) {
+		NDFREE(&fromnd, NDF_ONLY_PNBUF);
+		vrele(fromnd.ni_dvp);
+		vrele(fvp);
+		goto out1;
+	}
+	NDINIT_ATVP(&tond, RENAME, LOCKPARENT | LOCKLEAF | NOCACHE | SAVESTART |
+	    AUDITVNODE2, UIO_SYSSPACE, to, dvp, td);
+	if (fromnd.ni_vp->v_type == VDIR)
+		tond.ni_cnd.cn_flags |= WILLBEDIR;
+	if ((error = namei(&tond)) != 0) {
+		/* Translate error code for rename("dir1", "dir2/."). */
+		if (error == EISDIR && fvp->v_type == VDIR)
+			error = EINVAL;
+		NDFREE(&fromnd, NDF_ONLY_PNBUF);
+		vrele(fromnd.ni_dvp);
+		vrele(fvp);
+		goto out1;
+	}
+	tdvp = tond.ni_dvp;
+	tvp = tond.ni_vp;
+	error = vn_start_write(fvp, &mp, V_NOWAIT);
+	if (error != 0) {
+		NDFREE(&fromnd, NDF_ONLY_PNBUF);
+		NDFREE(&tond, NDF_ONLY_PNBUF);
+		if (tvp != NULL)
+			vput(tvp);
+		if (tdvp == tvp)
+			vrele(tdvp);
+		else
+			vput(tdvp);
+		vrele(fromnd.ni_dvp);
+		vrele(fvp);
+		vrele(tond.ni_startdir);
+		if (fromnd.ni_startdir != NULL)
+			vrele(fromnd.ni_startdir);
+		error = vn_start_write(NULL, &mp, V_XSLEEP | PCATCH);
+		if (error != 0)
+			return (error);
+		goto again;
+	}
+	if (tvp != NULL) {
+		if (fvp->v_type == VDIR && tvp->v_type != VDIR) {
+			error = ENOTDIR;
+			goto out;
+		} else if (fvp->v_type != VDIR && tvp->v_type == VDIR) {
+			error = EISDIR;
+			goto out;
+		}
+	}
+	if (fvp->v_mount != tdvp->v_mount) {
+		error = EXDEV;
+		goto out;
+	}
+	if (fvp == tdvp) {
+		error = EINVAL;
+		goto out;
+	}
+	/*
+	 * If the source is the same as the destination (that is, if they
+	 * are links to the same vnode), then there is nothing to do.
+	 */
+	if (fvp == tvp)
+		error = -1;
+#ifdef MAC
+	else
+		error = mac_vnode_check_rename_to(td->td_ucred, tdvp,
+		    tond.ni_vp, fromnd.ni_dvp == tdvp, &tond.ni_cnd);
+#endif
+out:
+	if (error == 0) {
+		error = VOP_RENAME(fromnd.ni_dvp, fromnd.ni_vp, &fromnd.ni_cnd,
+		    tond.ni_dvp, tond.ni_vp, &tond.ni_cnd);
+		NDFREE(&fromnd, NDF_ONLY_PNBUF);
+		NDFREE(&tond, NDF_ONLY_PNBUF);
+	} else {
+		NDFREE(&fromnd, NDF_ONLY_PNBUF);
+		NDFREE(&tond, NDF_ONLY_PNBUF);
+		if (tvp != NULL)
+			vput(tvp);
+		if (tdvp == tvp)
+			vrele(tdvp);
+		else
+			vput(tdvp);
+		vrele(fromnd.ni_dvp);
+		vrele(fvp);
+	}
+	vrele(tond.ni_startdir);
+	vn_finished_write(mp);
+out1:
+	if (fromnd.ni_startdir)
+		vrele(fromnd.ni_startdir);
+	if (error == -1)
+		return (0);
+	return (error);
+}
+
+/* code taken from kern_unlinkat */
+static int
+kern_fhunlink(struct thread *td, fhandle_t *fh, char *name)
+{
+	struct mount *mp;
+	struct vnode *vp, *dvp;
+	struct nameidata nd;
+	int error;
+
+restart:
+	bwillwrite();
+	error = fhremove_dvp(fh, &dvp);
+	if (error != 0)
+		return (error);
+	NDINIT_ATVP(&nd, DELETE, LOCKPARENT | LOCKLEAF | AUDITVNODE1,
+	    UIO_SYSSPACE, name, dvp, td);
+	if ((error = namei(&nd)) != 0)
+		return (error == EINVAL ? EPERM : error);
+	vp = nd.ni_vp;
+	if (vp->v_type == VDIR) {
+		error = EPERM;		/* POSIX */
+	} else {
+		/*
+		 * The root of a mounted filesystem cannot be deleted.
+		 *
+		 * XXX: can this only be a VDIR case?
+		 */
+		if (vp->v_vflag & VV_ROOT)
+			error = EBUSY;
+	}
+	if (error == 0) {
+		if (vn_start_write(nd.ni_dvp, &mp, V_NOWAIT) != 0) {
+			NDFREE(&nd, NDF_ONLY_PNBUF);
+			vput(nd.ni_dvp);
+			if (vp == nd.ni_dvp)
+				vrele(vp);
+			else
+				vput(vp);
+			if ((error = vn_start_write(NULL, &mp,
+			    V_XSLEEP | PCATCH)) != 0)
+				return (error);
+			goto restart;
+		}
+#ifdef MAC
+		error = mac_vnode_check_unlink(td->td_ucred, nd.ni_dvp, vp,
+		    &nd.ni_cnd);
+		if (error != 0)
+			goto out;
+#endif
+		vfs_notify_upper(vp, VFS_NOTIFY_UPPER_UNLINK);
+		error = VOP_REMOVE(nd.ni_dvp, vp, &nd.ni_cnd);
+#ifdef MAC
+out:
+#endif
+		vn_finished_write(mp);
+	}
+	NDFREE(&nd, NDF_ONLY_PNBUF);
+	vput(nd.ni_dvp);
+	if (vp == nd.ni_dvp)
+		vrele(vp);
+	else
+		vput(vp);
+	return (error);
+}
+
+/* code taken from kern_rmdirat */
+static int
+kern_fhrmdir(struct thread *td, fhandle_t *fh, char *name)
+{
+	struct mount *mp;
+	struct vnode *vp, *dvp;
+	struct nameidata nd;
+	int error;
+
+restart:
+	bwillwrite();
+	error = fhremove_dvp(fh, &dvp);
+	if (error != 0)
+		return (error);
+	NDINIT_ATVP(&nd, DELETE, LOCKPARENT | LOCKLEAF | AUDITVNODE1,
+	    UIO_SYSSPACE, name, dvp, td);
+	if ((error = namei(&nd)) != 0)
+		return (error);
+	vp = nd.ni_vp;
+	if (vp->v_type != VDIR) {
+		error = ENOTDIR;
+		goto out;
+	}
+	/*
+	 * No rmdir "." please.
+	 */
+	if (nd.ni_dvp == vp) {
+		error = EINVAL;
+		goto out;
+	}
+	/*
+	 * The root of a mounted filesystem cannot be deleted.
+	 */
+	if (vp->v_vflag & VV_ROOT) {
+		error = EBUSY;
+		goto out;
+	}
+#ifdef MAC
+	error = mac_vnode_check_unlink(td->td_ucred, nd.ni_dvp, vp,
+	    &nd.ni_cnd);
+	if (error != 0)
+		goto out;
+#endif
+	if (vn_start_write(nd.ni_dvp, &mp, V_NOWAIT) != 0) {
+		NDFREE(&nd, NDF_ONLY_PNBUF);
+		vput(vp);
+		if (nd.ni_dvp == vp)
+			vrele(nd.ni_dvp);
+		else
+			vput(nd.ni_dvp);
+		if ((error = vn_start_write(NULL, &mp,
+		    V_XSLEEP | PCATCH)) != 0)
+			return (error);
+		goto restart;
+	}
+	vfs_notify_upper(vp, VFS_NOTIFY_UPPER_UNLINK);
+	error = VOP_RMDIR(nd.ni_dvp, nd.ni_vp, &nd.ni_cnd);
+	vn_finished_write(mp);
+out:
+	NDFREE(&nd, NDF_ONLY_PNBUF);
+	vput(vp);
+	if (nd.ni_dvp == vp)
+		vrele(nd.ni_dvp);
+	else
+		vput(nd.ni_dvp);
+	return (error);
+}
+
+/*
+ * The function for implementing the rename syscall.
+ */
+static int
+user_fhrenameat(struct thread *td, struct fhrenameat_args *uap)
+{
+	char from[NAME_MAX + 1], to[NAME_MAX + 1];
+	fhandle_t fromfh, tofh;
+	int error;
+
+	error = priv_check(td, PRIV_VFS_GETFH);
+	if (error != 0)
+		return (error);
+
+	error = fhremove_copyin(uap->fromdfhp, &fromfh, uap->from, from);
+	if (error == 0)
+		error = fhremove_copyin(uap->todfhp, &tofh, uap->to, to);
+	if (error == 0)
+		error = kern_fhrenameat(td, &fromfh, from, &tofh, to);
+	return (error);
+}
+
+int sys_fhrenameat(struct thread *td, void *params)
+{
+	struct fhrenameat_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhrenameat_args*)params;
+
+	SDT_PROBE4(fhremove, , fhrenameat, entry, uap->fromdfhp, uap->from,
+	    uap->todfhp, uap->to);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = user_fhrenameat(td, uap);
+	SDT_PROBE2(fhremove, , fhrenameat, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The function for implementing the unlink syscall, AT_REMOVEDIR
+ * removes a directory.
+ */
+static int
+user_fhunlinkat(struct thread *td, struct fhunlinkat_args *uap)
+{
+	char name[NAME_MAX + 1];
+	fhandle_t fh;
+	int error;
+
+	error = priv_check(td, PRIV_VFS_GETFH);
+	if (error != 0)
+		return (error);
+
+	if ((uap->flag & ~AT_REMOVEDIR) != 0)
+		return (EINVAL);
+
+	error = fhremove_copyin(uap->dfhp, &fh, uap->name, name);
+	if (error != 0)
+		return (error);
+
+	if (uap->flag & AT_REMOVEDIR)
+		return (kern_fhrmdir(td, &fh, name));
+	return (kern_fhunlink(td, &fh, name));
+}
+
+int sys_fhunlinkat(struct thread *td, void *params)
+{
+	struct fhunlinkat_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhunlinkat_args*)params;
+
+	SDT_PROBE3(fhremove, , fhunlinkat, entry, uap->dfhp, uap->name,
+	    uap->flag);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = user_fhunlinkat(td, uap);
+	SDT_PROBE2(fhremove, , fhunlinkat, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The `sysent's for the new syscalls
+ */
+static struct sysent fhrenameat_sysent = {
+	4,			/* sy_narg */
+	sys_fhrenameat		/* sy_call */
+};
+
+static struct sysent fhunlinkat_sysent = {
+	3,			/* sy_narg */
+	sys_fhunlinkat		/* sy_call */
+};
+
+/*
+ * The offsets in sysent where the syscalls are allocated.
+ */
+static int fhrenameat_offset = NO_SYSCALL;
+static int fhunlinkat_offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload, arg points to the offset.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("%s syscall loaded at %d\n", module_getname(module),
+		    *(int *)arg);
+		break;
+	case MOD_UNLOAD :
+		printf("%s syscall unloaded from %d\n", module_getname(module),
+		    *(int *)arg);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(fhrenameat, &fhrenameat_offset, &fhrenameat_sysent, load,
+    &fhrenameat_offset);
+SYSCALL_MODULE(fhunlinkat, &fhunlinkat_offset, &fhunlinkat_sysent, load,
+    &fhunlinkat_offset);
+MODULE_DEPEND(fhrenameat, fhresolve, 1, 1, 1);
@@ -0,0 +1,590 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
+#include <sys/rmlock.h>
+#include <sys/malloc.h>
+#include <sys/queue.h>
+#include <sys/hash.h>
+#include <sys/counter.h>
+#include <sys/sysctl.h>
+#include <sys/eventhandler.h>
+#include <sys/mount.h>
+#include <sys/vnode.h>
+#include <sys/sdt.h>
+
+#include "fhresolve.h"
+
+struct fhresolve_mount {
+	LIST_ENTRY(fhresolve_mount) frm_link;
+	fsid_t		frm_fsid;
+	struct mount	*frm_mp;
+};
+
+LIST_HEAD(fhresolve_mount_head, fhresolve_mount);
+
+/*
+ * A cached handle.  The vnode is held, not referenced: it can still be
+ * recycled, which dooms it, and a doomed vnode found here is dropped.
+ */
+struct fhresolve_vnode {
+	LIST_ENTRY(fhresolve_vnode) frv_link;
+	TAILQ_ENTRY(fhresolve_vnode) frv_clock;
+	uint32_t	frv_hash;
+	int		frv_referenced;
+	fhandle_t	frv_fh;
+	struct mount	*frv_mp;
+	struct vnode	*frv_vp;
+};
+
+LIST_HEAD(fhresolve_vnode_head, fhresolve_vnode);
+TAILQ_HEAD(fhresolve_vnode_clock, fhresolve_vnode);
+
+static MALLOC_DEFINE(M_FHRESOLVE, "fhresolve", "file handle resolution");
+
+/*
+ * fhresolve:::fhtovp fires for every handle resolved by the fh* modules
+ * with the fsid, the errno, whether the vnode cache had it and the
+ * duration.  Most ESTALE come from here.
+ */
+SDT_PROVIDER_DEFINE(fhresolve);
+SDT_PROBE_DEFINE4(fhresolve, , , fhtovp, "fsid_t *", "int", "int",
+    "int64_t");
+
+static struct fhresolve_mount_head *fhresolve_mount_hashtbl;
+static u_long fhresolve_mount_hashmask;
+static struct rmlock fhresolve_mount_lock;
+static u_int fhresolve_mount_count;
+static eventhandler_tag fhresolve_mounted_tag;
+static eventhandler_tag fhresolve_unmounted_tag;
+
+static counter_u64_t fhresolve_mount_hits;
+static counter_u64_t fhresolve_mount_misses;
+
+static struct fhresolve_vnode_head *fhresolve_vnode_hashtbl;
+static u_long fhresolve_vnode_hashmask;
+static struct fhresolve_vnode_clock fhresolve_vnode_clock;
+static struct rmlock fhresolve_vnode_lock;
+static u_int fhresolve_vnode_count;
+static u_int fhresolve_vnode_max = 8192;
+
+static counter_u64_t fhresolve_vnode_hits;
+static counter_u64_t fhresolve_vnode_misses;
+static counter_u64_t fhresolve_vnode_evictions;
+static counter_u64_t fhresolve_vnode_stale;
+
+#define	FHRESOLVE_MOUNT_HASHSIZE	1024
+#define	FHRESOLVE_VNODE_HASHSIZE	8192
+
+#define	FHRESOLVE_MOUNT_HASH(fsid)					\
+	(&fhresolve_mount_hashtbl[jenkins_hash32((const uint32_t *)(fsid), \
+	    sizeof(fsid_t) / sizeof(uint32_t), 0) & fhresolve_mount_hashmask])
+
+static void fhresolve_vnode_purge(struct mount *mp);
+
+static SYSCTL_NODE(_kern, OID_AUTO, fhresolve, CTLFLAG_RW, 0,
+    "File handle resolution");
+SYSCTL_UINT(_kern_fhresolve, OID_AUTO, mounts, CTLFLAG_RD,
+    &fhresolve_mount_count, 0, "Mounts in the fsid index");
+SYSCTL_COUNTER_U64(_kern_fhresolve, OID_AUTO, mount_hits, CTLFLAG_RD,
+    &fhresolve_mount_hits, "fsids found in the index");
+SYSCTL_COUNTER_U64(_kern_fhresolve, OID_AUTO, mount_misses, CTLFLAG_RD,
+    &fhresolve_mount_misses, "fsids looked up in the mountlist");
+SYSCTL_UINT(_kern_fhresolve, OID_AUTO, vnodes, CTLFLAG_RD,
+    &fhresolve_vnode_count, 0, "Handles in the vnode cache");
+SYSCTL_UINT(_kern_fhresolve, OID_AUTO, vnode_max, CTLFLAG_RWTUN,
+    &fhresolve_vnode_max, 0, "Maximum handles in the vnode cache, 0 disables");
+SYSCTL_COUNTER_U64(_kern_fhresolve, OID_AUTO, vnode_hits, CTLFLAG_RD,
+    &fhresolve_vnode_hits, "Handles resolved from the vnode cache");
+SYSCTL_COUNTER_U64(_kern_fhresolve, OID_AUTO, vnode_misses, CTLFLAG_RD,
+    &fhresolve_vnode_misses, "Handles resolved with VFS_FHTOVP");
+SYSCTL_COUNTER_U64(_kern_fhresolve, OID_AUTO, vnode_evictions, CTLFLAG_RD,
+    &fhresolve_vnode_evictions, "Handles evicted from the vnode cache");
+SYSCTL_COUNTER_U64(_kern_fhresolve, OID_AUTO, vnode_stale, CTLFLAG_RD,
+    &fhresolve_vnode_stale, "Cached vnodes found recycled or unlinked");
+
+static struct fhresolve_mount *
+fhresolve_mount_lookup(struct fhresolve_mount_head *head, fsid_t *fsid)
+{
+	struct fhresolve_mount *frm;
+
+	LIST_FOREACH(frm, head, frm_link)
+		if (fsidcmp(&frm->frm_fsid, fsid) == 0)
+			return (frm);
+	return (NULL);
+}
+
+static void
+fhresolve_mount_insert(struct mount *mp)
+{
+	struct fhresolve_mount_head *head;
+	struct fhresolve_mount *frm, *nfrm;
+
+	nfrm = malloc(sizeof(*nfrm), M_FHRESOLVE, M_WAITOK);
+	nfrm->frm_fsid = mp->mnt_stat.f_fsid;
+	nfrm->frm_mp = mp;
+	head = FHRESOLVE_MOUNT_HASH(&nfrm->frm_fsid);
+
+	rm_wlock(&fhresolve_mount_lock);
+	frm = fhresolve_mount_lookup(head, &nfrm->frm_fsid);
+	if (frm == NULL) {
+		LIST_INSERT_HEAD(head, nfrm, frm_link);
+		fhresolve_mount_count++;
+		nfrm = NULL;
+	} else
+		frm->frm_mp = mp;
+	rm_wunlock(&fhresolve_mount_lock);
+	free(nfrm, M_FHRESOLVE);
+}
+
+static void
+fhresolve_mounted(void *arg __unused, struct mount *mp,
+    struct vnode *vp __unused, struct thread *td __unused)
+{
+
+	fhresolve_mount_insert(mp);
+}
+
+static void
+fhresolve_unmounted(void *arg __unused, struct mount *mp,
+    struct thread *td __unused)
+{
+	struct fhresolve_mount *frm;
+
+	rm_wlock(&fhresolve_mount_lock);
+	frm = fhresolve_mount_lookup(FHRESOLVE_MOUNT_HASH(&mp->mnt_stat.f_fsid),
+	    &mp->mnt_stat.f_fsid);
+	if (frm != NULL && frm->frm_mp == mp) {
+		LIST_REMOVE(frm, frm_link);
+		fhresolve_mount_count--;
+	} else
+		frm = NULL;
+	rm_wunlock(&fhresolve_mount_lock);
+	free(frm, M_FHRESOLVE);
+
+	fhresolve_vnode_purge(mp);
+}
+
+/*
+ * The lock flags to resolve a vnode of `mp' with: LK_SHARED only on
+ * the filesystems that namei() would take a shared lock on too.
+ */
+static int
+fhresolve_lkflags(struct mount *mp, int flags)
+{
+
+	if ((flags & LK_TYPE_MASK) == LK_SHARED &&
+	    (mp->mnt_kern_flag & MNTK_LOOKUP_SHARED) == 0)
+		flags = (flags & ~LK_TYPE_MASK) | LK_EXCLUSIVE;
+	return (flags);
+}
+
+static uint32_t
+fhresolve_fh_hash(fhandle_t *fhp)
+{
+	uint32_t hash;
+
+	hash = jenkins_hash(&fhp->fh_fsid, sizeof(fsid_t), 0);
+	return (jenkins_hash(&fhp->fh_fid,
+	    MIN(fhp->fh_fid.fid_len, sizeof(struct fid)), hash));
+}
+
+static struct fhresolve_vnode *
+fhresolve_vnode_lookup(uint32_t hash, fhandle_t *fhp)
+{
+	struct fhresolve_vnode *frv;
+
+	LIST_FOREACH(frv, &fhresolve_vnode_hashtbl[hash &
+	    fhresolve_vnode_hashmask], frv_link) {
+		if (frv->frv_hash == hash &&
+		    fsidcmp(&frv->frv_fh.fh_fsid, &fhp->fh_fsid) == 0 &&
+		    frv->frv_fh.fh_fid.fid_len == fhp->fh_fid.fid_len &&
+		    bcmp(&frv->frv_fh.fh_fid, &fhp->fh_fid,
+		    MIN(fhp->fh_fid.fid_len, sizeof(struct fid))) == 0)
+			return (frv);
+	}
+	return (NULL);
+}
+
+static void
+fhresolve_vnode_unlink(struct fhresolve_vnode *frv,
+    struct fhresolve_vnode_head *freelist)
+{
+
+	LIST_REMOVE(frv, frv_link);
+	TAILQ_REMOVE(&fhresolve_vnode_clock, frv, frv_clock);
+	fhresolve_vnode_count--;
+	LIST_INSERT_HEAD(freelist, frv, frv_link);
+}
+
+/*
+ * The vnodes are dropped once the lock is released, the last vdrop()
+ * of a doomed vnode frees it.
+ */
+static void
+fhresolve_vnode_free(struct fhresolve_vnode_head *freelist)
+{
+	struct fhresolve_vnode *frv;
+
+	while ((frv = LIST_FIRST(freelist)) != NULL) {
+		LIST_REMOVE(frv, frv_link);
+		vdrop(frv->frv_vp);
+		free(frv, M_FHRESOLVE);
+	}
+}
+
+/*
+ * Cache a handle just resolved to the locked vnode vp.  Past
+ * vnode_max the clock hand evicts the first entry not used since it
+ * last went by, giving the used ones a second chance.
+ */
+static void
+fhresolve_vnode_insert(uint32_t hash, fhandle_t *fhp, struct vnode *vp)
+{
+	struct fhresolve_vnode_head freelist;
+	struct fhresolve_vnode *frv, *nfrv;
+
+	nfrv = malloc(sizeof(*nfrv), M_FHRESOLVE, M_WAITOK);
+	nfrv->frv_hash = hash;
+	nfrv->frv_referenced = 0;
+	nfrv->frv_fh = *fhp;
+	nfrv->frv_mp = vp->v_mount;
+	nfrv->frv_vp = vp;
+	vhold(vp);
+
+	LIST_INIT(&freelist);
+	rm_wlock(&fhresolve_vnode_lock);
+	frv = fhresolve_vnode_lookup(hash, fhp);
+	if (frv != NULL)
+		fhresolve_vnode_unlink(frv, &freelist);
+	LIST_INSERT_HEAD(&fhresolve_vnode_hashtbl[hash &
+	    fhresolve_vnode_hashmask], nfrv, frv_link);
+	TAILQ_INSERT_TAIL(&fhresolve_vnode_clock, nfrv, frv_clock);
+	fhresolve_vnode_count++;
+	while (fhresolve_vnode_count > fhresolve_vnode_max) {
+		frv = TAILQ_FIRST(&fhresolve_vnode_clock);
+		if (frv->frv_referenced) {
+			frv->frv_referenced = 0;
+			TAILQ_REMOVE(&fhresolve_vnode_clock, frv, frv_clock);
+			TAILQ_INSERT_TAIL(&fhresolve_vnode_clock, frv,
+			    frv_clock);
+			continue;
+		}
+		fhresolve_vnode_unlink(frv, &freelist);
+		counter_u64_add(fhresolve_vnode_evictions, 1);
+	}
+	rm_wunlock(&fhresolve_vnode_lock);
+	fhresolve_vnode_free(&freelist);
+}
+
+static void
+fhresolve_vnode_remove(uint32_t hash, fhandle_t *fhp, struct vnode *vp)
+{
+	struct fhresolve_vnode_head freelist;
+	struct fhresolve_vnode *frv;
+
+	LIST_INIT(&freelist);
+	rm_wlock(&fhresolve_vnode_lock);
+	frv = fhresolve_vnode_lookup(hash, fhp);
+	if (frv != NULL && frv->frv_vp == vp)
+		fhresolve_vnode_unlink(frv, &freelist);
+	rm_wunlock(&fhresolve_vnode_lock);
+	fhresolve_vnode_free(&freelist);
+}
+
+/*
+ * Drop the cached vnodes of mp, or all of them if mp is NULL.
+ */
+static void
+fhresolve_vnode_purge(struct mount *mp)
+{
+	struct fhresolve_vnode_head freelist;
+	struct fhresolve_vnode *frv, *nfrv;
+
+	LIST_INIT(&freelist);
+	rm_wlock(&fhresolve_vnode_lock);
+	TAILQ_FOREACH_SAFE(frv, &fhresolve_vnode_clock, frv_clock, nfrv)
+		if (mp == NULL || frv->frv_mp == mp)
+			fhresolve_vnode_unlink(frv, &freelist);
+	rm_wunlock(&fhresolve_vnode_lock);
+	fhresolve_vnode_free(&freelist);
+}
+
+/*
+ * Lock and reference a cached vnode.  VFS_FHTOVP would fail for an
+ * unlinked file still in use, so one is not handed out either.
+ */
+static int
+fhresolve_vget(struct vnode *vp, int flags)
+{
+	struct thread *td;
+	struct vattr va;
+	int error;
+
+	td = curthread;
+	error = vget(vp, flags, td);
+	if (error != 0)
+		return (error);
+	if ((vp->v_iflag & VI_DOOMED) != 0)
+		error = ENOENT;
+	else {
+		error = VOP_GETATTR(vp, &va, td->td_ucred);
+		if (error == 0 && va.va_nlink == 0)
+			error = ENOENT;
+	}
+	if (error != 0)
+		vput(vp);
+	return (error);
+}
+
+/*
+ * code taken from vfs_busyfs
+ *
+ * Only a reference is taken under the read lock, vfs_busy() may sleep
+ * waiting for an unmount, which has to take the write lock to remove
+ * the mount from the index.  An fsid missing from the index falls back
+ * to vfs_busyfs(), so a stale handle costs what it did before.
+ */
+struct mount *
+fhresolve_busyfs(fsid_t *fsid)
+{
+	struct rm_priotracker tracker;
+	struct fhresolve_mount *frm;
+	struct mount *mp;
+	int error;
+
+	mp = NULL;
+	rm_rlock(&fhresolve_mount_lock, &tracker);
+	frm = fhresolve_mount_lookup(FHRESOLVE_MOUNT_HASH(fsid), fsid);
+	if (frm != NULL) {
+		mp = frm->frm_mp;
+		vfs_ref(mp);
+	}
+	rm_runlock(&fhresolve_mount_lock, &tracker);
+
+	if (mp == NULL) {
+		counter_u64_add(fhresolve_mount_misses, 1);
+		return (vfs_busyfs(fsid));
+	}
+	counter_u64_add(fhresolve_mount_hits, 1);
+
+	error = vfs_busy(mp, 0);
+	vfs_rel(mp);
+	if (error != 0)
+		return (NULL);
+	return (mp);
+}
+
+/*
+ * VFS_FHTOVP() on the mount of the handle, through the vnode cache.
+ * LK_SHARED is turned into LK_EXCLUSIVE on the filesystems that do not
+ * support shared lookups.
+ */
+int
+fhresolve_fhtovp(fhandle_t *fhp, int flags, struct vnode **vpp)
+{
+	struct rm_priotracker tracker;
+	struct fhresolve_vnode *frv;
+	struct mount *mp;
+	struct vnode *vp;
+	sbintime_t start;
+	uint32_t hash;
+	int error;
+
+	start = SDT_PROBES_ENABLED() ? sbinuptime() : 0;
+	hash = fhresolve_fh_hash(fhp);
+	vp = NULL;
+	rm_rlock(&fhresolve_vnode_lock, &tracker);
+	frv = fhresolve_vnode_lookup(hash, fhp);
+	if (frv != NULL) {
+		frv->frv_referenced = 1;
+		vp = frv->frv_vp;
+		vhold(vp);
+		/* The mount outlives its cache entries. */
+		flags = fhresolve_lkflags(frv->frv_mp, flags);
+	}
+	rm_runlock(&fhresolve_vnode_lock, &tracker);
+
+	if (vp != NULL) {
+		error = fhresolve_vget(vp, flags);
+		vdrop(vp);
+		if (error == 0) {
+			counter_u64_add(fhresolve_vnode_hits, 1);
+			SDT_PROBE4(fhresolve, , , fhtovp, &fhp->fh_fsid, 0, 1,
+			    sbttons(sbinuptime() - start));
+			*vpp = vp;
+			return (0);
+		}
+		counter_u64_add(fhresolve_vnode_stale, 1);
+		fhresolve_vnode_remove(hash, fhp, vp);
+	}
+	counter_u64_add(fhresolve_vnode_misses, 1);
+
+	if ((mp = fhresolve_busyfs(&fhp->fh_fsid)) == NULL)
+		error = ESTALE;
+	else {
+		error = VFS_FHTOVP(mp, &fhp->fh_fid,
+		    fhresolve_lkflags(mp, flags), &vp);
+		vfs_unbusy(mp);
+	}
+	SDT_PROBE4(fhresolve, , , fhtovp, &fhp->fh_fsid, error, 0,
+	    sbttons(sbinuptime() - start));
+	if (error != 0)
+		return (error);
+
+	if (fhresolve_vnode_max != 0 && (vp->v_iflag & VI_DOOMED) == 0)
+		fhresolve_vnode_insert(hash, fhp, vp);
+	*vpp = vp;
+	return (0);
+}
+
+/*
+ * Index the mounts that predate the module.  A mount being unmounted
+ * cannot be busied and is skipped, the others cannot go away before
+ * they are indexed.
+ */
+static void
+fhresolve_mount_populate(void)
+{
+	struct mount *mp, *nmp;
+
+	mtx_lock(&mountlist_mtx);
+	for (mp = TAILQ_FIRST(&mountlist); mp != NULL; mp = nmp) {
+		if (vfs_busy(mp, MBF_NOWAIT | MBF_MNTLSTLOCK)) {
+			nmp = TAILQ_NEXT(mp, mnt_list);
+			continue;
+		}
+		fhresolve_mount_insert(mp);
+		mtx_lock(&mountlist_mtx);
+		nmp = TAILQ_NEXT(mp, mnt_list);
+		vfs_unbusy(mp);
+	}
+	mtx_unlock(&mountlist_mtx);
+}
+
+/*
+ * Set up and torn down by SYSINIT rather than at MOD_LOAD and
+ * MOD_UNLOAD: linked in the fileserver kld, this module is unloaded
+ * before the syscalls using it, while the SYSUNINITs only run once
+ * every module of the kld is gone.
+ */
+static void
+fhresolve_init(void *arg __unused)
+{
+
+	fhresolve_mount_hits = counter_u64_alloc(M_WAITOK);
+	fhresolve_mount_misses = counter_u64_alloc(M_WAITOK);
+	fhresolve_vnode_hits = counter_u64_alloc(M_WAITOK);
+	fhresolve_vnode_misses = counter_u64_alloc(M_WAITOK);
+	fhresolve_vnode_evictions = counter_u64_alloc(M_WAITOK);
+	fhresolve_vnode_stale = counter_u64_alloc(M_WAITOK);
+	rm_init(&fhresolve_mount_lock, "fhresolve mounts");
+	fhresolve_mount_hashtbl = hashinit(FHRESOLVE_MOUNT_HASHSIZE,
+	    M_FHRESOLVE, &fhresolve_mount_hashmask);
+	rm_init(&fhresolve_vnode_lock, "fhresolve vnodes");
+	fhresolve_vnode_hashtbl = hashinit(FHRESOLVE_VNODE_HASHSIZE,
+	    M_FHRESOLVE, &fhresolve_vnode_hashmask);
+	TAILQ_INIT(&fhresolve_vnode_clock);
+	fhresolve_mounted_tag = EVENTHANDLER_REGISTER(vfs_mounted,
+	    fhresolve_mounted, NULL, EVENTHANDLER_PRI_ANY);
+	fhresolve_unmounted_tag = EVENTHANDLER_REGISTER(vfs_unmounted,
+	    fhresolve_unmounted, NULL, EVENTHANDLER_PRI_ANY);
+	fhresolve_mount_populate();
+}
+SYSINIT(fhresolve, SI_SUB_SYSCALLS, SI_ORDER_FIRST, fhresolve_init, NULL);
+
+static void
+fhresolve_uninit(void *arg __unused)
+{
+	struct fhresolve_mount *frm;
+	u_long i;
+
+	EVENTHANDLER_DEREGISTER(vfs_mounted, fhresolve_mounted_tag);
+	EVENTHANDLER_DEREGISTER(vfs_unmounted, fhresolve_unmounted_tag);
+	fhresolve_vnode_purge(NULL);
+	hashdestroy(fhresolve_vnode_hashtbl, M_FHRESOLVE,
+	    fhresolve_vnode_hashmask);
+	rm_destroy(&fhresolve_vnode_lock);
+	for (i = 0; i <= fhresolve_mount_hashmask; i++) {
+		while ((frm = LIST_FIRST(&fhresolve_mount_hashtbl[i]))
+		    != NULL) {
+			LIST_REMOVE(frm, frm_link);
+			free(frm, M_FHRESOLVE);
+		}
+	}
+	fhresolve_mount_count = 0;
+	hashdestroy(fhresolve_mount_hashtbl, M_FHRESOLVE,
+	    fhresolve_mount_hashmask);
+	rm_destroy(&fhresolve_mount_lock);
+	counter_u64_free(fhresolve_mount_hits);
+	counter_u64_free(fhresolve_mount_misses);
+	counter_u64_free(fhresolve_vnode_hits);
+	counter_u64_free(fhresolve_vnode_misses);
+	counter_u64_free(fhresolve_vnode_evictions);
+	counter_u64_free(fhresolve_vnode_stale);
+}
+SYSUNINIT(fhresolve, SI_SUB_SYSCALLS, SI_ORDER_FIRST, fhresolve_uninit, NULL);
+
+/*
+ * The function called at load/unload.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("fhresolve loaded\n");
+		break;
+	case MOD_UNLOAD :
+		printf("fhresolve unloaded\n");
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+static moduledata_t fhresolve_mod = {
+	"fhresolve",
+	load,
+	NULL
+};
+
+DECLARE_MODULE(fhresolve, fhresolve_mod, SI_SUB_SYSCALLS, SI_ORDER_FIRST);
+MODULE_VERSION(fhresolve, 1);
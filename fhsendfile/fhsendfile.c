@@ -0,0 +1,243 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * Copyright (c) 1999 Assar Westerlund
+ * Copyright (c) 1989, 1993
+ *      The Regents of the University of California.  All rights reserved.
+ * (c) UNIX System Laboratories, Inc.
+ * All or some portions of this file are derived from material licensed
+ * to the University of California by American Telephone and Telegraph
+ * Co. or Unix System Laboratories, Inc. and are reproduced herein with
+ * the permission of UNIX System Laboratories, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/mount.h>
+#include <sys/priv.h>
+#include <sys/vnode.h>
+#include <sys/file.h>
+#include <sys/fcntl.h>
+#include <sys/malloc.h>
+#include <sys/uio.h>
+#include <sys/sdt.h>
+
+#include "fhresolve.h"
+#include "syscallstat.h"
+
+/*
+ * sendfile(2) from a file given by handle.  The vnode is opened on a
+ * file that is never installed in the descriptor table, so the pages
+ * go from the page cache to the socket without an fd for the file and
+ * without a copy through userspace.  The optional header iovec is sent
+ * before the file data, e.g. an RPC reply header.
+ *
+ * With the offset taking two argument words on 32-bit platforms, the
+ * arguments take nine, one more than the kernel copies in for a
+ * syscall: fhsendfile is only available on 64-bit platforms.
+ */
+
+#ifndef __LP64__
+#error "fhsendfile needs a 64-bit platform"
+#endif
+
+struct fhsendfile_args {
+	fhandle_t	*fhp;
+	off_t		offset;
+	size_t		nbytes;
+	int		s;
+	struct iovec	*hdrp;
+	int		hdrcnt;
+	off_t		*sbytes;
+	int		flags;
+};
+
+int sys_fhsendfile(struct thread *td, void *params);
+
+/*
+ * The handle resolution is under fhresolve:::fhtovp.
+ */
+SDT_PROVIDER_DEFINE(fhsendfile);
+SDT_PROBE_DEFINE4(fhsendfile, , fhsendfile, entry, "fhandle_t *", "off_t",
+    "size_t", "int");
+SDT_PROBE_DEFINE2(fhsendfile, , fhsendfile, return, "int", "int64_t");
+
+/*
+ * The function for implementing the syscall.
+ */
+static int
+kern_fhsendfile(struct thread *td, struct fhsendfile_args *uap)
+{
+	fhandle_t fh;
+	struct vnode *vp;
+	struct file *fp;
+	struct uio *hdr_uio;
+	off_t sbytes;
+	int error, error1;
+
+	error = priv_check(td, PRIV_VFS_FHOPEN);
+	if (error != 0)
+		return (error);
+
+	if (uap->offset < 0)
+		return (EINVAL);
+
+	error = copyin(uap->fhp, &fh, sizeof(fh));
+	if (error != 0)
+		return (error);
+
+	/* code taken from kern_sendfile */
+	hdr_uio = NULL;
+	if (uap->hdrp != NULL) {
+		error = copyinuio(uap->hdrp, uap->hdrcnt, &hdr_uio);
+		if (error != 0)
+			return (error);
+	}
+
+	error = falloc_noinstall(td, &fp);
+	if (error != 0)
+		goto out;
+	/*
+	 * An extra reference on `fp' has been held for us by
+	 * falloc_noinstall().
+	 */
+
+	/* code taken from sys_fhopen */
+	error = fhresolve_fhtovp(&fh, LK_SHARED, &vp);
+	if (error != 0)
+		goto bad;
+
+	if (vp->v_type != VREG) {
+		error = vp->v_type == VDIR ? EISDIR : EINVAL;
+		vput(vp);
+		goto bad;
+	}
+
+#ifdef INVARIANTS
+	td->td_dupfd = -1;
+#endif
+	error = vn_open_vnode(vp, FREAD, td->td_ucred, td, fp);
+	if (error != 0) {
+		KASSERT(fp->f_ops == &badfileops,
+		    ("VOP_OPEN in fhsendfile() set f_ops"));
+		KASSERT(td->td_dupfd < 0,
+		    ("fhsendfile() encountered fdopen()"));
+		vput(vp);
+		goto bad;
+	}
+#ifdef INVARIANTS
+	td->td_dupfd = 0;
+#endif
+	fp->f_vnode = vp;
+	fp->f_seqcount = 1;
+	finit(fp, FREAD | (fp->f_flag & FHASLOCK), DTYPE_VNODE, vp, &vnops);
+	VOP_UNLOCK(vp, 0);
+
+	sbytes = 0;
+	error = fo_sendfile(fp, uap->s, hdr_uio, NULL, uap->offset,
+	    uap->nbytes, &sbytes, uap->flags, td);
+
+	/*
+	 * Report partial progress as sendfile(2) does, failing only if
+	 * the send itself did not.
+	 */
+	if (uap->sbytes != NULL) {
+		error1 = copyout(&sbytes, uap->sbytes, sizeof(off_t));
+		if (error == 0)
+			error = error1;
+	}
+bad:
+	fdrop(fp, td);
+out:
+	free(hdr_uio, M_IOV);
+	return (error);
+}
+
+int
+sys_fhsendfile(struct thread *td, void *params)
+{
+	struct fhsendfile_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhsendfile_args*)params;
+
+	SDT_PROBE4(fhsendfile, , fhsendfile, entry, uap->fhp, uap->offset,
+	    uap->nbytes, uap->s);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_fhsendfile(td, uap);
+	SDT_PROBE2(fhsendfile, , fhsendfile, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The `sysent' for the new syscall
+ */
+static struct sysent fhsendfile_sysent = {
+	8,			/* sy_narg */
+	sys_fhsendfile		/* sy_call */
+};
+
+/*
+ * The offset in sysent where the syscall is allocated.
+ */
+static int offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("fhsendfile syscall loaded at %d\n", offset);
+		break;
+	case MOD_UNLOAD :
+		printf("fhsendfile syscall unloaded from %d\n", offset);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(fhsendfile, &offset, &fhsendfile_sysent, load, NULL);
+MODULE_DEPEND(fhsendfile, fhresolve, 1, 1, 1);
@@ -0,0 +1,516 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * Copyright (c) 1999 Assar Westerlund
+ * Copyright (c) 1989, 1993
+ *      The Regents of the University of California.  All rights reserved.
+ * (c) UNIX System Laboratories, Inc.
+ * All or some portions of this file are derived from material licensed
+ * to the University of California by American Telephone and Telegraph
+ * Co. or Unix System Laboratories, Inc. and are reproduced herein with
+ * the permission of UNIX System Laboratories, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/mount.h>
+#include <sys/priv.h>
+#include <sys/vnode.h>
+#include <sys/buf.h>
+#include <sys/malloc.h>
+#include <sys/fcntl.h>
+#include <sys/filio.h>
+#include <sys/unistd.h>
+#include <sys/sdt.h>
+
+#include "fhresolve.h"
+#include "syscallstat.h"
+
+/*
+ * Space management on a regular file given by handle: SEEK_DATA and
+ * SEEK_HOLE, posix_fallocate(2), deallocation and posix_fadvise(2).
+ */
+
+#define	FHSPACE_ZEROSIZE	MAXPHYS
+
+/* An off_t takes two argument words on 32-bit platforms. */
+#ifdef __LP64__
+#define	FHSPACE_OFF_NARG	1
+#else
+#define	FHSPACE_OFF_NARG	2
+#endif
+
+struct fhseek_args {
+	fhandle_t	*fhp;
+	off_t		offset;
+	int		whence;
+	off_t		*resp;
+};
+
+struct fhallocate_args {
+	fhandle_t	*fhp;
+	off_t		offset;
+	off_t		len;
+};
+
+struct fhadvise_args {
+	fhandle_t	*fhp;
+	off_t		offset;
+	off_t		len;
+	int		advice;
+};
+
+int sys_fhseek(struct thread *td, void *params);
+int sys_fhallocate(struct thread *td, void *params);
+int sys_fhdeallocate(struct thread *td, void *params);
+int sys_fhadvise(struct thread *td, void *params);
+
+/*
+ * The handle resolution is under fhresolve:::fhtovp.
+ */
+SDT_PROVIDER_DEFINE(fhspace);
+SDT_PROBE_DEFINE3(fhspace, , fhseek, entry, "fhandle_t *", "off_t", "int");
+SDT_PROBE_DEFINE2(fhspace, , fhseek, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(fhspace, , fhallocate, entry, "fhandle_t *", "off_t",
+    "off_t");
+SDT_PROBE_DEFINE2(fhspace, , fhallocate, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(fhspace, , fhdeallocate, entry, "fhandle_t *", "off_t",
+    "off_t");
+SDT_PROBE_DEFINE2(fhspace, , fhdeallocate, return, "int", "int64_t");
+SDT_PROBE_DEFINE4(fhspace, , fhadvise, entry, "fhandle_t *", "off_t", "off_t",
+    "int");
+SDT_PROBE_DEFINE2(fhspace, , fhadvise, return, "int", "int64_t");
+
+/*
+ * Resolve a handle to a referenced, unlocked regular file the calling
+ * thread may access with `accmode'.
+ */
+static int
+fhspace_fhtovp(struct thread *td, fhandle_t *ufhp, accmode_t accmode,
+    struct vnode **vpp)
+{
+	fhandle_t fh;
+	struct vnode *vp;
+	int error;
+
+	error = priv_check(td, PRIV_VFS_FHOPEN);
+	if (error != 0)
+		return (error);
+
+	error = copyin(ufhp, &fh, sizeof(fh));
+	if (error != 0)
+		return (error);
+
+	error = fhresolve_fhtovp(&fh, LK_SHARED, &vp);
+	if (error != 0)
+		return (error);
+
+	if (vp->v_type != VREG)
+		error = vp->v_type == VDIR ? EISDIR : ENODEV;
+	if (error == 0 && (accmode & VWRITE) != 0)
+		error = vn_writechk(vp);
+	if (error == 0)
+		error = VOP_ACCESS(vp, accmode, td->td_ucred, td);
+	if (error != 0) {
+		vput(vp);
+		return (error);
+	}
+	VOP_UNLOCK(vp, 0);
+	*vpp = vp;
+	return (0);
+}
+
+/*
+ * code taken from vn_seek
+ */
+static int
+kern_fhseek(struct thread *td, struct fhseek_args *uap)
+{
+	struct vnode *vp;
+	struct vattr va;
+	off_t offset;
+	u_long cmd;
+	int error;
+
+	switch (uap->whence) {
+	case SEEK_DATA:
+		cmd = FIOSEEKDATA;
+		break;
+	case SEEK_HOLE:
+		cmd = FIOSEEKHOLE;
+		break;
+	default:
+		return (EINVAL);
+	}
+	if (uap->offset < 0)
+		return (ENXIO);
+
+	error = fhspace_fhtovp(td, uap->fhp, VREAD, &vp);
+	if (error != 0)
+		return (error);
+
+	offset = uap->offset;
+	error = VOP_IOCTL(vp, cmd, &offset, 0, td->td_ucred, td);
+	if (error == ENOTTY) {
+		/*
+		 * The filesystem does not track holes, the whole file is
+		 * data followed by the implicit hole at its end.
+		 */
+		vn_lock(vp, LK_SHARED | LK_RETRY);
+		error = VOP_GETATTR(vp, &va, td->td_ucred);
+		VOP_UNLOCK(vp, 0);
+		if (error == 0 && offset >= va.va_size)
+			error = ENXIO;
+		else if (error == 0 && cmd == FIOSEEKHOLE)
+			offset = va.va_size;
+	}
+	vrele(vp);
+
+	if (error == 0)
+		error = copyout(&offset, uap->resp, sizeof(offset));
+	return (error);
+}
+
+int
+sys_fhseek(struct thread *td, void *params)
+{
+	struct fhseek_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhseek_args*)params;
+
+	SDT_PROBE3(fhspace, , fhseek, entry, uap->fhp, uap->offset,
+	    uap->whence);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_fhseek(td, uap);
+	SDT_PROBE2(fhspace, , fhseek, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * code taken from kern_posix_fallocate
+ */
+static int
+kern_fhallocate(struct thread *td, struct fhallocate_args *uap)
+{
+	struct mount *mp;
+	struct vnode *vp;
+	off_t offset, len, olen, ooffset;
+	int error;
+
+	offset = uap->offset;
+	len = uap->len;
+	if (offset < 0 || len <= 0)
+		return (EINVAL);
+	/* Check for wrap. */
+	if (offset > OFF_MAX - len)
+		return (EFBIG);
+
+	error = fhspace_fhtovp(td, uap->fhp, VWRITE, &vp);
+	if (error != 0)
+		return (error);
+
+	/* Allocating blocks may take a long time, so iterate. */
+	for (;;) {
+		olen = len;
+		ooffset = offset;
+
+		bwillwrite();
+		mp = NULL;
+		error = vn_start_write(vp, &mp, V_WAIT | PCATCH);
+		if (error != 0)
+			break;
+		error = vn_lock(vp, LK_EXCLUSIVE);
+		if (error != 0) {
+			vn_finished_write(mp);
+			break;
+		}
+#ifdef MAC
+		error = mac_vnode_check_write(td->td_ucred, NOCRED, vp);
+		if (error == 0)
+#endif
+			error = VOP_ALLOCATE(vp, &offset, &len);
+		VOP_UNLOCK(vp, 0);
+		vn_finished_write(mp);
+
+		if (olen + ooffset != offset + len) {
+			panic("offset + len changed from %jx/%jx to %jx/%jx",
+			    ooffset, olen, offset, len);
+		}
+		if (error != 0 || len == 0)
+			break;
+		KASSERT(olen > len, ("Iteration did not make progress?"));
+		maybe_yield();
+	}
+	vrele(vp);
+	return (error);
+}
+
+int
+sys_fhallocate(struct thread *td, void *params)
+{
+	struct fhallocate_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhallocate_args*)params;
+
+	SDT_PROBE3(fhspace, , fhallocate, entry, uap->fhp, uap->offset,
+	    uap->len);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_fhallocate(td, uap);
+	SDT_PROBE2(fhspace, , fhallocate, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * There is no VOP to punch a hole in a file, zeroes are written over
+ * the range instead: reads of a deallocated range must return zeroes,
+ * which is all NFSv4.2 DEALLOCATE guarantees.  The range is clipped to
+ * the file size, the file is never extended.  It is written under the
+ * range lock so fhpwrite calls are not interleaved with it, and with
+ * IO_UNIT so a failing chunk is not left half written.
+ */
+static int
+kern_fhdeallocate(struct thread *td, struct fhallocate_args *uap)
+{
+	struct mount *mp;
+	struct vnode *vp;
+	struct vattr va;
+	void *rl_cookie;
+	char *zeroes;
+	off_t offset, end;
+	size_t xfer;
+	int error;
+
+	if (uap->offset < 0 || uap->len <= 0)
+		return (EINVAL);
+	if (uap->offset > OFF_MAX - uap->len)
+		return (EFBIG);
+
+	error = fhspace_fhtovp(td, uap->fhp, VWRITE, &vp);
+	if (error != 0)
+		return (error);
+
+	offset = uap->offset;
+	end = uap->offset + uap->len;
+	zeroes = malloc(MIN(uap->len, FHSPACE_ZEROSIZE), M_TEMP,
+	    M_WAITOK | M_ZERO);
+	bwillwrite();
+	rl_cookie = vn_rangelock_wlock(vp, offset, end);
+	error = vn_start_write(vp, &mp, V_WAIT | PCATCH);
+	if (error != 0)
+		goto out;
+	vn_lock(vp, LK_EXCLUSIVE | LK_RETRY);
+	if ((vp->v_iflag & VI_DOOMED) != 0)
+		error = ESTALE;
+#ifdef MAC
+	if (error == 0)
+		error = mac_vnode_check_write(td->td_ucred, NOCRED, vp);
+#endif
+	if (error == 0)
+		error = VOP_GETATTR(vp, &va, td->td_ucred);
+	if (error == 0 && end > va.va_size)
+		end = va.va_size;
+	while (error == 0 && offset < end) {
+		xfer = MIN(end - offset, FHSPACE_ZEROSIZE);
+		/* A short write without an error is turned into EIO. */
+		error = vn_rdwr(UIO_WRITE, vp, zeroes, xfer, offset,
+		    UIO_SYSSPACE, IO_UNIT | IO_NODELOCKED, td->td_ucred,
+		    NOCRED, NULL, td);
+		offset += xfer;
+	}
+	VOP_UNLOCK(vp, 0);
+	vn_finished_write(mp);
+out:
+	vn_rangelock_unlock(vp, rl_cookie);
+	free(zeroes, M_TEMP);
+	vrele(vp);
+	return (error);
+}
+
+int
+sys_fhdeallocate(struct thread *td, void *params)
+{
+	struct fhallocate_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhallocate_args*)params;
+
+	SDT_PROBE3(fhspace, , fhdeallocate, entry, uap->fhp, uap->offset,
+	    uap->len);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_fhdeallocate(td, uap);
+	SDT_PROBE2(fhspace, , fhdeallocate, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * code taken from kern_posix_fadvise
+ *
+ * Without an open file the per-file access pattern hints have nowhere
+ * to be recorded, they are accepted and ignored; pass FHIO_SEQUENTIAL
+ * to fhpread instead.  WILLNEED and DONTNEED go to the filesystem.
+ */
+static int
+kern_fhadvise(struct thread *td, struct fhadvise_args *uap)
+{
+	struct vnode *vp;
+	off_t end;
+	int error;
+
+	if (uap->offset < 0 || uap->len < 0 ||
+	    uap->offset > OFF_MAX - uap->len)
+		return (EINVAL);
+	switch (uap->advice) {
+	case POSIX_FADV_SEQUENTIAL:
+	case POSIX_FADV_RANDOM:
+	case POSIX_FADV_NOREUSE:
+	case POSIX_FADV_NORMAL:
+	case POSIX_FADV_WILLNEED:
+	case POSIX_FADV_DONTNEED:
+		break;
+	default:
+		return (EINVAL);
+	}
+
+	error = fhspace_fhtovp(td, uap->fhp, VREAD, &vp);
+	if (error != 0)
+		return (error);
+
+	switch (uap->advice) {
+	case POSIX_FADV_WILLNEED:
+	case POSIX_FADV_DONTNEED:
+		if (uap->len == 0)
+			end = OFF_MAX;
+		else
+			end = uap->offset + uap->len - 1;
+		error = VOP_ADVISE(vp, uap->offset, end, uap->advice);
+		break;
+	default:
+		break;
+	}
+	vrele(vp);
+	return (error);
+}
+
+int
+sys_fhadvise(struct thread *td, void *params)
+{
+	struct fhadvise_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct fhadvise_args*)params;
+
+	SDT_PROBE4(fhspace, , fhadvise, entry, uap->fhp, uap->offset, uap->len,
+	    uap->advice);
+	start = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	error = kern_fhadvise(td, uap);
+	SDT_PROBE2(fhspace, , fhadvise, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The `sysent's for the new syscalls
+ */
+static struct sysent fhseek_sysent = {
+	3 + FHSPACE_OFF_NARG,	/* sy_narg */
+	sys_fhseek		/* sy_call */
+};
+
+static struct sysent fhallocate_sysent = {
+	1 + 2 * FHSPACE_OFF_NARG, /* sy_narg */
+	sys_fhallocate		/* sy_call */
+};
+
+static struct sysent fhdeallocate_sysent = {
+	1 + 2 * FHSPACE_OFF_NARG, /* sy_narg */
+	sys_fhdeallocate	/* sy_call */
+};
+
+static struct sysent fhadvise_sysent = {
+	2 + 2 * FHSPACE_OFF_NARG, /* sy_narg */
+	sys_fhadvise		/* sy_call */
+};
+
+/*
+ * The offsets in sysent where the syscalls are allocated.
+ */
+static int fhseek_offset = NO_SYSCALL;
+static int fhallocate_offset = NO_SYSCALL;
+static int fhdeallocate_offset = NO_SYSCALL;
+static int fhadvise_offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload, arg points to the offset.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("%s syscall loaded at %d\n", module_getname(module),
+		    *(int *)arg);
+		break;
+	case MOD_UNLOAD :
+		printf("%s syscall unloaded from %d\n", module_getname(module),
+		    *(int *)arg);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(fhseek, &fhseek_offset, &fhseek_sysent, load,
+    &fhseek_offset);
+SYSCALL_MODULE(fhallocate, &fhallocate_offset, &fhallocate_sysent, load,
+    &fhallocate_offset);
+SYSCALL_MODULE(fhdeallocate, &fhdeallocate_offset, &fhdeallocate_sysent,
+    load, &fhdeallocate_offset);
+SYSCALL_MODULE(fhadvise, &fhadvise_offset, &fhadvise_sysent, load,
+    &fhadvise_offset);
+MODULE_DEPEND(fhseek, fhresolve, 1, 1, 1);
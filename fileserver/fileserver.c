@@ -0,0 +1,227 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/syscall.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+
+#include "fileserver.h"
+
+/*
+ * The fileserver kld links all the syscall modules in one file, each
+ * still registered by its own SYSCALL_MODULE so modfind(2) keeps
+ * working for them.  fileservercaps gives a server all their offsets
+ * in one call instead of a modfind and a modstat per syscall.
+ */
+
+struct fileservercaps_args {
+	struct fileserver_caps	*capsp;
+	size_t			size;
+};
+
+int sys_fileservercaps(struct thread *td, void *params);
+
+sy_call_t sys_getfhat, sys_getfhstatat, sys_fhlink, sys_fhlinkat,
+    sys_fhreadlink, sys_setthreaduid, sys_setthreadgid, sys_setthreadgroups,
+    sys_setthreadcred, sys_pushthreadcred, sys_popthreadcred,
+    sys_credtoken_register, sys_credtoken_unregister, sys_setthreadtoken,
+    sys_fhbatch, sys_fhreaddirplus, sys_fhlookupat, sys_fhmkdirat,
+    sys_fhsymlinkat, sys_fhmknodat, sys_fhopenat, sys_fhrenameat,
+    sys_fhunlinkat, sys_fhpread, sys_fhpwrite, sys_fhpreadv, sys_fhpwritev,
+    sys_fhcopyrange, sys_fhseek, sys_fhallocate, sys_fhdeallocate,
+    sys_fhadvise, sys_fhcommit, sys_fhgetattrs;
+#ifdef __LP64__
+sy_call_t sys_fhsendfile;
+#endif
+
+static const struct fileserver_syscall {
+	sy_call_t	*fs_call;
+	uint64_t	fs_cap;		/* FILESERVER_CAP_* it belongs to */
+} fileserver_syscalls[FILESERVER_NSYSCALLS] = {
+	[FILESERVER_SYS_GETFHAT] = { sys_getfhat, 0 },
+	[FILESERVER_SYS_GETFHSTATAT] = { sys_getfhstatat, 0 },
+	[FILESERVER_SYS_FHLINK] = { sys_fhlink, 0 },
+	[FILESERVER_SYS_FHLINKAT] = { sys_fhlinkat, FILESERVER_CAP_NAMESPACE },
+	[FILESERVER_SYS_FHREADLINK] = { sys_fhreadlink, 0 },
+	[FILESERVER_SYS_SETTHREADUID] = { sys_setthreaduid, 0 },
+	[FILESERVER_SYS_SETTHREADGID] = { sys_setthreadgid, 0 },
+	[FILESERVER_SYS_SETTHREADGROUPS] = { sys_setthreadgroups, 0 },
+	[FILESERVER_SYS_SETTHREADCRED] =
+	    { sys_setthreadcred, FILESERVER_CAP_THREADCRED },
+	[FILESERVER_SYS_PUSHTHREADCRED] =
+	    { sys_pushthreadcred, FILESERVER_CAP_THREADCRED },
+	[FILESERVER_SYS_POPTHREADCRED] =
+	    { sys_popthreadcred, FILESERVER_CAP_THREADCRED },
+	[FILESERVER_SYS_CREDTOKEN_REGISTER] =
+	    { sys_credtoken_register, FILESERVER_CAP_CREDTOKEN },
+	[FILESERVER_SYS_CREDTOKEN_UNREGISTER] =
+	    { sys_credtoken_unregister, FILESERVER_CAP_CREDTOKEN },
+	[FILESERVER_SYS_SETTHREADTOKEN] =
+	    { sys_setthreadtoken, FILESERVER_CAP_CREDTOKEN },
+	[FILESERVER_SYS_FHBATCH] = { sys_fhbatch, FILESERVER_CAP_BATCH },
+	[FILESERVER_SYS_FHREADDIRPLUS] =
+	    { sys_fhreaddirplus, FILESERVER_CAP_READDIRPLUS },
+	[FILESERVER_SYS_FHLOOKUPAT] =
+	    { sys_fhlookupat, FILESERVER_CAP_NAMESPACE },
+	[FILESERVER_SYS_FHMKDIRAT] =
+	    { sys_fhmkdirat, FILESERVER_CAP_NAMESPACE },
+	[FILESERVER_SYS_FHSYMLINKAT] =
+	    { sys_fhsymlinkat, FILESERVER_CAP_NAMESPACE },
+	[FILESERVER_SYS_FHMKNODAT] =
+	    { sys_fhmknodat, FILESERVER_CAP_NAMESPACE },
+	[FILESERVER_SYS_FHOPENAT] = { sys_fhopenat, FILESERVER_CAP_NAMESPACE },
+	[FILESERVER_SYS_FHRENAMEAT] =
+	    { sys_fhrenameat, FILESERVER_CAP_NAMESPACE },
+	[FILESERVER_SYS_FHUNLINKAT] =
+	    { sys_fhunlinkat, FILESERVER_CAP_NAMESPACE },
+	[FILESERVER_SYS_FHPREAD] = { sys_fhpread, FILESERVER_CAP_IO },
+	[FILESERVER_SYS_FHPWRITE] = { sys_fhpwrite, FILESERVER_CAP_IO },
+	[FILESERVER_SYS_FHPREADV] = { sys_fhpreadv, FILESERVER_CAP_IO },
+	[FILESERVER_SYS_FHPWRITEV] = { sys_fhpwritev, FILESERVER_CAP_IO },
+#ifdef __LP64__
+	[FILESERVER_SYS_FHSENDFILE] =
+	    { sys_fhsendfile, FILESERVER_CAP_SENDFILE },
+#else
+	/* Never found in sysent, FILESERVER_CAP_SENDFILE stays clear. */
+	[FILESERVER_SYS_FHSENDFILE] = { NULL, FILESERVER_CAP_SENDFILE },
+#endif
+	[FILESERVER_SYS_FHCOPYRANGE] =
+	    { sys_fhcopyrange, FILESERVER_CAP_COPYRANGE },
+	[FILESERVER_SYS_FHSEEK] = { sys_fhseek, FILESERVER_CAP_SPACE },
+	[FILESERVER_SYS_FHALLOCATE] = { sys_fhallocate, FILESERVER_CAP_SPACE },
+	[FILESERVER_SYS_FHDEALLOCATE] =
+	    { sys_fhdeallocate, FILESERVER_CAP_SPACE },
+	[FILESERVER_SYS_FHADVISE] = { sys_fhadvise, FILESERVER_CAP_SPACE },
+	[FILESERVER_SYS_FHCOMMIT] = { sys_fhcommit, FILESERVER_CAP_COMMIT },
+	[FILESERVER_SYS_FHGETATTRS] =
+	    { sys_fhgetattrs, FILESERVER_CAP_GETATTRS },
+};
+
+/*
+ * Look the syscalls up in sysent rather than keeping their offsets:
+ * this is done once when a server starts, and tells which of them
+ * actually got registered.
+ */
+static void
+fileserver_getcaps(struct fileserver_caps *caps)
+{
+	uint64_t present, missing;
+	sy_call_t *call;
+	int i, off;
+
+	bzero(caps, sizeof(*caps));
+	caps->fc_version = FILESERVER_VERSION;
+	caps->fc_nsyscalls = FILESERVER_NSYSCALLS;
+	for (i = 0; i < FILESERVER_NSYSCALLS; i++)
+		caps->fc_syscalls[i] = -1;
+
+	for (off = 0; off < SYS_MAXSYSCALL; off++) {
+		call = sysent[off].sy_call;
+		for (i = 0; i < FILESERVER_NSYSCALLS; i++) {
+			if (call == fileserver_syscalls[i].fs_call) {
+				caps->fc_syscalls[i] = off;
+				break;
+			}
+		}
+	}
+
+	present = missing = 0;
+	for (i = 0; i < FILESERVER_NSYSCALLS; i++) {
+		if (caps->fc_syscalls[i] != -1)
+			present |= fileserver_syscalls[i].fs_cap;
+		else
+			missing |= fileserver_syscalls[i].fs_cap;
+	}
+	caps->fc_flags = (present & ~missing) | FILESERVER_CAP_STATS;
+#ifdef KDTRACE_HOOKS
+	caps->fc_flags |= FILESERVER_CAP_SDT;
+#endif
+}
+
+/*
+ * The function for implementing the syscall.
+ */
+int sys_fileservercaps(struct thread *td, void *params)
+{
+	struct fileservercaps_args *uap;
+	struct fileserver_caps caps;
+	int error;
+
+	uap = (struct fileservercaps_args*)params;
+
+	fileserver_getcaps(&caps);
+	error = copyout(&caps, uap->capsp, MIN(uap->size, sizeof(caps)));
+	if (error == 0)
+		td->td_retval[0] = sizeof(caps);
+	return (error);
+}
+
+/*
+ * The `sysent' for the new syscall
+ */
+static struct sysent fileservercaps_sysent = {
+	2,			/* sy_narg */
+	sys_fileservercaps	/* sy_call */
+};
+
+/*
+ * The offset in sysent where the syscall is allocated.
+ */
+static int offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("fileservercaps syscall loaded at %d\n", offset);
+		break;
+	case MOD_UNLOAD :
+		printf("fileservercaps syscall unloaded from %d\n", offset);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(fileservercaps, &offset, &fileservercaps_sysent, load, NULL);
+MODULE_VERSION(fileserver, FILESERVER_VERSION);
@@ -0,0 +1,230 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#ifndef _FILESERVER_H_
+#define	_FILESERVER_H_
+
+#include <sys/types.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+/*
+ * Capabilities of the fileserver kld, which links every fh*, setthread*
+ * and credtoken syscall with the modules they share, and the structures
+ * and flags those syscalls take.  This header is shared by the modules
+ * and libfileserver, which installs it.
+ *
+ * fileservercaps(caps, size) fills the first size bytes of a struct
+ * fileserver_caps with the offset in sysent of each syscall, -1 for
+ * the ones not loaded, and returns the size of the whole structure.
+ * FILESERVER_SYS_* indexes are never reused, new syscalls are added at
+ * the end: a caller built with an older header gets the entries it
+ * knows, one built with a newer header finds fc_nsyscalls entries and
+ * takes the following ones as missing.
+ */
+
+#define	FILESERVER_VERSION	1
+
+#define	FILESERVER_SYS_GETFHAT			0
+#define	FILESERVER_SYS_GETFHSTATAT		1
+#define	FILESERVER_SYS_FHLINK			2
+#define	FILESERVER_SYS_FHLINKAT			3
+#define	FILESERVER_SYS_FHREADLINK		4
+#define	FILESERVER_SYS_SETTHREADUID		5
+#define	FILESERVER_SYS_SETTHREADGID		6
+#define	FILESERVER_SYS_SETTHREADGROUPS		7
+#define	FILESERVER_SYS_SETTHREADCRED		8
+#define	FILESERVER_SYS_PUSHTHREADCRED		9
+#define	FILESERVER_SYS_POPTHREADCRED		10
+#define	FILESERVER_SYS_CREDTOKEN_REGISTER	11
+#define	FILESERVER_SYS_CREDTOKEN_UNREGISTER	12
+#define	FILESERVER_SYS_SETTHREADTOKEN		13
+#define	FILESERVER_SYS_FHBATCH			14
+#define	FILESERVER_SYS_FHREADDIRPLUS		15
+#define	FILESERVER_SYS_FHLOOKUPAT		16
+#define	FILESERVER_SYS_FHMKDIRAT		17
+#define	FILESERVER_SYS_FHSYMLINKAT		18
+#define	FILESERVER_SYS_FHMKNODAT		19
+#define	FILESERVER_SYS_FHOPENAT			20
+#define	FILESERVER_SYS_FHRENAMEAT		21
+#define	FILESERVER_SYS_FHUNLINKAT		22
+#define	FILESERVER_SYS_FHPREAD			23
+#define	FILESERVER_SYS_FHPWRITE			24
+#define	FILESERVER_SYS_FHPREADV			25
+#define	FILESERVER_SYS_FHPWRITEV		26
+#define	FILESERVER_SYS_FHSENDFILE		27
+#define	FILESERVER_SYS_FHCOPYRANGE		28
+#define	FILESERVER_SYS_FHSEEK			29
+#define	FILESERVER_SYS_FHALLOCATE		30
+#define	FILESERVER_SYS_FHDEALLOCATE		31
+#define	FILESERVER_SYS_FHADVISE			32
+#define	FILESERVER_SYS_FHCOMMIT			33
+#define	FILESERVER_SYS_FHGETATTRS		34
+#define	FILESERVER_NSYSCALLS			35
+
+/*
+ * Optional paths, set in fc_flags when all their syscalls are there.
+ */
+#define	FILESERVER_CAP_THREADCRED	0x0001	/* [push|pop|set]threadcred */
+#define	FILESERVER_CAP_CREDTOKEN	0x0002	/* credential tokens */
+#define	FILESERVER_CAP_BATCH		0x0004	/* fhbatch */
+#define	FILESERVER_CAP_READDIRPLUS	0x0008	/* fhreaddirplus */
+#define	FILESERVER_CAP_NAMESPACE	0x0010	/* fhlookupat ... fhunlinkat */
+#define	FILESERVER_CAP_IO		0x0020	/* fhp{read,write}[v] */
+#define	FILESERVER_CAP_SENDFILE		0x0040	/* fhsendfile */
+#define	FILESERVER_CAP_COPYRANGE	0x0080	/* fhcopyrange */
+#define	FILESERVER_CAP_SPACE		0x0100	/* fhseek ... fhadvise */
+#define	FILESERVER_CAP_COMMIT		0x0200	/* fhcommit */
+#define	FILESERVER_CAP_GETATTRS		0x0400	/* fhgetattrs */
+#define	FILESERVER_CAP_STATS		0x0800	/* kern.syscallstat */
+#define	FILESERVER_CAP_SDT		0x1000	/* SDT probes */
+
+struct fileserver_caps {
+	uint32_t	fc_version;		/* FILESERVER_VERSION */
+	uint32_t	fc_nsyscalls;		/* entries in fc_syscalls */
+	uint64_t	fc_flags;		/* FILESERVER_CAP_* */
+	int32_t		fc_syscalls[FILESERVER_NSYSCALLS];
+};
+
+/*
+ * getfhstatat: fields of struct stat to fill, the others are zeroed.
+ * VOP_GETATTR is skipped entirely when only the type is asked for.
+ */
+#define	GETFHSTAT_TYPE		0x0001	/* file type bits of st_mode */
+#define	GETFHSTAT_MODE		0x0002	/* permission bits of st_mode */
+#define	GETFHSTAT_IDS		0x0004	/* st_uid, st_gid */
+#define	GETFHSTAT_SIZE		0x0008	/* st_size, st_blocks */
+#define	GETFHSTAT_CTIME		0x0010	/* st_ctim */
+#define	GETFHSTAT_TIMES		0x0020	/* st_atim, st_mtim, st_birthtim */
+#define	GETFHSTAT_OTHER		0x0040	/* everything else */
+#define	GETFHSTAT_ALL		0x007f
+
+/*
+ * fhbatch: a vector of at most FHBATCH_MAX operations, each one getting
+ * its own errno in fbo_error.
+ */
+#define	FHBATCH_GETFHAT		1	/* fbo_fd, fbo_path, fbo_flag -> fbo_fhp */
+#define	FHBATCH_RESOLVE		2	/* fbo_fhp -> fbo_retval = vtype */
+#define	FHBATCH_READLINK	3	/* fbo_fhp -> fbo_buf, fbo_retval */
+#define	FHBATCH_LINK		4	/* fbo_fhp, fbo_fd, fbo_path */
+
+#define	FHBATCH_MAX		256
+
+struct fhbatch_op {
+	int		fbo_op;
+	int		fbo_error;
+	fhandle_t	*fbo_fhp;
+	int		fbo_fd;
+	int		fbo_flag;
+	const char	*fbo_path;
+	char		*fbo_buf;
+	size_t		fbo_bufsize;
+	ssize_t		fbo_retval;
+};
+
+/*
+ * fhreaddirplus: records of fdp_reclen bytes, 8 bytes aligned, in a
+ * buffer of at most FHREADDIRPLUS_MAXBUF bytes.
+ */
+#define	FHREADDIRPLUS_MAXBUF	(256 * 1024)
+
+struct fhdirplus {
+	uint16_t	fdp_reclen;	/* length of this record */
+	uint16_t	fdp_namlen;	/* length of fdp_name, without NUL */
+	int		fdp_error;	/* fdp_fh and fdp_stat are valid if 0 */
+	off_t		fdp_cookie;	/* resume after this entry */
+	fhandle_t	fdp_fh;
+	struct stat	fdp_stat;
+	char		fdp_name[];
+};
+
+/*
+ * fhp{read,write}[v] flags.
+ */
+#define	FHIO_DIRECT	0x0001	/* IO_DIRECT, bypass the buffer cache */
+#define	FHIO_SYNC	0x0002	/* IO_SYNC, write synchronously */
+#define	FHIO_SEQUENTIAL	0x0004	/* maximal read-ahead / clustering */
+
+/*
+ * fhcommit: a vector of at most FHCOMMIT_MAX ranges, each one getting
+ * its own errno in fco_error.  The range only bounds the pages pushed
+ * ahead of the wait, each file is then synced as a whole.
+ */
+#define	FHCOMMIT_MAX		256
+
+struct fhcommit_op {
+	fhandle_t	fco_fh;
+	off_t		fco_offset;
+	off_t		fco_length;	/* 0 means to the end of the file */
+	int		fco_error;
+};
+
+/*
+ * fhgetattrs: the attributes to fill, fa_valid tells which ones were.
+ */
+#define	FHATTR_TYPE		0x0001	/* fa_type */
+#define	FHATTR_MODE		0x0002	/* fa_mode */
+#define	FHATTR_NLINK		0x0004	/* fa_nlink */
+#define	FHATTR_OWNER		0x0008	/* fa_uid, fa_gid */
+#define	FHATTR_SIZE		0x0010	/* fa_size, fa_bytes */
+#define	FHATTR_FSID		0x0020	/* fa_fsid, the fsid of the handle */
+#define	FHATTR_FILEID		0x0040	/* fa_fileid */
+#define	FHATTR_CHANGE		0x0080	/* fa_change, from va_filerev */
+#define	FHATTR_ATIME		0x0100	/* fa_atime */
+#define	FHATTR_MTIME		0x0200	/* fa_mtime */
+#define	FHATTR_CTIME		0x0400	/* fa_ctime */
+#define	FHATTR_BIRTHTIME	0x0800	/* fa_birthtime */
+#define	FHATTR_RDEV		0x1000	/* fa_rdev */
+#define	FHATTR_FLAGS		0x2000	/* fa_flags */
+#define	FHATTR_GEN		0x4000	/* fa_gen */
+#define	FHATTR_ALL		0x7fff
+
+struct fhattrs {
+	u_int		fa_valid;
+	int		fa_type;	/* enum vtype */
+	mode_t		fa_mode;
+	nlink_t		fa_nlink;
+	uid_t		fa_uid;
+	gid_t		fa_gid;
+	off_t		fa_size;
+	u_quad_t	fa_bytes;
+	fsid_t		fa_fsid;
+	ino_t		fa_fileid;
+	u_quad_t	fa_change;
+	struct timespec	fa_atime;
+	struct timespec	fa_mtime;
+	struct timespec	fa_ctime;
+	struct timespec	fa_birthtime;
+	dev_t		fa_rdev;
+	u_long		fa_flags;
+	u_long		fa_gen;
+};
+
+#endif /* !_FILESERVER_H_ */
@@ -42,6 +42,11 @@
 #include <sys/vnode.h>
 #include <sys/file.h>
 #include <sys/capsicum.h>
+#include <sys/stat.h>
+#include <sys/sdt.h>
+
+#include "fileserver.h"
+#include "syscallstat.h"
 
 struct getfhat_args {
 	int		fd;
@@ -50,29 +55,127 @@ struct getfhat_args {
 	int		flag;
 };
 
+struct getfhstatat_args {
+	int		fd;
+	char		*path;
+	fhandle_t	*fhp;
+	int		flag;
+	struct stat	*sbp;
+	int		mask;
+};
+
 int sys_getfhat(struct thread *td, void *params);
+int sys_getfhstatat(struct thread *td, void *params);
+
+static struct syscallstat *getfhat_stats;
+static struct syscallstat *getfhstatat_stats;
+
+#define	GETFHAT_PHASE_NAMEI	0
+#define	GETFHAT_PHASE_VPTOFH	1
+#define	GETFHAT_PHASE_STAT	2
+
+static const char * const getfhat_phases[] = { "namei", "vptofh", "stat" };
 
 /*
- * The function for implementing the syscall.
+ * getfhat:::namei has no fsid, the filesystem is only known once the
+ * lookup succeeded.
  */
-int sys_getfhat(struct thread *td, void *params)
+SDT_PROVIDER_DEFINE(getfhat);
+SDT_PROBE_DEFINE3(getfhat, , getfhat, entry, "int", "char *", "int");
+SDT_PROBE_DEFINE2(getfhat, , getfhat, return, "int", "int64_t");
+SDT_PROBE_DEFINE4(getfhat, , getfhstatat, entry, "int", "char *", "int",
+    "int");
+SDT_PROBE_DEFINE2(getfhat, , getfhstatat, return, "int", "int64_t");
+SDT_PROBE_DEFINE2(getfhat, , , namei, "int", "int64_t");
+SDT_PROBE_DEFINE3(getfhat, , , vptofh, "fsid_t *", "int", "int64_t");
+SDT_PROBE_DEFINE3(getfhat, , , stat, "fsid_t *", "int", "int64_t");
+
+/* code taken from vn_stat */
+static int
+getfhat_stat(struct thread *td, struct vnode *vp, int mask, struct stat *sb)
+{
+	struct vattr vattr;
+	struct vattr *vap;
+	int error;
+
+	bzero(sb, sizeof(*sb));
+	if (mask & GETFHSTAT_TYPE)
+		sb->st_mode = VTTOIF(vp->v_type);
+	if ((mask & ~GETFHSTAT_TYPE) == 0)
+		return (0);
+
+#ifdef MAC
+	error = mac_vnode_check_stat(td->td_ucred, NOCRED, vp);
+	if (error != 0)
+		return (error);
+#endif
+
+	vap = &vattr;
+	vap->va_birthtime.tv_sec = -1;
+	vap->va_birthtime.tv_nsec = 0;
+	error = VOP_GETATTR(vp, vap, td->td_ucred);
+	if (error != 0)
+		return (error);
+
+	if (mask & GETFHSTAT_MODE)
+		sb->st_mode |= vap->va_mode;
+	if (mask & GETFHSTAT_IDS) {
+		sb->st_uid = vap->va_uid;
+		sb->st_gid = vap->va_gid;
+	}
+	if (mask & GETFHSTAT_SIZE) {
+		sb->st_size = vap->va_size;
+		sb->st_blocks = vap->va_bytes / S_BLKSIZE;
+	}
+	if (mask & GETFHSTAT_CTIME)
+		sb->st_ctim = vap->va_ctime;
+	if (mask & GETFHSTAT_TIMES) {
+		sb->st_atim = vap->va_atime;
+		sb->st_mtim = vap->va_mtime;
+		sb->st_birthtim = vap->va_birthtime;
+	}
+	if (mask & GETFHSTAT_OTHER) {
+		sb->st_dev = vap->va_fsid;
+		sb->st_ino = vap->va_fileid;
+		sb->st_nlink = vap->va_nlink;
+		sb->st_rdev = vap->va_rdev;
+		sb->st_blksize = max(PAGE_SIZE, vap->va_blocksize);
+		sb->st_flags = vap->va_flags;
+		sb->st_gen = vap->va_gen;
+	}
+	return (0);
+}
+
+/*
+ * Get the handle of a path and, if sbp is not NULL, its attributes
+ * from the same locked vnode.
+ */
+static int
+kern_getfhat(struct thread *td, int fd, char *path, int flag, fhandle_t *fhp,
+    struct stat *sbp, int mask, struct syscallstat *ss)
 {
-	struct getfhat_args *uap;
 	struct nameidata nd;
 	fhandle_t fh;
+	struct stat sb;
 	struct vnode *vp;
+	sbintime_t t;
 	int error;
 
-	uap = (struct getfhat_args*)params;
-
 	error = priv_check(td, PRIV_VFS_GETFH);
 	if (error != 0)
 		return (error);
 
-	NDINIT_AT(&nd, LOOKUP, (uap->flag & AT_SYMLINK_NOFOLLOW ? NOFOLLOW : FOLLOW) | LOCKLEAF | AUDITVNODE1,
-		uap->path ? UIO_USERSPACE : UIO_SYSSPACE, uap->path ? uap->path : ".", uap->fd, td);
+	/*
+	 * LOCKSHARED: namei() falls back to an exclusive lock on the
+	 * filesystems without MNTK_LOOKUP_SHARED.
+	 */
+	NDINIT_AT(&nd, LOOKUP, (flag & AT_SYMLINK_NOFOLLOW ? NOFOLLOW : FOLLOW) | LOCKLEAF | LOCKSHARED | AUDITVNODE1,
+		path ? UIO_USERSPACE : UIO_SYSSPACE, path ? path : ".", fd, td);
 
+	t = syscallstat_start();
 	error = namei(&nd);
+	syscallstat_phase(ss, GETFHAT_PHASE_NAMEI, t);
+	SDT_PROBE2(getfhat, , , namei, error, syscallstat_elapsed(t));
 	if (error != 0)
 		return (error);
 	NDFREE(&nd, NDF_ONLY_PNBUF);
@@ -80,28 +183,113 @@ int sys_getfhat(struct thread *td, void *params)
 
         bzero(&fh, sizeof(fh));
         fh.fh_fsid = vp->v_mount->mnt_stat.f_fsid;
+	t = syscallstat_start();
         error = VOP_VPTOFH(vp, &fh.fh_fid);
+	syscallstat_phase(ss, GETFHAT_PHASE_VPTOFH, t);
+	SDT_PROBE3(getfhat, , , vptofh, &fh.fh_fsid, error,
+	    syscallstat_elapsed(t));
+	if (error == 0 && sbp != NULL) {
+		t = syscallstat_start();
+		error = getfhat_stat(td, vp, mask, &sb);
+		syscallstat_phase(ss, GETFHAT_PHASE_STAT, t);
+		SDT_PROBE3(getfhat, , , stat, &fh.fh_fsid, error,
+		    syscallstat_elapsed(t));
+	}
         vput(vp);
         if (error == 0)
-		error = copyout(&fh, uap->fhp, sizeof (fh));
+		error = copyout(&fh, fhp, sizeof (fh));
+	if (error == 0 && sbp != NULL)
+		error = copyout(&sb, sbp, sizeof (sb));
+	return (error);
+}
+
+/*
+ * The function for implementing the syscall.
+ */
+int sys_getfhat(struct thread *td, void *params)
+{
+	struct getfhat_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct getfhat_args*)params;
+
+	SDT_PROBE3(getfhat, , getfhat, entry, uap->fd, uap->path, uap->flag);
+	start = syscallstat_start();
+	error = kern_getfhat(td, uap->fd, uap->path, uap->flag, uap->fhp,
+	    NULL, 0, getfhat_stats);
+	syscallstat_end(getfhat_stats, start, error);
+	SDT_PROBE2(getfhat, , getfhat, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * The function for implementing the syscall with attributes.
+ */
+int sys_getfhstatat(struct thread *td, void *params)
+{
+	struct getfhstatat_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct getfhstatat_args*)params;
+
+	SDT_PROBE4(getfhat, , getfhstatat, entry, uap->fd, uap->path,
+	    uap->flag, uap->mask);
+	start = syscallstat_start();
+	if ((uap->mask & ~GETFHSTAT_ALL) != 0)
+		error = EINVAL;
+	else
+		error = kern_getfhat(td, uap->fd, uap->path, uap->flag,
+		    uap->fhp, uap->sbp, uap->mask, getfhstatat_stats);
+	syscallstat_end(getfhstatat_stats, start, error);
+	SDT_PROBE2(getfhat, , getfhstatat, return, error,
+	    syscallstat_elapsed(start));
 	return (error);
 }
 
+static void
+getfhat_init(void *arg __unused)
+{
+
+	getfhat_stats = syscallstat_register("getfhat", getfhat_phases,
+	    nitems(getfhat_phases));
+	getfhstatat_stats = syscallstat_register("getfhstatat", getfhat_phases,
+	    nitems(getfhat_phases));
+}
+SYSINIT(getfhat, SI_SUB_SYSCALLS, SI_ORDER_FIRST, getfhat_init, NULL);
+
+static void
+getfhat_uninit(void *arg __unused)
+{
+
+	syscallstat_deregister(getfhat_stats);
+	syscallstat_deregister(getfhstatat_stats);
+}
+SYSUNINIT(getfhat, SI_SUB_SYSCALLS, SI_ORDER_FIRST, getfhat_uninit, NULL);
+
 /*
- * The `sysent' for the new syscall
+ * The `sysent's for the new syscalls
  */
 static struct sysent getfhat_sysent = {
 	4,			/* sy_narg */
 	sys_getfhat		/* sy_call */
 };
 
+static struct sysent getfhstatat_sysent = {
+	6,			/* sy_narg */
+	sys_getfhstatat		/* sy_call */
+};
+
 /*
- * The offset in sysent where the syscall is allocated.
+ * The offsets in sysent where the syscalls are allocated.
  */
-static int offset = NO_SYSCALL;
+static int getfhat_offset = NO_SYSCALL;
+static int getfhstatat_offset = NO_SYSCALL;
 
 /*
- * The function called at load/unload.
+ * The function called at load/unload, arg points to the offset.
  */
 static int
 load(struct module *module, int cmd, void *arg)
@@ -110,10 +298,12 @@ load(struct module *module, int cmd, void *arg)
 
 	switch (cmd) {
 	case MOD_LOAD :
-		printf("getfhat syscall loaded at %d\n", offset);
+		printf("%s syscall loaded at %d\n", module_getname(module),
+		    *(int *)arg);
 		break;
 	case MOD_UNLOAD :
-		printf("getfhat syscall unloaded from %d\n", offset);
+		printf("%s syscall unloaded from %d\n", module_getname(module),
+		    *(int *)arg);
 		break;
 	default :
 		error = EOPNOTSUPP;
@@ -122,4 +312,8 @@ load(struct module *module, int cmd, void *arg)
 	return (error);
 }
 
-SYSCALL_MODULE(getfhat, &offset, &getfhat_sysent, load, NULL);
+SYSCALL_MODULE(getfhat, &getfhat_offset, &getfhat_sysent, load,
+    &getfhat_offset);
+SYSCALL_MODULE(getfhstatat, &getfhstatat_offset, &getfhstatat_sysent, load,
+    &getfhstatat_offset);
+MODULE_DEPEND(getfhat, syscallstat, 1, 1, 1);
@@ -0,0 +1,160 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/module.h>
+#include <string.h>
+
+#include "libfileserver.h"
+
+/*
+ * Module names and FILESERVER_CAP_* of the syscalls, to find them one
+ * by one when the standalone modules are loaded instead of the
+ * fileserver kld.  Kept in the order of FILESERVER_SYS_*.
+ */
+static const struct {
+	const char	*name;
+	uint64_t	cap;
+} fileserver_syscalls[FILESERVER_NSYSCALLS] = {
+	{ "getfhat", 0 },
+	{ "getfhstatat", 0 },
+	{ "fhlink", 0 },
+	{ "fhlinkat", FILESERVER_CAP_NAMESPACE },
+	{ "fhreadlink", 0 },
+	{ "setthreaduid", 0 },
+	{ "setthreadgid", 0 },
+	{ "setthreadgroups", 0 },
+	{ "setthreadcred", FILESERVER_CAP_THREADCRED },
+	{ "pushthreadcred", FILESERVER_CAP_THREADCRED },
+	{ "popthreadcred", FILESERVER_CAP_THREADCRED },
+	{ "credtoken_register", FILESERVER_CAP_CREDTOKEN },
+	{ "credtoken_unregister", FILESERVER_CAP_CREDTOKEN },
+	{ "setthreadtoken", FILESERVER_CAP_CREDTOKEN },
+	{ "fhbatch", FILESERVER_CAP_BATCH },
+	{ "fhreaddirplus", FILESERVER_CAP_READDIRPLUS },
+	{ "fhlookupat", FILESERVER_CAP_NAMESPACE },
+	{ "fhmkdirat", FILESERVER_CAP_NAMESPACE },
+	{ "fhsymlinkat", FILESERVER_CAP_NAMESPACE },
+	{ "fhmknodat", FILESERVER_CAP_NAMESPACE },
+	{ "fhopenat", FILESERVER_CAP_NAMESPACE },
+	{ "fhrenameat", FILESERVER_CAP_NAMESPACE },
+	{ "fhunlinkat", FILESERVER_CAP_NAMESPACE },
+	{ "fhpread", FILESERVER_CAP_IO },
+	{ "fhpwrite", FILESERVER_CAP_IO },
+	{ "fhpreadv", FILESERVER_CAP_IO },
+	{ "fhpwritev", FILESERVER_CAP_IO },
+	{ "fhsendfile", FILESERVER_CAP_SENDFILE },
+	{ "fhcopyrange", FILESERVER_CAP_COPYRANGE },
+	{ "fhseek", FILESERVER_CAP_SPACE },
+	{ "fhallocate", FILESERVER_CAP_SPACE },
+	{ "fhdeallocate", FILESERVER_CAP_SPACE },
+	{ "fhadvise", FILESERVER_CAP_SPACE },
+	{ "fhcommit", FILESERVER_CAP_COMMIT },
+	{ "fhgetattrs", FILESERVER_CAP_GETATTRS },
+};
+
+struct fileserver_caps fileserver_caps;
+
+static int
+fileserver_offset(const char *name)
+{
+	struct module_stat stat;
+	int modid;
+
+	modid = modfind(name);
+	if (modid == -1)
+		return (-1);
+	stat.version = sizeof(stat);
+	if (modstat(modid, &stat) == -1)
+		return (-1);
+	return (stat.data.intval);
+}
+
+/*
+ * Without the fileserver kld, fc_version is 0 and the flags only tell
+ * which groups of syscalls are complete.
+ */
+static void
+fileserver_getcaps_standalone(struct fileserver_caps *caps)
+{
+	uint64_t present, missing;
+	int i;
+
+	caps->fc_version = 0;
+	caps->fc_nsyscalls = FILESERVER_NSYSCALLS;
+	present = missing = 0;
+	for (i = 0; i < FILESERVER_NSYSCALLS; i++) {
+		caps->fc_syscalls[i] =
+		    fileserver_offset(fileserver_syscalls[i].name);
+		if (caps->fc_syscalls[i] != -1)
+			present |= fileserver_syscalls[i].cap;
+		else
+			missing |= fileserver_syscalls[i].cap;
+	}
+	caps->fc_flags = present & ~missing;
+	if (modfind("syscallstat") != -1)
+		caps->fc_flags |= FILESERVER_CAP_STATS;
+}
+
+/*
+ * Look up the syscall numbers, from the fileserver kld in one syscall
+ * when it is loaded.  Returns -1 with errno set to ENOENT when none of
+ * the syscalls is there.
+ */
+int
+fileserver_init(void)
+{
+	struct fileserver_caps caps;
+	int i, offset;
+
+	for (i = 0; i < FILESERVER_NSYSCALLS; i++)
+		caps.fc_syscalls[i] = -1;
+
+	offset = fileserver_offset("fileservercaps");
+	if (offset != -1) {
+		if (syscall(offset, &caps, sizeof(caps)) == -1)
+			return (-1);
+		/* An older kld leaves the entries it does not know at -1. */
+		caps.fc_nsyscalls = MIN(caps.fc_nsyscalls,
+		    FILESERVER_NSYSCALLS);
+	} else
+		fileserver_getcaps_standalone(&caps);
+
+	for (i = 0; i < FILESERVER_NSYSCALLS; i++)
+		if (caps.fc_syscalls[i] != -1)
+			break;
+	if (i == FILESERVER_NSYSCALLS) {
+		errno = ENOENT;
+		return (-1);
+	}
+
+	memcpy(&fileserver_caps, &caps, sizeof(caps));
+	return (0);
+}
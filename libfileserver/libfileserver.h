@@ -0,0 +1,367 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#ifndef _LIBFILESERVER_H_
+#define	_LIBFILESERVER_H_
+
+#include <sys/types.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "fileserver.h"
+
+/*
+ * Wrappers for the syscalls of the fileserver kld, or of the standalone
+ * modules, dispatching through the numbers fileserver_init() looked up
+ * once.  fileserver_init() must be called before starting any thread
+ * using them; a wrapper for a syscall which is not loaded fails with
+ * ENOSYS, fileserver_has() tells beforehand whether an optional path
+ * (FILESERVER_CAP_*) can be used.  The structures and flags they take
+ * are in fileserver.h, shared with the kernel.
+ */
+
+extern struct fileserver_caps fileserver_caps;
+
+int	fileserver_init(void);
+
+/* Offset 0 is the indirect syscall, never one of ours. */
+#define	FILESERVER_CALL(sys, ...)					\
+	(fileserver_caps.fc_syscalls[(sys)] > 0 ?			\
+	    syscall(fileserver_caps.fc_syscalls[(sys)], __VA_ARGS__) :	\
+	    (errno = ENOSYS, -1))
+
+/* Same for the syscalls returning a size or an offset. */
+#define	FILESERVER_CALLQ(sys, ...)					\
+	(fileserver_caps.fc_syscalls[(sys)] > 0 ?			\
+	    __syscall((quad_t)fileserver_caps.fc_syscalls[(sys)],	\
+	    __VA_ARGS__) : (errno = ENOSYS, -1))
+
+static __inline int
+fileserver_has(uint64_t caps)
+{
+
+	return ((fileserver_caps.fc_flags & caps) == caps);
+}
+
+static __inline int
+fileserver_getfhat(int fd, const char *path, fhandle_t *fhp, int flag)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_GETFHAT, fd, path, fhp,
+	    flag));
+}
+
+static __inline int
+fileserver_getfhstatat(int fd, const char *path, fhandle_t *fhp, int flag,
+    struct stat *sb, int mask)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_GETFHSTATAT, fd, path, fhp,
+	    flag, sb, mask));
+}
+
+static __inline int
+fileserver_fhlink(fhandle_t *fhp, int tofd, const char *to)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHLINK, fhp, tofd, to));
+}
+
+static __inline int
+fileserver_fhlinkat(fhandle_t *fhp, fhandle_t *todfhp, const char *to)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHLINKAT, fhp, todfhp, to));
+}
+
+static __inline ssize_t
+fileserver_fhreadlink(fhandle_t *fhp, char *buf, size_t bufsize)
+{
+
+	return (FILESERVER_CALLQ(FILESERVER_SYS_FHREADLINK, fhp, buf,
+	    bufsize));
+}
+
+static __inline int
+fileserver_setthreaduid(uid_t uid)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_SETTHREADUID, uid));
+}
+
+static __inline int
+fileserver_setthreadgid(gid_t gid)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_SETTHREADGID, gid));
+}
+
+static __inline int
+fileserver_setthreadgroups(u_int gidsetsize, const gid_t *gidset)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_SETTHREADGROUPS, gidsetsize,
+	    gidset));
+}
+
+static __inline int
+fileserver_setthreadcred(uid_t uid, gid_t gid, u_int gidsetsize,
+    const gid_t *gidset)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_SETTHREADCRED, uid, gid,
+	    gidsetsize, gidset));
+}
+
+static __inline int
+fileserver_pushthreadcred(uid_t uid, gid_t gid, u_int gidsetsize,
+    const gid_t *gidset)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_PUSHTHREADCRED, uid, gid,
+	    gidsetsize, gidset));
+}
+
+static __inline int
+fileserver_popthreadcred(void)
+{
+
+	if (fileserver_caps.fc_syscalls[FILESERVER_SYS_POPTHREADCRED] <= 0) {
+		errno = ENOSYS;
+		return (-1);
+	}
+	return (syscall(fileserver_caps.fc_syscalls[
+	    FILESERVER_SYS_POPTHREADCRED]));
+}
+
+static __inline int
+fileserver_credtoken_register(uid_t uid, gid_t gid, u_int gidsetsize,
+    const gid_t *gidset)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_CREDTOKEN_REGISTER, uid, gid,
+	    gidsetsize, gidset));
+}
+
+static __inline int
+fileserver_credtoken_unregister(int token)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_CREDTOKEN_UNREGISTER, token));
+}
+
+static __inline int
+fileserver_setthreadtoken(int token)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_SETTHREADTOKEN, token));
+}
+
+static __inline int
+fileserver_fhbatch(struct fhbatch_op *ops, u_int nops)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHBATCH, ops, nops));
+}
+
+static __inline ssize_t
+fileserver_fhreaddirplus(fhandle_t *fhp, off_t *cookiep, char *buf,
+    size_t bufsize)
+{
+
+	return (FILESERVER_CALLQ(FILESERVER_SYS_FHREADDIRPLUS, fhp, cookiep,
+	    buf, bufsize));
+}
+
+static __inline int
+fileserver_fhlookupat(fhandle_t *dfhp, const char *name, fhandle_t *fhp,
+    struct stat *sb)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHLOOKUPAT, dfhp, name, fhp,
+	    sb));
+}
+
+static __inline int
+fileserver_fhmkdirat(fhandle_t *dfhp, const char *name, mode_t mode,
+    fhandle_t *fhp, struct stat *sb)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHMKDIRAT, dfhp, name, mode,
+	    fhp, sb));
+}
+
+static __inline int
+fileserver_fhsymlinkat(const char *target, fhandle_t *dfhp,
+    const char *name, fhandle_t *fhp, struct stat *sb)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHSYMLINKAT, target, dfhp,
+	    name, fhp, sb));
+}
+
+static __inline int
+fileserver_fhmknodat(fhandle_t *dfhp, const char *name, mode_t mode,
+    dev_t dev, fhandle_t *fhp, struct stat *sb)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHMKNODAT, dfhp, name, mode,
+	    dev, fhp, sb));
+}
+
+static __inline int
+fileserver_fhopenat(fhandle_t *dfhp, const char *name, int flags, int mode,
+    fhandle_t *fhp, struct stat *sb, int *createdp)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHOPENAT, dfhp, name, flags,
+	    mode, fhp, sb, createdp));
+}
+
+static __inline int
+fileserver_fhrenameat(fhandle_t *fromdfhp, const char *from,
+    fhandle_t *todfhp, const char *to)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHRENAMEAT, fromdfhp, from,
+	    todfhp, to));
+}
+
+static __inline int
+fileserver_fhunlinkat(fhandle_t *dfhp, const char *name, int flag)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHUNLINKAT, dfhp, name, flag));
+}
+
+static __inline ssize_t
+fileserver_fhpread(fhandle_t *fhp, void *buf, size_t nbyte, off_t offset,
+    int flags)
+{
+
+	return (FILESERVER_CALLQ(FILESERVER_SYS_FHPREAD, fhp, buf, nbyte,
+	    offset, flags));
+}
+
+static __inline ssize_t
+fileserver_fhpwrite(fhandle_t *fhp, const void *buf, size_t nbyte,
+    off_t offset, int flags)
+{
+
+	return (FILESERVER_CALLQ(FILESERVER_SYS_FHPWRITE, fhp, buf, nbyte,
+	    offset, flags));
+}
+
+static __inline ssize_t
+fileserver_fhpreadv(fhandle_t *fhp, const struct iovec *iov, u_int iovcnt,
+    off_t offset, int flags)
+{
+
+	return (FILESERVER_CALLQ(FILESERVER_SYS_FHPREADV, fhp, iov, iovcnt,
+	    offset, flags));
+}
+
+static __inline ssize_t
+fileserver_fhpwritev(fhandle_t *fhp, const struct iovec *iov, u_int iovcnt,
+    off_t offset, int flags)
+{
+
+	return (FILESERVER_CALLQ(FILESERVER_SYS_FHPWRITEV, fhp, iov, iovcnt,
+	    offset, flags));
+}
+
+static __inline int
+fileserver_fhsendfile(fhandle_t *fhp, off_t offset, size_t nbytes, int s,
+    const struct iovec *hdrp, int hdrcnt, off_t *sbytes, int flags)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHSENDFILE, fhp, offset,
+	    nbytes, s, hdrp, hdrcnt, sbytes, flags));
+}
+
+static __inline ssize_t
+fileserver_fhcopyrange(fhandle_t *infhp, off_t *inoffp, fhandle_t *outfhp,
+    off_t *outoffp, size_t len, u_int flags)
+{
+
+	return (FILESERVER_CALLQ(FILESERVER_SYS_FHCOPYRANGE, infhp, inoffp,
+	    outfhp, outoffp, len, flags));
+}
+
+static __inline int
+fileserver_fhseek(fhandle_t *fhp, off_t offset, int whence, off_t *resp)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHSEEK, fhp, offset, whence,
+	    resp));
+}
+
+static __inline int
+fileserver_fhallocate(fhandle_t *fhp, off_t offset, off_t len)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHALLOCATE, fhp, offset, len));
+}
+
+static __inline int
+fileserver_fhdeallocate(fhandle_t *fhp, off_t offset, off_t len)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHDEALLOCATE, fhp, offset,
+	    len));
+}
+
+static __inline int
+fileserver_fhadvise(fhandle_t *fhp, off_t offset, off_t len, int advice)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHADVISE, fhp, offset, len,
+	    advice));
+}
+
+static __inline int
+fileserver_fhcommit(struct fhcommit_op *ops, u_int nops)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHCOMMIT, ops, nops));
+}
+
+static __inline int
+fileserver_fhgetattrs(fhandle_t *fhp, u_int mask, struct fhattrs *attrp)
+{
+
+	return (FILESERVER_CALL(FILESERVER_SYS_FHGETATTRS, fhp, mask,
+	    attrp));
+}
+
+#endif /* !_LIBFILESERVER_H_ */
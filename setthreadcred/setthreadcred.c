@@ -0,0 +1,517 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * Copyright (c) 1999 Assar Westerlund
+ * Copyright (c) 1982, 1986, 1989, 1990, 1991, 1993
+ *	The Regents of the University of California.
+ * (c) UNIX System Laboratories, Inc.
+ * Copyright (c) 2000-2001 Robert N. M. Watson.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/sysproto.h>
+#include <sys/sysent.h>
+#include <sys/eventhandler.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/priv.h>
+#include <sys/resourcevar.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/osd.h>
+#include <sys/sdt.h>
+
+#include <security/audit/audit.h>
+
+#include "credintern.h"
+#include "groupsort.h"
+#include "syscallstat.h"
+
+/*
+ * Each argument takes a full register, pad the ones smaller than that
+ * the way sysproto.h does.
+ */
+struct setthreadcred_args {
+	char	uid_l_[PADL_(uid_t)]; uid_t uid; char uid_r_[PADR_(uid_t)];
+	char	gid_l_[PADL_(gid_t)]; gid_t gid; char gid_r_[PADR_(gid_t)];
+	char	gidsetsize_l_[PADL_(u_int)]; u_int gidsetsize; char gidsetsize_r_[PADR_(u_int)];
+	char	gidset_l_[PADL_(gid_t *)]; gid_t *gidset; char gidset_r_[PADR_(gid_t *)];
+};
+
+int sys_setthreadcred(struct thread *td, void *params);
+int sys_pushthreadcred(struct thread *td, void *params);
+int sys_popthreadcred(struct thread *td, void *params);
+
+static struct syscallstat *setthreadcred_stats;
+static struct syscallstat *pushthreadcred_stats;
+static struct syscallstat *popthreadcred_stats;
+
+#define	SETTHREADCRED_PHASE_INTERN	0
+#define	SETTHREADCRED_PHASE_CRCOPY	1
+
+static const char * const setthreadcred_phases[] = { "intern", "crcopy" };
+
+/*
+ * The group counts include the egid, popthreadcred:::entry gives the
+ * one of the credential being dropped.  setthreadcred:::groupsort is
+ * only timed while some SDT probe is enabled.
+ */
+SDT_PROVIDER_DEFINE(setthreadcred);
+SDT_PROBE_DEFINE3(setthreadcred, , setthreadcred, entry, "uid_t", "gid_t",
+    "u_int");
+SDT_PROBE_DEFINE2(setthreadcred, , setthreadcred, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(setthreadcred, , pushthreadcred, entry, "uid_t", "gid_t",
+    "u_int");
+SDT_PROBE_DEFINE2(setthreadcred, , pushthreadcred, return, "int",
+    "int64_t");
+SDT_PROBE_DEFINE1(setthreadcred, , popthreadcred, entry, "int");
+SDT_PROBE_DEFINE2(setthreadcred, , popthreadcred, return, "int", "int64_t");
+SDT_PROBE_DEFINE2(setthreadcred, , , groupsort, "int", "int64_t");
+SDT_PROBE_DEFINE3(setthreadcred, , , intern, "int", "int", "int64_t");
+SDT_PROBE_DEFINE2(setthreadcred, , , crcopy, "int", "int64_t");
+
+/*
+ * Credentials saved by pushthreadcred, kept in the thread OSD so they
+ * are released when the thread exits.  Each one goes with the process
+ * credential at the time of the push, a saved credential is only given
+ * back while the process still runs with that one.
+ */
+#define	THREADCRED_DEPTH	8
+
+struct threadcred_stack {
+	int		tcs_depth;
+	struct ucred	*tcs_creds[THREADCRED_DEPTH];
+	struct ucred	*tcs_proccreds[THREADCRED_DEPTH];
+};
+
+static MALLOC_DEFINE(M_THREADCRED, "threadcred", "saved thread credentials");
+
+static u_int threadcred_slot;
+static eventhandler_tag threadcred_exec_tag;
+
+/*
+ * Release every saved credential.
+ */
+static void
+threadcred_stack_flush(struct threadcred_stack *tcs)
+{
+
+	while (tcs->tcs_depth > 0) {
+		tcs->tcs_depth--;
+		crfree(tcs->tcs_creds[tcs->tcs_depth]);
+		crfree(tcs->tcs_proccreds[tcs->tcs_depth]);
+	}
+}
+
+/*
+ * Install egid in cr_groups[0] and the supplementary groups after it,
+ * unlike setgroups(2) where the caller provides cr_groups[0] itself.
+ * The groups must already be sorted.
+ */
+static void
+crsetgroups_locked(struct ucred *cr, gid_t egid, int ngrp, gid_t *groups)
+{
+
+	KASSERT(cr->cr_agroups >= ngrp + 1, ("cr_ngroups is too small"));
+
+	cr->cr_groups[0] = egid;
+	bcopy(groups, &cr->cr_groups[1], ngrp * sizeof(gid_t));
+	cr->cr_ngroups = ngrp + 1;
+}
+
+/*
+ * Same as setthreaduid, setthreadgid and setthreadgroups in a row, but
+ * with a single ucred allocation and copy.  All privilege checks are
+ * done against the current credential before anything is allocated.
+ */
+static int
+kern_setthreadcred(struct thread *td, uid_t euid, gid_t egid, u_int ngrp,
+    gid_t *groups, struct syscallstat *ss)
+{
+	struct credintern_key key;
+	struct ucred *newcred, *oldcred;
+	sbintime_t t;
+	struct uidinfo *euip;
+	int error;
+
+	MPASS(ngrp <= ngroups_max);
+	AUDIT_ARG_EUID(euid);
+	AUDIT_ARG_EGID(egid);
+	AUDIT_ARG_GROUPSET(groups, ngrp);
+
+	oldcred = td->td_ucred;
+
+#ifdef MAC
+	error = mac_cred_check_seteuid(oldcred, euid);
+	if (error)
+		return (error);
+	error = mac_cred_check_setegid(oldcred, egid);
+	if (error)
+		return (error);
+	error = mac_cred_check_setgroups(oldcred, ngrp, groups);
+	if (error)
+		return (error);
+#endif
+
+	/* code taken from seteuid, setegid and setgroups */
+	if (euid != oldcred->cr_ruid &&		/* allow seteuid(getuid()) */
+	    euid != oldcred->cr_svuid &&	/* allow seteuid(saved uid) */
+	    (error = priv_check_cred(oldcred, PRIV_CRED_SETEUID, 0)) != 0)
+		return (error);
+	if (egid != oldcred->cr_rgid &&		/* allow setegid(getgid()) */
+	    egid != oldcred->cr_svgid &&	/* allow setegid(saved gid) */
+	    (error = priv_check_cred(oldcred, PRIV_CRED_SETEGID, 0)) != 0)
+		return (error);
+	error = priv_check_cred(oldcred, PRIV_CRED_SETGROUPS, 0);
+	if (error)
+		return (error);
+
+	/*
+	 * Everything's okay, do it.  Sorting the groups first allows
+	 * groupmember to perform a binary search, and to compare them
+	 * with the interned credentials.
+	 */
+	t = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+	groupsort(groups, ngrp);
+	SDT_PROBE2(setthreadcred, , , groupsort, ngrp + 1,
+	    syscallstat_elapsed(t));
+	credintern_key_init(&key, oldcred);
+	key.cik_uid = euid;
+	key.cik_gid = egid;
+	key.cik_ngroups = ngrp;
+	key.cik_groups = groups;
+	t = syscallstat_start();
+	newcred = credintern_find(&key);
+	syscallstat_phase(ss, SETTHREADCRED_PHASE_INTERN, t);
+	SDT_PROBE3(setthreadcred, , , intern, ngrp + 1, newcred != NULL,
+	    syscallstat_elapsed(t));
+	if (newcred == NULL) {
+		t = syscallstat_start();
+		newcred = crget();
+		crextend(newcred, ngrp + 1);
+		euip = uifind(euid);
+		crcopy(newcred, oldcred);
+
+		if (oldcred->cr_uid != euid)
+			change_euid(newcred, euip);
+		crsetgroups_locked(newcred, egid, ngrp, groups);
+		uifree(euip);
+		newcred = credintern_insert(newcred);
+		syscallstat_phase(ss, SETTHREADCRED_PHASE_CRCOPY, t);
+		SDT_PROBE2(setthreadcred, , , crcopy, ngrp + 1,
+		    syscallstat_elapsed(t));
+	}
+
+	/* Nothing to switch if the thread already runs with it. */
+	if (newcred == oldcred) {
+		crfree(newcred);
+		return (0);
+	}
+	td->td_ucred = newcred;
+	crfree(oldcred);
+	return (0);
+}
+
+/*
+ * Copy the groups vector in and switch to the new credential.
+ */
+static int
+user_setthreadcred(struct thread *td, uid_t euid, gid_t egid,
+    u_int gidsetsize, gid_t *gidset, struct syscallstat *ss)
+{
+	gid_t smallgroups[XU_NGROUPS];
+	gid_t *groups;
+	int error;
+
+	/* cr_groups[0] is reserved for the egid */
+	if (gidsetsize > ngroups_max)
+		return (EINVAL);
+
+	if (gidsetsize > XU_NGROUPS)
+		groups = malloc(gidsetsize * sizeof(gid_t), M_TEMP, M_WAITOK);
+	else
+		groups = smallgroups;
+
+	error = copyin(gidset, groups, gidsetsize * sizeof(gid_t));
+	if (error == 0)
+		error = kern_setthreadcred(td, euid, egid, gidsetsize, groups,
+		    ss);
+
+	if (gidsetsize > XU_NGROUPS)
+		free(groups, M_TEMP);
+	return (error);
+}
+
+/*
+ * The function for implementing the syscall.
+ */
+int sys_setthreadcred(struct thread *td, void *params)
+{
+	struct setthreadcred_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct setthreadcred_args*)params;
+
+	SDT_PROBE3(setthreadcred, , setthreadcred, entry, uap->uid, uap->gid,
+	    uap->gidsetsize);
+	start = syscallstat_start();
+	error = user_setthreadcred(td, uap->uid, uap->gid, uap->gidsetsize,
+	    uap->gidset, setthreadcred_stats);
+	syscallstat_end(setthreadcred_stats, start, error);
+	SDT_PROBE2(setthreadcred, , setthreadcred, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * Save the current credential on the per-thread stack, then switch
+ * like setthreadcred.  The saved reference is kept as is so popping it
+ * is a pointer swap, with no copy and no privilege check: the thread
+ * only gets back a credential it already had, under the same process
+ * credential.
+ */
+static int
+kern_pushthreadcred(struct thread *td, struct setthreadcred_args *uap)
+{
+	struct threadcred_stack *tcs;
+	struct ucred *savedcred;
+	int error;
+
+	tcs = osd_thread_get(td, threadcred_slot);
+	if (tcs == NULL) {
+		tcs = malloc(sizeof(*tcs), M_THREADCRED, M_WAITOK | M_ZERO);
+		error = osd_thread_set(td, threadcred_slot, tcs);
+		if (error != 0) {
+			free(tcs, M_THREADCRED);
+			return (error);
+		}
+	}
+	if (tcs->tcs_depth == THREADCRED_DEPTH)
+		return (ENOSPC);
+
+	savedcred = crhold(td->td_ucred);
+	error = user_setthreadcred(td, uap->uid, uap->gid, uap->gidsetsize,
+	    uap->gidset, pushthreadcred_stats);
+	if (error != 0) {
+		crfree(savedcred);
+		return (error);
+	}
+	PROC_LOCK(td->td_proc);
+	tcs->tcs_proccreds[tcs->tcs_depth] = crhold(td->td_proc->p_ucred);
+	PROC_UNLOCK(td->td_proc);
+	tcs->tcs_creds[tcs->tcs_depth++] = savedcred;
+	return (0);
+}
+
+int sys_pushthreadcred(struct thread *td, void *params)
+{
+	struct setthreadcred_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct setthreadcred_args*)params;
+
+	SDT_PROBE3(setthreadcred, , pushthreadcred, entry, uap->uid, uap->gid,
+	    uap->gidsetsize);
+	start = syscallstat_start();
+	error = kern_pushthreadcred(td, uap);
+	syscallstat_end(pushthreadcred_stats, start, error);
+	SDT_PROBE2(setthreadcred, , pushthreadcred, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * Restore the credential saved by the last pushthreadcred.  If the
+ * process credential changed since the push (setuid, jail_attach...)
+ * the saved ones are stale: drop them all and fail.
+ */
+static int
+kern_popthreadcred(struct thread *td)
+{
+	struct threadcred_stack *tcs;
+	struct ucred *oldcred;
+	struct proc *p;
+	bool changed;
+
+	tcs = osd_thread_get(td, threadcred_slot);
+	if (tcs == NULL || tcs->tcs_depth == 0)
+		return (EINVAL);
+
+	p = td->td_proc;
+	PROC_LOCK(p);
+	changed = p->p_ucred != tcs->tcs_proccreds[tcs->tcs_depth - 1];
+	PROC_UNLOCK(p);
+	if (changed) {
+		threadcred_stack_flush(tcs);
+		return (EPERM);
+	}
+
+	oldcred = td->td_ucred;
+	tcs->tcs_depth--;
+	td->td_ucred = tcs->tcs_creds[tcs->tcs_depth];
+	crfree(tcs->tcs_proccreds[tcs->tcs_depth]);
+	crfree(oldcred);
+	return (0);
+}
+
+int sys_popthreadcred(struct thread *td, void *params __unused)
+{
+	sbintime_t start;
+	int error;
+
+	SDT_PROBE1(setthreadcred, , popthreadcred, entry,
+	    td->td_ucred->cr_ngroups);
+	start = syscallstat_start();
+	error = kern_popthreadcred(td);
+	syscallstat_end(popthreadcred_stats, start, error);
+	SDT_PROBE2(setthreadcred, , popthreadcred, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+/*
+ * Called at thread exit, or for every thread at unload.
+ */
+static void
+threadcred_stack_free(void *value)
+{
+	struct threadcred_stack *tcs;
+
+	tcs = value;
+	threadcred_stack_flush(tcs);
+	free(tcs, M_THREADCRED);
+}
+
+/*
+ * The new image must not pop back to credentials of the old one.  Only
+ * the thread calling exec is left at this point.
+ */
+static void
+threadcred_exec(void *arg __unused, struct proc *p __unused,
+    struct image_params *imgp __unused)
+{
+	struct threadcred_stack *tcs;
+
+	tcs = osd_thread_get(curthread, threadcred_slot);
+	if (tcs != NULL)
+		threadcred_stack_flush(tcs);
+}
+
+static void
+threadcred_init(void *arg __unused)
+{
+
+	threadcred_slot = osd_thread_register(threadcred_stack_free);
+	threadcred_exec_tag = EVENTHANDLER_REGISTER(process_exec,
+	    threadcred_exec, NULL, EVENTHANDLER_PRI_ANY);
+	setthreadcred_stats = syscallstat_register("setthreadcred",
+	    setthreadcred_phases, nitems(setthreadcred_phases));
+	pushthreadcred_stats = syscallstat_register("pushthreadcred",
+	    setthreadcred_phases, nitems(setthreadcred_phases));
+	popthreadcred_stats = syscallstat_register("popthreadcred", NULL, 0);
+}
+SYSINIT(threadcred, SI_SUB_SYSCALLS, SI_ORDER_FIRST, threadcred_init, NULL);
+
+static void
+threadcred_uninit(void *arg __unused)
+{
+
+	EVENTHANDLER_DEREGISTER(process_exec, threadcred_exec_tag);
+	osd_thread_deregister(threadcred_slot);
+	syscallstat_deregister(setthreadcred_stats);
+	syscallstat_deregister(pushthreadcred_stats);
+	syscallstat_deregister(popthreadcred_stats);
+}
+SYSUNINIT(threadcred, SI_SUB_SYSCALLS, SI_ORDER_FIRST, threadcred_uninit,
+    NULL);
+
+/*
+ * The `sysent's for the new syscalls
+ */
+static struct sysent setthreadcred_sysent = {
+	4,			/* sy_narg */
+	sys_setthreadcred	/* sy_call */
+};
+
+static struct sysent pushthreadcred_sysent = {
+	4,			/* sy_narg */
+	sys_pushthreadcred	/* sy_call */
+};
+
+static struct sysent popthreadcred_sysent = {
+	0,			/* sy_narg */
+	sys_popthreadcred	/* sy_call */
+};
+
+/*
+ * The offsets in sysent where the syscalls are allocated.
+ */
+static int setthreadcred_offset = NO_SYSCALL;
+static int pushthreadcred_offset = NO_SYSCALL;
+static int popthreadcred_offset = NO_SYSCALL;
+
+/*
+ * The function called at load/unload, arg points to the offset.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("%s syscall loaded at %d\n", module_getname(module),
+		    *(int *)arg);
+		break;
+	case MOD_UNLOAD :
+		printf("%s syscall unloaded from %d\n", module_getname(module),
+		    *(int *)arg);
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+SYSCALL_MODULE(setthreadcred, &setthreadcred_offset, &setthreadcred_sysent,
+    load, &setthreadcred_offset);
+SYSCALL_MODULE(pushthreadcred, &pushthreadcred_offset,
+    &pushthreadcred_sysent, load, &pushthreadcred_offset);
+SYSCALL_MODULE(popthreadcred, &popthreadcred_offset, &popthreadcred_sysent,
+    load, &popthreadcred_offset);
+MODULE_DEPEND(setthreadcred, credintern, 1, 1, 1);
+MODULE_DEPEND(setthreadcred, syscallstat, 1, 1, 1);
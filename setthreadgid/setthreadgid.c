@@ -45,62 +45,126 @@
 #include <sys/systm.h>
 #include <sys/priv.h>
 #include <sys/resourcevar.h>
+#include <sys/sdt.h>
 
 #include <security/audit/audit.h>
 
+#include "credintern.h"
+#include "syscallstat.h"
+
 struct setthreadgid_args {
 	gid_t	gid;
 };
 
 int sys_setthreadgid(struct thread *td, void *params);
 
-/*
- * The function for implementing the syscall.
- */
-int sys_setthreadgid(struct thread *td, void *params)
+static struct syscallstat *setthreadgid_stats;
+
+#define	SETTHREADGID_PHASE_INTERN	0
+#define	SETTHREADGID_PHASE_CRCOPY	1
+
+static const char * const setthreadgid_phases[] = { "intern", "crcopy" };
+
+SDT_PROVIDER_DEFINE(setthreadgid);
+SDT_PROBE_DEFINE1(setthreadgid, , setthreadgid, entry, "gid_t");
+SDT_PROBE_DEFINE2(setthreadgid, , setthreadgid, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(setthreadgid, , , intern, "int", "int", "int64_t");
+SDT_PROBE_DEFINE2(setthreadgid, , , crcopy, "int", "int64_t");
+
+static int
+kern_setthreadgid(struct thread *td, struct setthreadgid_args *uap)
 {
-	struct setthreadgid_args *uap;
+	struct credintern_key key;
 	struct ucred *newcred, *oldcred;
+	sbintime_t t;
 	gid_t egid;
 	int error;
 
-	uap = (struct setthreadgid_args*)params;
 	egid = uap->gid;
 
 	/* code taken from setegid */
 
 	AUDIT_ARG_EGID(egid);
-	newcred = crget();
-
 	oldcred = td->td_ucred;
-	crcopy(newcred, oldcred);
 
 #ifdef MAC
 	error = mac_cred_check_setegid(oldcred, egid);
 	if (error)
-		goto fail;
+		return (error);
 #endif
 
 	if (egid != oldcred->cr_rgid &&		/* allow setegid(getgid()) */
 	    egid != oldcred->cr_svgid &&	/* allow setegid(saved gid) */
 	    (error = priv_check_cred(oldcred, PRIV_CRED_SETEGID, 0)) != 0)
-		goto fail;
+		return (error);
 
 	/*
 	 * Everything's okay, do it.
 	 */
-	if (oldcred->cr_groups[0] != egid) {
+	if (oldcred->cr_groups[0] == egid)
+		return (0);
+
+	credintern_key_init(&key, oldcred);
+	key.cik_gid = egid;
+	t = syscallstat_start();
+	newcred = credintern_find(&key);
+	syscallstat_phase(setthreadgid_stats, SETTHREADGID_PHASE_INTERN, t);
+	SDT_PROBE3(setthreadgid, , , intern, oldcred->cr_ngroups,
+	    newcred != NULL, syscallstat_elapsed(t));
+	if (newcred == NULL) {
+		t = syscallstat_start();
+		newcred = crget();
+		crcopy(newcred, oldcred);
 		change_egid(newcred, egid);
+		newcred = credintern_insert(newcred);
+		syscallstat_phase(setthreadgid_stats,
+		    SETTHREADGID_PHASE_CRCOPY, t);
+		SDT_PROBE2(setthreadgid, , , crcopy, oldcred->cr_ngroups,
+		    syscallstat_elapsed(t));
 	}
 	td->td_ucred = newcred;
 	crfree(oldcred);
 	return (0);
+}
+
+/*
+ * The function for implementing the syscall.
+ */
+int sys_setthreadgid(struct thread *td, void *params)
+{
+	struct setthreadgid_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct setthreadgid_args*)params;
 
-fail:
-	crfree(newcred);
+	SDT_PROBE1(setthreadgid, , setthreadgid, entry, uap->gid);
+	start = syscallstat_start();
+	error = kern_setthreadgid(td, uap);
+	syscallstat_end(setthreadgid_stats, start, error);
+	SDT_PROBE2(setthreadgid, , setthreadgid, return, error,
+	    syscallstat_elapsed(start));
 	return (error);
 }
 
+static void
+setthreadgid_init(void *arg __unused)
+{
+
+	setthreadgid_stats = syscallstat_register("setthreadgid",
+	    setthreadgid_phases, nitems(setthreadgid_phases));
+}
+SYSINIT(setthreadgid, SI_SUB_SYSCALLS, SI_ORDER_FIRST, setthreadgid_init, NULL);
+
+static void
+setthreadgid_uninit(void *arg __unused)
+{
+
+	syscallstat_deregister(setthreadgid_stats);
+}
+SYSUNINIT(setthreadgid, SI_SUB_SYSCALLS, SI_ORDER_FIRST, setthreadgid_uninit,
+    NULL);
+
 /*
  * The `sysent' for the new syscall
  */
@@ -137,3 +201,5 @@ load(struct module *module, int cmd, void *arg)
 }
 
 SYSCALL_MODULE(setthreadgid, &offset, &setthreadgid_sysent, load, NULL);
+MODULE_DEPEND(setthreadgid, credintern, 1, 1, 1);
+MODULE_DEPEND(setthreadgid, syscallstat, 1, 1, 1);
@@ -46,9 +46,14 @@
 #include <sys/priv.h>
 #include <sys/resourcevar.h>
 #include <sys/lock.h>
+#include <sys/sdt.h>
 
 #include <security/audit/audit.h>
 
+#include "credintern.h"
+#include "groupsort.h"
+#include "syscallstat.h"
+
 struct setthreadgroups_args {
 	u_int	gidsetsize;
 	gid_t	*gidset;
@@ -56,12 +61,29 @@ struct setthreadgroups_args {
 
 int sys_setthreadgroups(struct thread *td, void *params);
 
+static struct syscallstat *setthreadgroups_stats;
+
+#define	SETTHREADGROUPS_PHASE_INTERN	0
+#define	SETTHREADGROUPS_PHASE_CRCOPY	1
+
+static const char * const setthreadgroups_phases[] = { "intern", "crcopy" };
+
+/*
+ * setthreadgroups:::groupsort is only timed while some SDT probe is
+ * enabled, the other phases reuse the syscallstat timestamps.
+ */
+SDT_PROVIDER_DEFINE(setthreadgroups);
+SDT_PROBE_DEFINE2(setthreadgroups, , setthreadgroups, entry, "u_int",
+    "gid_t *");
+SDT_PROBE_DEFINE2(setthreadgroups, , setthreadgroups, return, "int",
+    "int64_t");
+SDT_PROBE_DEFINE2(setthreadgroups, , , groupsort, "int", "int64_t");
+SDT_PROBE_DEFINE3(setthreadgroups, , , intern, "int", "int", "int64_t");
+SDT_PROBE_DEFINE2(setthreadgroups, , , crcopy, "int", "int64_t");
+
 static void
 crsetgroups_locked(struct ucred *cr, int ngrp, gid_t *groups)
 {
-	int i;
-	int j;
-	gid_t g;
 	
 	KASSERT(cr->cr_agroups >= ngrp, ("cr_ngroups is too small"));
 
@@ -70,77 +92,102 @@ crsetgroups_locked(struct ucred *cr, int ngrp, gid_t *groups)
 
 	/*
 	 * Sort all groups except cr_groups[0] to allow groupmember to
-	 * perform a binary search.
-	 *
-	 * XXX: If large numbers of groups become common this should
-	 * be replaced with shell sort like linux uses or possibly
-	 * heap sort.
+	 * perform a binary search.  The copy from kern_setthreadgroups is
+	 * already sorted, this only checks it.
 	 */
-	for (i = 2; i < ngrp; i++) {
-		g = cr->cr_groups[i];
-		for (j = i-1; j >= 1 && g < cr->cr_groups[j]; j--)
-			cr->cr_groups[j + 1] = cr->cr_groups[j];
-		cr->cr_groups[j + 1] = g;
-	}
+	if (ngrp > 1)
+		groupsort(&cr->cr_groups[1], ngrp - 1);
 }
 
 static int
 kern_setthreadgroups(struct thread *td, u_int ngrp, gid_t *groups)
 {
+	struct credintern_key key;
 	struct ucred *newcred, *oldcred;
+	sbintime_t t;
 	int error;
 
 	MPASS(ngrp <= ngroups_max + 1);
 	AUDIT_ARG_GROUPSET(groups, ngrp);
-	newcred = crget();
-	crextend(newcred, ngrp);
-
 	oldcred = td->td_ucred;
-	crcopy(newcred, oldcred);
 
 #ifdef MAC
 	error = mac_cred_check_setgroups(oldcred, ngrp, groups);
 	if (error)
-		goto fail;
+		return (error);
 #endif
 
 	error = priv_check_cred(oldcred, PRIV_CRED_SETGROUPS, 0);
 	if (error)
-		goto fail;
+		return (error);
 
+	/*
+	 * Sort the caller's copy first so it can be compared with the
+	 * interned credentials, crsetgroups_locked then finds it sorted.
+	 */
+	credintern_key_init(&key, oldcred);
 	if (ngrp == 0) {
-		/*
-		 * setgroups(0, NULL) is a legitimate way of clearing the
-		 * groups vector on non-BSD systems (which generally do not
-		 * have the egid in the groups[0]).  We risk security holes
-		 * when running non-BSD software if we do not do the same.
-		 */
-		newcred->cr_ngroups = 1;
+		key.cik_ngroups = 0;
 	} else {
-		crsetgroups_locked(newcred, ngrp, groups);
+		if (ngrp > 1) {
+			t = SDT_PROBES_ENABLED() ? syscallstat_start() : 0;
+			groupsort(&groups[1], ngrp - 1);
+			SDT_PROBE2(setthreadgroups, , , groupsort, ngrp,
+			    syscallstat_elapsed(t));
+		}
+		key.cik_gid = groups[0];
+		key.cik_ngroups = ngrp - 1;
+		key.cik_groups = &groups[1];
+	}
+	t = syscallstat_start();
+	newcred = credintern_find(&key);
+	syscallstat_phase(setthreadgroups_stats,
+	    SETTHREADGROUPS_PHASE_INTERN, t);
+	SDT_PROBE3(setthreadgroups, , , intern, ngrp, newcred != NULL,
+	    syscallstat_elapsed(t));
+	if (newcred == NULL) {
+		t = syscallstat_start();
+		newcred = crget();
+		crextend(newcred, ngrp);
+		crcopy(newcred, oldcred);
+
+		if (ngrp == 0) {
+			/*
+			 * setgroups(0, NULL) is a legitimate way of clearing
+			 * the groups vector on non-BSD systems (which
+			 * generally do not have the egid in the groups[0]).
+			 * We risk security holes when running non-BSD
+			 * software if we do not do the same.
+			 */
+			newcred->cr_ngroups = 1;
+		} else {
+			crsetgroups_locked(newcred, ngrp, groups);
+		}
+		newcred = credintern_insert(newcred);
+		syscallstat_phase(setthreadgroups_stats,
+		    SETTHREADGROUPS_PHASE_CRCOPY, t);
+		SDT_PROBE2(setthreadgroups, , , crcopy, ngrp,
+		    syscallstat_elapsed(t));
+	}
+
+	/* Nothing to switch if the thread already runs with it. */
+	if (newcred == oldcred) {
+		crfree(newcred);
+		return (0);
 	}
 	td->td_ucred = newcred;
 	crfree(oldcred);
 	return (0);
-
-fail:
-	crfree(newcred);
-	return (error);
 }
 
-/*
- * The function for implementing the syscall.
- */
-int sys_setthreadgroups(struct thread *td, void *params)
+static int
+user_setthreadgroups(struct thread *td, struct setthreadgroups_args *uap)
 {
-	struct setthreadgroups_args *uap;
 	gid_t smallgroups[XU_NGROUPS];
 	gid_t *groups;
 	u_int gidsetsize;
 	int error;
 
-	uap = (struct setthreadgroups_args*)params;
-
 	gidsetsize = uap->gidsetsize;
 	if (gidsetsize > ngroups_max + 1)
 		return (EINVAL);
@@ -160,6 +207,46 @@ int sys_setthreadgroups(struct thread *td, void *params)
 
 }
 
+/*
+ * The function for implementing the syscall.
+ */
+int sys_setthreadgroups(struct thread *td, void *params)
+{
+	struct setthreadgroups_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct setthreadgroups_args*)params;
+
+	SDT_PROBE2(setthreadgroups, , setthreadgroups, entry, uap->gidsetsize,
+	    uap->gidset);
+	start = syscallstat_start();
+	error = user_setthreadgroups(td, uap);
+	syscallstat_end(setthreadgroups_stats, start, error);
+	SDT_PROBE2(setthreadgroups, , setthreadgroups, return, error,
+	    syscallstat_elapsed(start));
+	return (error);
+}
+
+static void
+setthreadgroups_init(void *arg __unused)
+{
+
+	setthreadgroups_stats = syscallstat_register("setthreadgroups",
+	    setthreadgroups_phases, nitems(setthreadgroups_phases));
+}
+SYSINIT(setthreadgroups, SI_SUB_SYSCALLS, SI_ORDER_FIRST, setthreadgroups_init,
+    NULL);
+
+static void
+setthreadgroups_uninit(void *arg __unused)
+{
+
+	syscallstat_deregister(setthreadgroups_stats);
+}
+SYSUNINIT(setthreadgroups, SI_SUB_SYSCALLS, SI_ORDER_FIRST,
+    setthreadgroups_uninit, NULL);
+
 /*
  * The `sysent' for the new syscall
  */
@@ -196,3 +283,5 @@ load(struct module *module, int cmd, void *arg)
 }
 
 SYSCALL_MODULE(setthreadgroups, &offset, &setthreadgroups_sysent, load, NULL);
+MODULE_DEPEND(setthreadgroups, credintern, 1, 1, 1);
+MODULE_DEPEND(setthreadgroups, syscallstat, 1, 1, 1);
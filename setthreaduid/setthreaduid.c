@@ -45,66 +45,129 @@
 #include <sys/systm.h>
 #include <sys/priv.h>
 #include <sys/resourcevar.h>
+#include <sys/sdt.h>
 
 #include <security/audit/audit.h>
 
+#include "credintern.h"
+#include "syscallstat.h"
+
 struct setthreaduid_args {
 	uid_t	uid;
 };
 
 int sys_setthreaduid(struct thread *td, void *params);
 
-/*
- * The function for implementing the syscall.
- */
-int sys_setthreaduid(struct thread *td, void *params)
+static struct syscallstat *setthreaduid_stats;
+
+#define	SETTHREADUID_PHASE_INTERN	0
+#define	SETTHREADUID_PHASE_CRCOPY	1
+
+static const char * const setthreaduid_phases[] = { "intern", "crcopy" };
+
+SDT_PROVIDER_DEFINE(setthreaduid);
+SDT_PROBE_DEFINE1(setthreaduid, , setthreaduid, entry, "uid_t");
+SDT_PROBE_DEFINE2(setthreaduid, , setthreaduid, return, "int", "int64_t");
+SDT_PROBE_DEFINE3(setthreaduid, , , intern, "int", "int", "int64_t");
+SDT_PROBE_DEFINE2(setthreaduid, , , crcopy, "int", "int64_t");
+
+static int
+kern_setthreaduid(struct thread *td, struct setthreaduid_args *uap)
 {
-	struct setthreaduid_args *uap;
+	struct credintern_key key;
 	struct ucred *newcred, *oldcred;
+	sbintime_t t;
 	uid_t euid;
 	struct uidinfo *euip;
 	int error;
 
-	uap = (struct setthreaduid_args*)params;
 	euid = uap->uid;
 
 	/* code taken from seteuid */
 
 	AUDIT_ARG_EUID(euid);
-	newcred = crget();
-        euip = uifind(euid);
-
 	oldcred = td->td_ucred;
-	crcopy(newcred, oldcred);
 
 #ifdef MAC
 	error = mac_cred_check_seteuid(oldcred, euid);
 	if (error)
-		goto fail;
+		return (error);
 #endif
 
 	if (euid != oldcred->cr_ruid &&		/* allow seteuid(getuid()) */
 	    euid != oldcred->cr_svuid &&	/* allow seteuid(saved uid) */
 	    (error = priv_check_cred(oldcred, PRIV_CRED_SETEUID, 0)) != 0)
-		goto fail;
+		return (error);
 
 	/*
 	 * Everything's okay, do it.
 	 */
-	if (oldcred->cr_uid != euid) {
+	if (oldcred->cr_uid == euid)
+		return (0);
+
+	credintern_key_init(&key, oldcred);
+	key.cik_uid = euid;
+	t = syscallstat_start();
+	newcred = credintern_find(&key);
+	syscallstat_phase(setthreaduid_stats, SETTHREADUID_PHASE_INTERN, t);
+	SDT_PROBE3(setthreaduid, , , intern, oldcred->cr_ngroups,
+	    newcred != NULL, syscallstat_elapsed(t));
+	if (newcred == NULL) {
+		t = syscallstat_start();
+		newcred = crget();
+		euip = uifind(euid);
+		crcopy(newcred, oldcred);
 		change_euid(newcred, euip);
+		uifree(euip);
+		newcred = credintern_insert(newcred);
+		syscallstat_phase(setthreaduid_stats,
+		    SETTHREADUID_PHASE_CRCOPY, t);
+		SDT_PROBE2(setthreaduid, , , crcopy, oldcred->cr_ngroups,
+		    syscallstat_elapsed(t));
 	}
 	td->td_ucred = newcred;
-	uifree(euip);
 	crfree(oldcred);
 	return (0);
+}
+
+/*
+ * The function for implementing the syscall.
+ */
+int sys_setthreaduid(struct thread *td, void *params)
+{
+	struct setthreaduid_args *uap;
+	sbintime_t start;
+	int error;
+
+	uap = (struct setthreaduid_args*)params;
 
-fail:
-	uifree(euip);
-	crfree(newcred);
+	SDT_PROBE1(setthreaduid, , setthreaduid, entry, uap->uid);
+	start = syscallstat_start();
+	error = kern_setthreaduid(td, uap);
+	syscallstat_end(setthreaduid_stats, start, error);
+	SDT_PROBE2(setthreaduid, , setthreaduid, return, error,
+	    syscallstat_elapsed(start));
 	return (error);
 }
 
+static void
+setthreaduid_init(void *arg __unused)
+{
+
+	setthreaduid_stats = syscallstat_register("setthreaduid",
+	    setthreaduid_phases, nitems(setthreaduid_phases));
+}
+SYSINIT(setthreaduid, SI_SUB_SYSCALLS, SI_ORDER_FIRST, setthreaduid_init, NULL);
+
+static void
+setthreaduid_uninit(void *arg __unused)
+{
+
+	syscallstat_deregister(setthreaduid_stats);
+}
+SYSUNINIT(setthreaduid, SI_SUB_SYSCALLS, SI_ORDER_FIRST, setthreaduid_uninit,
+    NULL);
+
 /*
  * The `sysent' for the new syscall
  */
@@ -141,3 +204,5 @@ load(struct module *module, int cmd, void *arg)
 }
 
 SYSCALL_MODULE(setthreaduid, &offset, &setthreaduid_sysent, load, NULL);
+MODULE_DEPEND(setthreaduid, credintern, 1, 1, 1);
+MODULE_DEPEND(setthreaduid, syscallstat, 1, 1, 1);
@@ -0,0 +1,347 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/module.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/errno.h>
+#include <sys/lock.h>
+#include <sys/sx.h>
+#include <sys/malloc.h>
+#include <sys/queue.h>
+#include <sys/counter.h>
+#include <sys/sbuf.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
+
+#include "syscallstat.h"
+
+#define	SYSCALLSTAT_NERRORS	(ELAST + 2)	/* the last one for the others */
+
+/*
+ * Index of the counters in ss_ctr.
+ */
+#define	SSC_CALLS		0
+#define	SSC_RETRIES		1
+#define	SSC_ERRORS		2
+#define	SSC_LATENCY		(SSC_ERRORS + SYSCALLSTAT_NERRORS)
+#define	SSC_COUNT							\
+	(SSC_LATENCY + (SYSCALLSTAT_NPHASES + 1) * SYSCALLSTAT_NBUCKETS)
+
+#define	SSC_HIST(phase)		(SSC_LATENCY + (phase) * SYSCALLSTAT_NBUCKETS)
+
+struct syscallstat_ctr {
+	counter_u64_t	ssc_counter;
+	uint64_t	ssc_base;	/* value at the last reset */
+};
+
+struct syscallstat {
+	TAILQ_ENTRY(syscallstat) ss_link;
+	struct sysctl_ctx_list ss_ctx;
+	struct syscallstat_ctr ss_ctr[SSC_COUNT];
+};
+
+static MALLOC_DEFINE(M_SYSCALLSTAT, "syscallstat", "syscall statistics");
+
+static TAILQ_HEAD(, syscallstat) syscallstat_list =
+    TAILQ_HEAD_INITIALIZER(syscallstat_list);
+
+/*
+ * Set up at SI_SUB_LOCK, before the syscalls register their statistics
+ * and destroyed after they deregister them, also when they are linked
+ * in the same kld.
+ */
+static struct sx syscallstat_lock;
+SX_SYSINIT(syscallstat_lock, &syscallstat_lock, "syscallstat");
+
+static int sysctl_syscallstat_reset_all(SYSCTL_HANDLER_ARGS);
+
+static SYSCTL_NODE(_kern, OID_AUTO, syscallstat, CTLFLAG_RW, 0,
+    "Statistics of the fh* and setthread* syscalls");
+SYSCTL_PROC(_kern_syscallstat, OID_AUTO, reset,
+    CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_MPSAFE, NULL, 0,
+    sysctl_syscallstat_reset_all, "I", "Write 1 to reset all statistics");
+
+static uint64_t
+syscallstat_fetch(struct syscallstat *ss, int i)
+{
+
+	return (counter_u64_fetch(ss->ss_ctr[i].ssc_counter) -
+	    ss->ss_ctr[i].ssc_base);
+}
+
+static void
+syscallstat_reset(struct syscallstat *ss)
+{
+	int i;
+
+	for (i = 0; i < SSC_COUNT; i++)
+		ss->ss_ctr[i].ssc_base =
+		    counter_u64_fetch(ss->ss_ctr[i].ssc_counter);
+}
+
+static void
+syscallstat_hist(struct syscallstat *ss, int phase, sbintime_t start)
+{
+	uint64_t ns;
+	int bucket;
+
+	ns = sbttons(sbinuptime() - start);
+	bucket = MIN(flsll(ns), SYSCALLSTAT_NBUCKETS - 1);
+	counter_u64_add(ss->ss_ctr[SSC_HIST(phase) + bucket].ssc_counter, 1);
+}
+
+void
+syscallstat_phase(struct syscallstat *ss, int phase, sbintime_t start)
+{
+
+	KASSERT(phase >= 0 && phase < SYSCALLSTAT_NPHASES,
+	    ("syscallstat_phase: bad phase %d", phase));
+	syscallstat_hist(ss, phase + 1, start);
+}
+
+void
+syscallstat_end(struct syscallstat *ss, sbintime_t start, int error)
+{
+
+	syscallstat_hist(ss, 0, start);
+	if (error < 0 || error >= SYSCALLSTAT_NERRORS - 1)
+		error = SYSCALLSTAT_NERRORS - 1;
+	counter_u64_add(ss->ss_ctr[SSC_CALLS].ssc_counter, 1);
+	counter_u64_add(ss->ss_ctr[SSC_ERRORS + error].ssc_counter, 1);
+}
+
+void
+syscallstat_retry(struct syscallstat *ss)
+{
+
+	counter_u64_add(ss->ss_ctr[SSC_RETRIES].ssc_counter, 1);
+}
+
+static int
+sysctl_syscallstat_counter(SYSCTL_HANDLER_ARGS)
+{
+	uint64_t val;
+
+	val = syscallstat_fetch(arg1, arg2);
+	return (sysctl_handle_64(oidp, &val, 0, req));
+}
+
+/*
+ * "errno:count" for the errnos returned at least once, "other" for
+ * ERESTART, EJUSTRETURN and the like.
+ */
+static int
+sysctl_syscallstat_errors(SYSCTL_HANDLER_ARGS)
+{
+	struct syscallstat *ss;
+	struct sbuf sb;
+	uint64_t val;
+	int error, i;
+
+	ss = arg1;
+	sbuf_new_for_sysctl(&sb, NULL, 128, req);
+	for (i = 0; i < SYSCALLSTAT_NERRORS; i++) {
+		val = syscallstat_fetch(ss, SSC_ERRORS + i);
+		if (val == 0)
+			continue;
+		if (i == SYSCALLSTAT_NERRORS - 1)
+			sbuf_printf(&sb, " other:%ju", (uintmax_t)val);
+		else
+			sbuf_printf(&sb, " %d:%ju", i, (uintmax_t)val);
+	}
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+
+/*
+ * One "ns count" line per non-empty bucket, ns is the exclusive upper
+ * bound of the bucket, 0 for the last one.
+ */
+static int
+sysctl_syscallstat_latency(SYSCTL_HANDLER_ARGS)
+{
+	struct syscallstat *ss;
+	struct sbuf sb;
+	uint64_t val;
+	int error, i;
+
+	ss = arg1;
+	sbuf_new_for_sysctl(&sb, NULL, 128, req);
+	for (i = 0; i < SYSCALLSTAT_NBUCKETS; i++) {
+		val = syscallstat_fetch(ss, SSC_HIST(arg2) + i);
+		if (val == 0)
+			continue;
+		sbuf_printf(&sb, "\n%ju %ju",
+		    i == SYSCALLSTAT_NBUCKETS - 1 ? 0 : (uintmax_t)1 << i,
+		    (uintmax_t)val);
+	}
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+
+static int
+sysctl_syscallstat_reset(SYSCTL_HANDLER_ARGS)
+{
+	int error, val;
+
+	val = 0;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error != 0 || req->newptr == NULL)
+		return (error);
+	if (val != 0)
+		syscallstat_reset(arg1);
+	return (0);
+}
+
+static int
+sysctl_syscallstat_reset_all(SYSCTL_HANDLER_ARGS)
+{
+	struct syscallstat *ss;
+	int error, val;
+
+	val = 0;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error != 0 || req->newptr == NULL)
+		return (error);
+	if (val != 0) {
+		sx_slock(&syscallstat_lock);
+		TAILQ_FOREACH(ss, &syscallstat_list, ss_link)
+			syscallstat_reset(ss);
+		sx_sunlock(&syscallstat_lock);
+	}
+	return (0);
+}
+
+/*
+ * Allocate the statistics of a syscall and publish them under
+ * kern.syscallstat.<name>, phases names its nphases phases.  Meant to
+ * be called from a SYSINIT of the module implementing the syscall.
+ */
+struct syscallstat *
+syscallstat_register(const char *name, const char * const *phases,
+    int nphases)
+{
+	struct syscallstat *ss;
+	struct sysctl_oid *node, *lnode;
+	struct sysctl_oid_list *children, *lchildren;
+	int i;
+
+	KASSERT(nphases >= 0 && nphases <= SYSCALLSTAT_NPHASES,
+	    ("syscallstat_register: %d phases for %s", nphases, name));
+
+	ss = malloc(sizeof(*ss), M_SYSCALLSTAT, M_WAITOK | M_ZERO);
+	for (i = 0; i < SSC_COUNT; i++)
+		ss->ss_ctr[i].ssc_counter = counter_u64_alloc(M_WAITOK);
+
+	sysctl_ctx_init(&ss->ss_ctx);
+	node = SYSCTL_ADD_NODE(&ss->ss_ctx,
+	    SYSCTL_STATIC_CHILDREN(_kern_syscallstat), OID_AUTO, name,
+	    CTLFLAG_RD, NULL, "Statistics of a syscall");
+	children = SYSCTL_CHILDREN(node);
+	SYSCTL_ADD_PROC(&ss->ss_ctx, children, OID_AUTO, "calls",
+	    CTLTYPE_U64 | CTLFLAG_RD | CTLFLAG_MPSAFE, ss, SSC_CALLS,
+	    sysctl_syscallstat_counter, "QU", "Calls");
+	SYSCTL_ADD_PROC(&ss->ss_ctx, children, OID_AUTO, "retries",
+	    CTLTYPE_U64 | CTLFLAG_RD | CTLFLAG_MPSAFE, ss, SSC_RETRIES,
+	    sysctl_syscallstat_counter, "QU", "Internal retries");
+	SYSCTL_ADD_PROC(&ss->ss_ctx, children, OID_AUTO, "errors",
+	    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, ss, 0,
+	    sysctl_syscallstat_errors, "A", "Returns by errno");
+	SYSCTL_ADD_PROC(&ss->ss_ctx, children, OID_AUTO, "reset",
+	    CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_MPSAFE, ss, 0,
+	    sysctl_syscallstat_reset, "I", "Write 1 to reset");
+
+	lnode = SYSCTL_ADD_NODE(&ss->ss_ctx, children, OID_AUTO, "latency",
+	    CTLFLAG_RD, NULL, "log2 histograms of the latency in ns");
+	lchildren = SYSCTL_CHILDREN(lnode);
+	SYSCTL_ADD_PROC(&ss->ss_ctx, lchildren, OID_AUTO, "total",
+	    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, ss, 0,
+	    sysctl_syscallstat_latency, "A", "Whole call");
+	for (i = 0; i < nphases; i++)
+		SYSCTL_ADD_PROC(&ss->ss_ctx, lchildren, OID_AUTO, phases[i],
+		    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, ss, i + 1,
+		    sysctl_syscallstat_latency, "A", "Phase of the call");
+
+	sx_xlock(&syscallstat_lock);
+	TAILQ_INSERT_TAIL(&syscallstat_list, ss, ss_link);
+	sx_xunlock(&syscallstat_lock);
+	return (ss);
+}
+
+void
+syscallstat_deregister(struct syscallstat *ss)
+{
+	int i;
+
+	sx_xlock(&syscallstat_lock);
+	TAILQ_REMOVE(&syscallstat_list, ss, ss_link);
+	sx_xunlock(&syscallstat_lock);
+
+	sysctl_ctx_free(&ss->ss_ctx);
+	for (i = 0; i < SSC_COUNT; i++)
+		counter_u64_free(ss->ss_ctr[i].ssc_counter);
+	free(ss, M_SYSCALLSTAT);
+}
+
+/*
+ * The function called at load/unload.
+ */
+static int
+load(struct module *module, int cmd, void *arg)
+{
+	int error = 0;
+
+	switch (cmd) {
+	case MOD_LOAD :
+		printf("syscallstat loaded\n");
+		break;
+	case MOD_UNLOAD :
+		printf("syscallstat unloaded\n");
+		break;
+	default :
+		error = EOPNOTSUPP;
+		break;
+	}
+	return (error);
+}
+
+static moduledata_t syscallstat_mod = {
+	"syscallstat",
+	load,
+	NULL
+};
+
+DECLARE_MODULE(syscallstat, syscallstat_mod, SI_SUB_SYSCALLS, SI_ORDER_FIRST);
+MODULE_VERSION(syscallstat, 1);
@@ -0,0 +1,73 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2018 Gandi SAS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#ifndef _SYSCALLSTAT_H_
+#define	_SYSCALLSTAT_H_
+
+/*
+ * Per-syscall statistics shared by the fh* and setthread* modules:
+ * calls, returns by errno and retries, and log2 histograms of the
+ * latency of the whole call and of up to SYSCALLSTAT_NPHASES phases.
+ * Everything is kept in per-CPU counters and exported under
+ * kern.syscallstat.<name>.  Writing to a reset sysctl snapshots the
+ * counters instead of zeroing them on every CPU.
+ *
+ * A call is timed from a syscallstat_start() timestamp:
+ *
+ *	start = syscallstat_start();
+ *	...
+ *	t = syscallstat_start();
+ *	error = namei(&nd);
+ *	syscallstat_phase(ss, PHASE_NAMEI, t);
+ *	...
+ *	syscallstat_end(ss, start, error);
+ */
+
+#define	SYSCALLSTAT_NPHASES	4
+#define	SYSCALLSTAT_NBUCKETS	32	/* [2^(n-1), 2^n) ns, the last open */
+
+struct syscallstat;
+
+struct syscallstat *syscallstat_register(const char *name,
+	    const char * const *phases, int nphases);
+void	syscallstat_deregister(struct syscallstat *ss);
+void	syscallstat_phase(struct syscallstat *ss, int phase, sbintime_t start);
+void	syscallstat_end(struct syscallstat *ss, sbintime_t start, int error);
+void	syscallstat_retry(struct syscallstat *ss);
+
+#define	syscallstat_start()	sbinuptime()
+
+/*
+ * Nanoseconds since a syscallstat_start() timestamp, for the arguments
+ * of SDT probes which are only evaluated when the probe is enabled.
+ */
+#define	syscallstat_elapsed(start)	sbttons(sbinuptime() - (start))
+
+#endif /* !_SYSCALLSTAT_H_ */